@@ -54,6 +54,22 @@ void BOX3_AddPoint(Box3 *b, Vector *point) {
   BOX3_CalcCenter(b);
 }
 
+bool BOX3_RayIntersect(const Box3 *b, const Ray *ray, REAL tmax,
+                       REAL *tnear) {
+  return b->cpt && BOX3_RayIntersectBounds(&b->min, &b->max, ray, tmax, tnear);
+}
+
+/*
+ * On teste le sommet de la boite le plus loin dans la direction n
+ */
+bool BOX3_IsBehindPlane(const Box3 *b, const Vector *n, REAL d) {
+  if (!b->cpt)
+    return true;
+  Vector p = {n->x >= 0 ? b->max.x : b->min.x, n->y >= 0 ? b->max.y : b->min.y,
+              n->z >= 0 ? b->max.z : b->min.z};
+  return VECT_DotProduct(n, &p) < d;
+}
+
 static Vector *BOX3_CalcCenter(Box3 *b) {
   assert(b->cpt);
   b->center.x = (b->max.x + b->min.x) / 2;
@@ -14,6 +14,11 @@
  * Macros
  ******************************************************************************/
 
+// 1 + 2 * gamma(3) : rend le test rayon / boite conservatif malgre les arrondis
+// https://jcgt.org/published/0002/02/02/
+#define BOX3_ROBUST_FACTOR                                                     \
+  (sizeof(REAL) == sizeof(float) ? (REAL)1.00000036 : (REAL)1.0000000000000007)
+
 /*******************************************************************************
  * Types
  ******************************************************************************/
@@ -41,4 +46,56 @@ bool BOX3_IsPointInside(Box3 *b, Vector *point);
 
 void BOX3_AddPoint(Box3 *b, Vector *point);
 
+/*
+ * Intersection rayon / boite par les slabs (Williams et al.)
+ * Vrai si le rayon entre dans la boite a une distance t dans [0, tmax],
+ * tnear est alors la distance d'entree.
+ * Le choix de la borne par le signe de la direction evite les min / max et
+ * gere les directions nulles (invdir infini).
+ * Inline : appele pour chaque noeud parcouru dans les BVH.
+ */
+static inline bool BOX3_RayIntersectBounds(const Vector *min, const Vector *max,
+                                           const Ray *ray, REAL tmax,
+                                           REAL *tnear) {
+  const Vector *bounds[2] = {min, max};
+  REAL txmin, txmax, tymin, tymax, tzmin, tzmax;
+
+  txmin = (bounds[ray->sign[0]]->x - ray->origin.x) * ray->invdir.x;
+  txmax = (bounds[1 - ray->sign[0]]->x - ray->origin.x) * ray->invdir.x;
+  tymin = (bounds[ray->sign[1]]->y - ray->origin.y) * ray->invdir.y;
+  tymax = (bounds[1 - ray->sign[1]]->y - ray->origin.y) * ray->invdir.y;
+  txmax *= BOX3_ROBUST_FACTOR;
+  tymax *= BOX3_ROBUST_FACTOR;
+  if (txmin > tymax || tymin > txmax)
+    return false;
+  if (tymin > txmin)
+    txmin = tymin;
+  if (tymax < txmax)
+    txmax = tymax;
+
+  tzmin = (bounds[ray->sign[2]]->z - ray->origin.z) * ray->invdir.z;
+  tzmax = (bounds[1 - ray->sign[2]]->z - ray->origin.z) * ray->invdir.z;
+  tzmax *= BOX3_ROBUST_FACTOR;
+  if (txmin > tzmax || tzmin > txmax)
+    return false;
+  if (tzmin > txmin)
+    txmin = tzmin;
+  if (tzmax < txmax)
+    txmax = tzmax;
+
+  if (txmin > tmax || txmax < 0)
+    return false;
+  *tnear = txmin > 0 ? txmin : 0;
+  return true;
+}
+
+
+bool BOX3_RayIntersect(const Box3 *b, const Ray *ray, REAL tmax,
+                       REAL *tnear);
+
+/*
+ * Vrai si la boite est entierement du cote negatif du plan n . p = d
+ */
+bool BOX3_IsBehindPlane(const Box3 *b, const Vector *n, REAL d);
+
 #endif /* _BOX3_H_ */
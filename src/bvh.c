@@ -0,0 +1,383 @@
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+
+#include "bvh.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*******************************************************************************
+ * Macros
+ ******************************************************************************/
+
+#define BVH_NB_BINS 12
+// Au dela, on coupe meme si le SAH prefere une feuille
+#define BVH_MAX_LEAF 8
+// Borne la profondeur, et donc la pile de parcours
+#define BVH_MAX_DEPTH 64
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/*******************************************************************************
+ * Types
+ ******************************************************************************/
+
+struct BvhBin {
+  Vector min, max;
+  uint32_t count;
+};
+
+struct BvhStackEntry {
+  uint32_t node;
+  REAL tnear;
+};
+
+struct BvhPacketStackEntry {
+  uint32_t node;
+  float tnear;
+};
+
+/*******************************************************************************
+ * Internal function declaration
+ ******************************************************************************/
+
+static uint32_t buildNode(Bvh *bvh, const Box3 *boxes, uint32_t start,
+                          uint32_t count, unsigned depth);
+
+static inline bool intersectNode(const BvhNode *node, const Ray *ray,
+                                 REAL tmax, REAL *tnear);
+
+static inline double axis(const Vector *v, int a);
+static void boundsReset(Vector *min, Vector *max);
+static void boundsGrow(Vector *min, Vector *max, const Vector *pmin,
+                       const Vector *pmax);
+static double boundsArea(const Vector *min, const Vector *max);
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Public function
+ ******************************************************************************/
+
+/*
+ * Construction SAH (par bins) d'une hierarchie sur nbPrims boites
+ */
+Bvh *BVH_Build(const Box3 *boxes, uint32_t nbPrims) {
+  Bvh *bvh = malloc(sizeof(Bvh));
+  assert(bvh);
+  bvh->nbPrims = nbPrims;
+  bvh->nbNodes = 0;
+  bvh->indices = malloc(sizeof(uint32_t) * (nbPrims ? nbPrims : 1));
+  // Un arbre binaire a n feuilles a au plus 2n - 1 noeuds
+  bvh->nodes = malloc(sizeof(BvhNode) * (nbPrims ? 2 * nbPrims - 1 : 1));
+  assert(bvh->indices && bvh->nodes);
+
+  for (uint32_t i = 0; i < nbPrims; i++)
+    bvh->indices[i] = i;
+
+  if (nbPrims) {
+    buildNode(bvh, boxes, 0, nbPrims, 0);
+    bvh->nodes = realloc(bvh->nodes, sizeof(BvhNode) * bvh->nbNodes);
+    assert(bvh->nodes);
+  }
+  // Conversion en float faite une fois pour tous les paquets
+  bvh->packetBounds = malloc(sizeof(*bvh->packetBounds) *
+                             (bvh->nbNodes ? bvh->nbNodes : 1));
+  assert(bvh->packetBounds);
+  for (uint32_t i = 0; i < bvh->nbNodes; i++)
+    PACKET_BoxBounds(&bvh->nodes[i].min, &bvh->nodes[i].max,
+                     bvh->packetBounds[i]);
+  return bvh;
+}
+
+void BVH_Free(Bvh *bvh) {
+  if (!bvh)
+    return;
+  free(bvh->nodes);
+  free(bvh->packetBounds);
+  free(bvh->indices);
+  free(bvh);
+}
+
+/*
+ * Parcours plus-proche-d'abord, on elague avec la meilleure distance courante
+ */
+bool BVH_Intersect(const Bvh *bvh, const Vector *origin, const Vector *dir,
+                   REAL *tmax, BvhPrimCallback callback, void **args) {
+  if (!bvh || !bvh->nbNodes)
+    return false;
+
+  Ray ray;
+  RAY_Init(&ray, origin, dir);
+  struct BvhStackEntry stack[BVH_MAX_DEPTH];
+  unsigned sp = 0;
+  bool hit = false;
+  REAL tnear;
+
+  if (!intersectNode(&bvh->nodes[0], &ray, *tmax, &tnear))
+    return false;
+
+  uint32_t inode = 0;
+  while (1) {
+    const BvhNode *node = &bvh->nodes[inode];
+    if (node->count) {
+      // Feuille
+      for (uint32_t i = 0; i < node->count; i++) {
+        if (callback(bvh->indices[node->start + i], tmax, args))
+          hit = true;
+        if (*tmax <= 0)
+          return hit;
+      }
+    } else {
+      // Noeud interne : on descend dans le plus proche, on empile l'autre
+      uint32_t left = inode + 1, right = node->start;
+      REAL tl = 0, tr = 0;
+      bool hitl = intersectNode(&bvh->nodes[left], &ray, *tmax, &tl);
+      bool hitr = intersectNode(&bvh->nodes[right], &ray, *tmax, &tr);
+      if (hitl && hitr) {
+        assert(sp < BVH_MAX_DEPTH);
+        if (tl <= tr) {
+          stack[sp++] = (struct BvhStackEntry){right, tr};
+          inode = left;
+        } else {
+          stack[sp++] = (struct BvhStackEntry){left, tl};
+          inode = right;
+        }
+        continue;
+      } else if (hitl) {
+        inode = left;
+        continue;
+      } else if (hitr) {
+        inode = right;
+        continue;
+      }
+    }
+
+    // Depile le prochain noeud encore plus proche que la meilleure distance
+    do {
+      if (!sp)
+        return hit;
+      sp--;
+    } while (stack[sp].tnear >= *tmax);
+    inode = stack[sp].node;
+  }
+}
+
+/*
+ * Parcours par paquet, meme schema que BVH_Intersect : on elague avec le plus
+ * grand tmax du paquet
+ */
+unsigned BVH_IntersectPacket(const Bvh *bvh, RayPacket *packet,
+                             BvhPacketCallback callback, void **args) {
+  if (!bvh || !bvh->nbNodes)
+    return 0;
+
+  struct BvhPacketStackEntry stack[BVH_MAX_DEPTH];
+  unsigned sp = 0;
+  unsigned hits = 0;
+  float tnear;
+
+  if (!PACKET_IntersectBox(packet, bvh->packetBounds[0], &tnear))
+    return 0;
+
+  uint32_t inode = 0;
+  while (1) {
+    const BvhNode *node = &bvh->nodes[inode];
+    if (node->count) {
+      for (uint32_t i = 0; i < node->count; i++)
+        hits |= callback(bvh->indices[node->start + i], packet, args);
+    } else {
+      uint32_t left = inode + 1, right = node->start;
+      float tl, tr;
+      unsigned hitl = PACKET_IntersectBox(packet, bvh->packetBounds[left], &tl);
+      unsigned hitr = PACKET_IntersectBox(packet, bvh->packetBounds[right], &tr);
+      if (hitl && hitr) {
+        assert(sp < BVH_MAX_DEPTH);
+        if (tl <= tr) {
+          stack[sp++] = (struct BvhPacketStackEntry){right, tr};
+          inode = left;
+        } else {
+          stack[sp++] = (struct BvhPacketStackEntry){left, tl};
+          inode = right;
+        }
+        continue;
+      } else if (hitl) {
+        inode = left;
+        continue;
+      } else if (hitr) {
+        inode = right;
+        continue;
+      }
+    }
+
+    float tmax = PACKET_MaxT(packet);
+    do {
+      if (!sp)
+        return hits;
+      sp--;
+    } while (stack[sp].tnear >= tmax);
+    inode = stack[sp].node;
+  }
+}
+
+void BVH_Print(const Bvh *bvh) {
+  uint32_t nbLeafs = 0;
+  for (uint32_t i = 0; i < bvh->nbNodes; i++)
+    nbLeafs += bvh->nodes[i].count ? 1 : 0;
+  printf("BVH : %u prims, %u nodes, %u leafs\n", bvh->nbPrims, bvh->nbNodes,
+         nbLeafs);
+}
+
+/*******************************************************************************
+ * Internal function
+ ******************************************************************************/
+
+/*
+ * Construit recursivement le noeud couvrant les primitives
+ * indices[start .. start + count[ et retourne son indice
+ */
+static uint32_t buildNode(Bvh *bvh, const Box3 *boxes, uint32_t start,
+                          uint32_t count, unsigned depth) {
+  uint32_t inode = bvh->nbNodes++;
+  BvhNode *node = &bvh->nodes[inode];
+  uint32_t *indices = bvh->indices + start;
+
+  // Boite du noeud et boite des centroides
+  Vector cmin, cmax;
+  boundsReset(&node->min, &node->max);
+  boundsReset(&cmin, &cmax);
+  for (uint32_t i = 0; i < count; i++) {
+    const Box3 *b = &boxes[indices[i]];
+    boundsGrow(&node->min, &node->max, &b->min, &b->max);
+    boundsGrow(&cmin, &cmax, &b->center, &b->center);
+  }
+
+  node->start = start;
+  node->count = count;
+  if (count <= 1 || depth >= BVH_MAX_DEPTH - 1)
+    return inode;
+
+  // Recherche du meilleur plan de coupe parmi les bins des trois axes
+  int bestAxis = -1;
+  unsigned bestSplit = 0;
+  double bestCost = INFINITY;
+  for (int a = 0; a < 3; a++) {
+    double cminA = axis(&cmin, a);
+    double extent = axis(&cmax, a) - cminA;
+    if (extent <= 0)
+      continue;
+
+    struct BvhBin bins[BVH_NB_BINS];
+    for (unsigned b = 0; b < BVH_NB_BINS; b++) {
+      bins[b].count = 0;
+      boundsReset(&bins[b].min, &bins[b].max);
+    }
+    double k = BVH_NB_BINS / extent;
+    for (uint32_t i = 0; i < count; i++) {
+      const Box3 *box = &boxes[indices[i]];
+      unsigned b = (unsigned)((axis(&box->center, a) - cminA) * k);
+      b = MIN(b, BVH_NB_BINS - 1);
+      bins[b].count++;
+      boundsGrow(&bins[b].min, &bins[b].max, &box->min, &box->max);
+    }
+
+    // Balayage gauche -> droite puis droite -> gauche
+    double leftArea[BVH_NB_BINS - 1];
+    uint32_t leftCount[BVH_NB_BINS - 1];
+    Vector min, max;
+    uint32_t n = 0;
+    boundsReset(&min, &max);
+    for (unsigned b = 0; b < BVH_NB_BINS - 1; b++) {
+      n += bins[b].count;
+      if (bins[b].count)
+        boundsGrow(&min, &max, &bins[b].min, &bins[b].max);
+      leftCount[b] = n;
+      leftArea[b] = n ? boundsArea(&min, &max) : 0;
+    }
+    n = 0;
+    boundsReset(&min, &max);
+    for (unsigned b = BVH_NB_BINS - 1; b > 0; b--) {
+      n += bins[b].count;
+      if (bins[b].count)
+        boundsGrow(&min, &max, &bins[b].min, &bins[b].max);
+      if (!n || !leftCount[b - 1])
+        continue;
+      double cost = leftArea[b - 1] * leftCount[b - 1] +
+                    boundsArea(&min, &max) * n;
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = a;
+        bestSplit = b;
+      }
+    }
+  }
+
+  // Tous les centroides sont confondus : feuille
+  if (bestAxis < 0)
+    return inode;
+
+  // Cout d'une feuille contre cout du parcours (1) + cout des enfants
+  double area = boundsArea(&node->min, &node->max);
+  if (count <= BVH_MAX_LEAF && area > 0 && 1 + bestCost / area >= count)
+    return inode;
+
+  // Partition en place autour du plan choisi
+  double cminA = axis(&cmin, bestAxis);
+  double k = BVH_NB_BINS / (axis(&cmax, bestAxis) - cminA);
+  uint32_t i = 0, j = count;
+  while (i < j) {
+    unsigned b =
+        (unsigned)((axis(&boxes[indices[i]].center, bestAxis) - cminA) * k);
+    if (MIN(b, BVH_NB_BINS - 1) < bestSplit) {
+      i++;
+    } else {
+      uint32_t tmp = indices[i];
+      indices[i] = indices[--j];
+      indices[j] = tmp;
+    }
+  }
+  assert(i > 0 && i < count);
+
+  node->count = 0;
+  buildNode(bvh, boxes, start, i, depth + 1);
+  // Le tableau des noeuds n'est jamais realloue pendant la construction
+  node->start = buildNode(bvh, boxes, start + i, count - i, depth + 1);
+  return inode;
+}
+
+/*
+ * Test rayon / boite du noeud, retourne la distance d'entree tnear
+ */
+static inline bool intersectNode(const BvhNode *node, const Ray *ray,
+                                 REAL tmax, REAL *tnear) {
+  return BOX3_RayIntersectBounds(&node->min, &node->max, ray, tmax, tnear);
+}
+
+static inline double axis(const Vector *v, int a) {
+  return a == 0 ? v->x : (a == 1 ? v->y : v->z);
+}
+
+static void boundsReset(Vector *min, Vector *max) {
+  VECT_Set(min, INFINITY, INFINITY, INFINITY);
+  VECT_Set(max, -INFINITY, -INFINITY, -INFINITY);
+}
+
+static void boundsGrow(Vector *min, Vector *max, const Vector *pmin,
+                       const Vector *pmax) {
+  min->x = MIN(min->x, pmin->x);
+  min->y = MIN(min->y, pmin->y);
+  min->z = MIN(min->z, pmin->z);
+  max->x = MAX(max->x, pmax->x);
+  max->y = MAX(max->y, pmax->y);
+  max->z = MAX(max->z, pmax->z);
+}
+
+static double boundsArea(const Vector *min, const Vector *max) {
+  double dx = max->x - min->x, dy = max->y - min->y, dz = max->z - min->z;
+  return dx * dy + dy * dz + dz * dx;
+}
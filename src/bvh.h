@@ -0,0 +1,96 @@
+#ifndef _BVH_H_
+#define _BVH_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+
+#include "box3.h"
+#include "geo.h"
+#include "raypacket.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*******************************************************************************
+ * Macros
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Types
+ ******************************************************************************/
+
+/*
+ * Noeud de la hierarchie, stocke a plat dans un tableau contigu (ordre en
+ * profondeur) : l'enfant gauche d'un noeud interne est toujours le noeud
+ * suivant, seul l'indice de l'enfant droit est stocke.
+ */
+typedef struct BvhNode BvhNode;
+struct BvhNode {
+  Vector min, max; // Boite englobante du noeud
+  uint32_t start;  // Feuille : premier indice de primitive. Noeud : enfant droit
+  uint32_t count;  // Nombre de primitives de la feuille, 0 si noeud interne
+};
+
+typedef struct Bvh Bvh;
+struct Bvh {
+  BvhNode *nodes;    // Noeuds, la racine est nodes[0]
+  float (*packetBounds)[6]; // Boites des noeuds pour les paquets (cf
+                            // PACKET_BoxBounds)
+  uint32_t nbNodes;  // Nombre de noeuds utilises
+  uint32_t *indices; // Indices des primitives, groupes par feuille
+  uint32_t nbPrims;  // Nombre de primitives
+};
+
+/*
+ * Callback appele pour chaque primitive d'une feuille traversee.
+ * Retourne true si la primitive est touchee a une distance plus faible que
+ * *tmax, auquel cas *tmax doit etre mis a jour.
+ */
+typedef bool (*BvhPrimCallback)(uint32_t prim, REAL *tmax, void **args);
+
+/*
+ * Callback appele pour chaque primitive d'une feuille traversee par un paquet
+ * Retourne le masque des rayons du paquet touches plus pres que leur tmax
+ * (mis a jour par PACKET_IntersectTriangle par exemple)
+ */
+typedef unsigned (*BvhPacketCallback)(uint32_t prim, RayPacket *packet,
+                                      void **args);
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/*
+ * Construction SAH (par bins) d'une hierarchie sur nbPrims boites
+ * Les centres des boites servent de centroides.
+ */
+Bvh *BVH_Build(const Box3 *boxes, uint32_t nbPrims);
+
+void BVH_Free(Bvh *bvh);
+
+/*
+ * Parcours plus-proche-d'abord de la hierarchie par le rayon
+ * origin + t * dir, t dans ]0, *tmax[.
+ * Les noeuds plus loin que *tmax (meilleure distance courante) sont elagues,
+ * un callback qui le ramene a 0 arrete donc le parcours (premier point).
+ * Retourne true si au moins un callback a retourne true.
+ */
+bool BVH_Intersect(const Bvh *bvh, const Vector *origin, const Vector *dir,
+                   REAL *tmax, BvhPrimCallback callback, void **args);
+
+/*
+ * Parcours de la hierarchie par un paquet de rayons
+ * Un noeud est visite si au moins un rayon du paquet le traverse.
+ * Retourne le masque des rayons touches.
+ */
+unsigned BVH_IntersectPacket(const Bvh *bvh, RayPacket *packet,
+                             BvhPacketCallback callback, void **args);
+
+void BVH_Print(const Bvh *bvh);
+
+#endif /* _BVH_H_ */
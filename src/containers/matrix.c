@@ -50,6 +50,18 @@ void MATRIX_Clear(Matrix *m) {
   exit(1);
 }
 
+/*
+ * Change la taille de la matrice, son contenu est perdu. La structure reste
+ * la meme : les pointeurs vers elle restent valides.
+ */
+void MATRIX_Resize(Matrix *m, uint32_t xmax, uint32_t ymax) {
+  free(m->data);
+  m->xmax = xmax;
+  m->ymax = ymax;
+  m->data = malloc(m->elemsize * xmax * ymax);
+  assert(m->data);
+}
+
 void MATRIX_Free(Matrix *m) {
   free(m->data);
   free(m);
@@ -37,6 +37,7 @@ typedef struct Matrix Matrix;
 Matrix *MATRIX_Init(uint32_t xmax, uint32_t ymax, uint32_t elemsize, char *ss);
 void *MATRIX_Edit(Matrix *m, uint32_t x, uint32_t y);
 void MATRIX_Clear(Matrix *m);
+void MATRIX_Resize(Matrix *m, uint32_t xmax, uint32_t ymax);
 void MATRIX_Free(Matrix *m);
 void *MATRIX_Max(Matrix *m, int (*isgreater)(void *, void *));
 
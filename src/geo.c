@@ -44,7 +44,7 @@ const struct Vector VECT_Z = {0, 0, 1};
 /*
  * Initialisation d'un vecteur statique
  */
-struct Vector *VECT_SetStatic(double x, double y, double z) {
+struct Vector *VECT_SetStatic(REAL x, REAL y, REAL z) {
   static struct Vector v;
   v.x = x;
   v.y = y;
@@ -55,7 +55,7 @@ struct Vector *VECT_SetStatic(double x, double y, double z) {
 /*
  * Initialisation de vecteur
  */
-struct Vector *VECT_Set(struct Vector *v, double x, double y, double z) {
+struct Vector *VECT_Set(struct Vector *v, REAL x, REAL y, REAL z) {
   v->x = x;
   v->y = y;
   v->z = z;
@@ -79,18 +79,17 @@ char VECT_Eq(const struct Vector *a, const struct Vector *b) {
 /*
  * Distance au carre entre deux points
  */
-float VECT_DistanceSquare(const struct Vector *a, const struct Vector *b) {
-  static double d1, d2, d3;
-  d1 = (a->x - b->x);
-  d2 = (a->y - b->y);
-  d3 = (a->z - b->z);
+REAL VECT_DistanceSquare(const struct Vector *a, const struct Vector *b) {
+  REAL d1 = (a->x - b->x);
+  REAL d2 = (a->y - b->y);
+  REAL d3 = (a->z - b->z);
   return d1 * d1 + d2 * d2 + d3 * d3;
 }
 
 /*
  * Distance entre deux points
  */
-float VECT_Distance(const struct Vector *a, const struct Vector *b) {
+REAL VECT_Distance(const struct Vector *a, const struct Vector *b) {
   return sqrt(VECT_DistanceSquare(a, b));
 }
 
@@ -127,7 +126,7 @@ struct Vector *VECT_Sub(struct Vector *dest, const struct Vector *a,
  * SOustraction vecteur : a := a - b
  */
 struct Vector *VECT_MultSca(struct Vector *dest, const struct Vector *a,
-                            double lambda) {
+                            REAL lambda) {
   dest->x = a->x * lambda;
   dest->y = a->y * lambda;
   dest->z = a->z * lambda;
@@ -137,7 +136,7 @@ struct Vector *VECT_MultSca(struct Vector *dest, const struct Vector *a,
 /*
  * Produit scalaire
  */
-double VECT_DotProduct(const struct Vector *a, const struct Vector *b) {
+REAL VECT_DotProduct(const struct Vector *a, const struct Vector *b) {
   return a->x * b->x + a->y * b->y + a->z * b->z;
 }
 
@@ -155,7 +154,7 @@ struct Vector *VECT_CrossProduct(struct Vector *dest, const struct Vector *a,
 /*
  * Norme au carré
  */
-double VECT_NormSquare(const struct Vector *v) {
+REAL VECT_NormSquare(const struct Vector *v) {
   return v->x * v->x + v->y * v->y + v->z * v->z;
 }
 
@@ -170,7 +169,7 @@ struct Vector *VECT_Normalise(struct Vector *v) {
  * Angle entre deux vecteurs
  */
 /*
-double VECT_Angle(const struct Vector *a, const struct Vector *b) {
+REAL VECT_Angle(const struct Vector *a, const struct Vector *b) {
   return 0.f;
 }
 */
@@ -185,10 +184,10 @@ bool RayIntersectsTriangle(const struct Vector *rayOrigin,
                            const struct Vector *trpoint1,
                            const struct Vector *trpoint2,
                            struct Vector *outIntersectionPoint) {
-  const double EPSILON = 0.0000001;
+  const REAL EPSILON = 0.0000001;
 
-  static struct Vector edge1, edge2, h, s, q, rab;
-  static double a, f, u, v;
+  struct Vector edge1, edge2, h, s, q, rab;
+  REAL a, f, u, v;
 
   VECT_Sub(&edge1, trpoint1, trpoint0);
   VECT_Sub(&edge2, trpoint2, trpoint0);
@@ -212,7 +211,7 @@ bool RayIntersectsTriangle(const struct Vector *rayOrigin,
 
   // On calcule t pour savoir ou le point d'intersection se situe sur la ligne.
 
-  float t = f * VECT_DotProduct(&edge2, &q);
+  REAL t = f * VECT_DotProduct(&edge2, &q);
   if (t > EPSILON) // Intersection avec le rayon
   {
     VECT_Add(outIntersectionPoint, rayOrigin, VECT_MultSca(&rab, rayVector, t));
@@ -221,6 +220,20 @@ bool RayIntersectsTriangle(const struct Vector *rayOrigin,
     return false;
 }
 
+/*
+ * Initialisation d'un rayon precalcule
+ */
+struct Ray *RAY_Init(struct Ray *ray, const struct Vector *origin,
+                     const struct Vector *dir) {
+  VECT_Cpy(&ray->origin, origin);
+  VECT_Cpy(&ray->dir, dir);
+  VECT_Set(&ray->invdir, 1 / dir->x, 1 / dir->y, 1 / dir->z);
+  ray->sign[0] = ray->invdir.x < 0;
+  ray->sign[1] = ray->invdir.y < 0;
+  ray->sign[2] = ray->invdir.z < 0;
+  return ray;
+}
+
 void VECT_test(void) {
   /*
    p2
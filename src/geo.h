@@ -19,18 +19,41 @@
  * Macros
  ******************************************************************************/
 
+/*
+ * Precision des calculs geometriques (sommets, buffers, lancer de rayons) :
+ * double par defaut, -DGEO_PRECISION=float pour la simple precision
+ */
+#ifndef GEO_PRECISION
+#define GEO_PRECISION double
+#endif
+
 /*******************************************************************************
  * Types
  ******************************************************************************/
 
+typedef GEO_PRECISION REAL;
+
 struct Vector {
-  double x;
-  double y;
-  double z;
+  REAL x;
+  REAL y;
+  REAL z;
 };
 
 typedef struct Vector Vector;
 
+/*
+ * Rayon origin + t * dir precalcule pour les tests rayon / boite
+ * https://www.researchgate.net/publication/220494140_An_Efficient_and_Robust_Ray-Box_Intersection_Algorithm
+ */
+struct Ray {
+  Vector origin;
+  Vector dir;
+  Vector invdir; // 1 / dir, infini si composante nulle
+  int sign[3];   // 1 si la composante de dir est negative
+};
+
+typedef struct Ray Ray;
+
 /*******************************************************************************
  * Variables
  ******************************************************************************/
@@ -46,12 +69,12 @@ extern const struct Vector VECT_Z;
 /*
  * Initialisation d'un vecteur statique
  */
-struct Vector *VECT_SetStatic(double x, double y, double z);
+struct Vector *VECT_SetStatic(REAL x, REAL y, REAL z);
 
 /*
  * Initialisation de vecteur
  */
-struct Vector *VECT_Set(struct Vector *v, double x, double y, double z);
+struct Vector *VECT_Set(struct Vector *v, REAL x, REAL y, REAL z);
 
 /*
  * Copie de vecteur
@@ -66,12 +89,12 @@ char VECT_Eq(const struct Vector *a, const struct Vector *b);
 /*
  * Distance au carre entre deux points
  */
-float VECT_DistanceSquare(const struct Vector *a, const struct Vector *b);
+REAL VECT_DistanceSquare(const struct Vector *a, const struct Vector *b);
 
 /*
  * Distance entre deux points
  */
-float VECT_Distance(const struct Vector *a, const struct Vector *b);
+REAL VECT_Distance(const struct Vector *a, const struct Vector *b);
 
 /*
  * Affichage vecteur
@@ -93,12 +116,12 @@ struct Vector *VECT_Sub(struct Vector *dest, const struct Vector *a,
  * SOustraction vecteur : a := a - b
  */
 struct Vector *VECT_MultSca(struct Vector *dest, const struct Vector *a,
-                            double lambda);
+                            REAL lambda);
 
 /*
  * Produit scalaire
  */
-double VECT_DotProduct(const struct Vector *a, const struct Vector *b);
+REAL VECT_DotProduct(const struct Vector *a, const struct Vector *b);
 
 /*
  * Produit vectorielle
@@ -109,7 +132,7 @@ struct Vector *VECT_CrossProduct(struct Vector *dest, const struct Vector *a,
 /*
  * Norme au carré
  */
-double VECT_NormSquare(const struct Vector *v);
+REAL VECT_NormSquare(const struct Vector *v);
 
 /*
  * Vecteur normalisé
@@ -119,7 +142,7 @@ struct Vector *VECT_Normalise(struct Vector *v);
 /*
  * Angle entre deux vecteurs
  */
-double VECT_Angle(const struct Vector *a, const struct Vector *b);
+REAL VECT_Angle(const struct Vector *a, const struct Vector *b);
 /*
  * RayIntersectsTriangle
  * https://fr.wikipedia.org/wiki/Algorithme_d%27intersection_de_M%C3%B6ller%E2%80%93Trumbore
@@ -130,6 +153,13 @@ bool RayIntersectsTriangle(const struct Vector *rayOrigin,
                            const struct Vector *trpoint1,
                            const struct Vector *trpoint2,
                            struct Vector *outIntersectionPoint);
+
+/*
+ * Initialisation d'un rayon precalcule
+ */
+struct Ray *RAY_Init(struct Ray *ray, const struct Vector *origin,
+                     const struct Vector *dir);
+
 void VECT_test(void);
 
 #endif /* _GEO_H_ */
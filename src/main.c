@@ -7,6 +7,7 @@
 #include "window.h"
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define MODE_TERMINAL 0
@@ -14,13 +15,17 @@
 
 struct Render *rd;
 double camDistFactor = 0.5;
+bool camRotate = true; // Camera en orbite, 'p' pour la figer
 
 void mouse_event(const struct event *event) {
   if (event->data.mouse.dx > 0 || event->data.mouse.dy > 0) {
     struct Mesh *mesh = NULL;
     struct MeshFace *face = NULL;
     struct Vector ray, collisionPoint;
-    RD_CalcRayDir(rd, event->data.mouse.x, event->data.mouse.y, &ray);
+    // Position fenetre -> raster (cf RD_SetFrameBudget)
+    unsigned x = event->data.mouse.x * rd->raster->xmax / rd->outputX;
+    unsigned y = event->data.mouse.y * rd->raster->ymax / rd->outputY;
+    RD_CalcRayDir(rd, x, y, &ray);
     RD_RayCastOnRD(rd, &ray, &collisionPoint, &mesh, &face);
 
     // printf("Mesh : %p, face : %p\n", mesh, face);
@@ -39,6 +44,8 @@ void key_event(const struct event *event) {
       camDistFactor *= 0.95;
     else if (event->data.key.code == 'l')
       camDistFactor *= 1.05;
+    else if (event->data.key.code == 'p')
+      camRotate = !camRotate;
 
     camDistFactor = fmax(camDistFactor, 0);
   }
@@ -46,6 +53,7 @@ void key_event(const struct event *event) {
 
 void user_loop(unsigned int cpt) {
   cpt++;
+  RD_AdaptResolution(rd);
 
   static double angle = 7.1;
   struct Vector *barycentre = &rd->meshs[0]->box.center;
@@ -58,7 +66,10 @@ void user_loop(unsigned int cpt) {
   // printf("d : %f \n", d);
   /* pos */
 
-  angle += 0.05;
+  // Camera figee : les projections et le z buffer sont repris, seul le
+  // surlignage est redessine (cf RD_RenderDeferred)
+  if (camRotate)
+    angle += 0.05;
   cam_pos.x = cos(angle) * d;
   cam_pos.y = cos(angle / 2) * d;
   cam_pos.z = sin(angle) * d;
@@ -68,19 +79,27 @@ void user_loop(unsigned int cpt) {
 
   // Mise a jour des objets
   RD_CalcProjectionVertices(rd); // Calcul des projections
-  RD_CalcZbuffer(rd);            // Calcul du Z buffer
-  RD_calcCacheBarycentres(rd);
-  RD_CalcGbuffer(rd);
+
+  // Rendu differe par tuiles : z buffer, normales, ombrage et negatif en une
+  // passe. Equivalent en passes ecran completes :
+  // RD_CalcZbuffer(rd);
+  // RD_calcCacheBarycentres(rd);
+  // RD_CalcGbuffer(rd);
+  // RD_DrawFill(rd);
+  // RD_DrawZbuffer(rd);
+  // RD_DrawGbuffer(rd);
+  // RASTER_Negate(rd->raster);
+  struct RenderDeferred deferred = {.shading = RD_SHADING_NORMALS,
+                                    .lum = {1, 1, 1},
+                                    .lumColor = CL_CHARTREUSE,
+                                    .background = (color)0xFF000000,
+                                    .negate = true};
+  VECT_Normalise(&deferred.lum);
+  // deferred.shading = RD_SHADING_LUM;
+  RD_RenderDeferred(rd, &deferred);
 
   // Rendu
   // RD_DrawRaytracing(rd);
-  RD_DrawFill(rd);
-
-  RD_DrawZbuffer(rd);
-  RD_DrawGbuffer(rd);
-  Vector lum = {1, 1, 1};
-  VECT_Normalise(&lum);
-  // RD_DrawFbufferWithLum(rd, &lum, CL_CHARTREUSE);
 
   // Rendu debug
   // RD_DrawWireframe(rd);
@@ -88,10 +107,11 @@ void user_loop(unsigned int cpt) {
   // RD_DrawNormales(rd);
   // RD_DrawAxis(rd);
 
-  // Filtres vidéo
-  RASTER_Negate(rd->raster);
+  // Filtres vidéo (cf deferred.negate)
+  // RASTER_Negate(rd->raster);
   // printf("\n================= CONFIG ===============\n");
   // RD_Print(rd);
+  // RD_PrintStats(rd);
   // getchar();
 }
 
@@ -117,6 +137,9 @@ int main(int argc, char **argv) {
   unsigned w = 400;
   unsigned h = 400;
   int mode = MODE_SDL2;
+  double weld = -1;
+  double budget = 0; // Budget d'une image (ms), 0 : resolution fixe
+  bool cull = false;  // Faces de dos rejetees, pour les modeles fermes
 
   char *helpstr =
       "\033[31mNAME\033[m                                              \n"
@@ -131,6 +154,9 @@ int main(int argc, char **argv) {
       "      \033[31m-f\033[m \033[32mFILE\033[m    set 3D file        \n"
       "      \033[31m-x\033[m=\033[32mSIZE\033[m    set windows width  \n"
       "      \033[31m-y\033[m=\033[32mSIZE\033[m    set windows height \n"
+      "      \033[31m-w\033[m=\033[32mEPS\033[m     weld vertices closer than EPS\n"
+      "      \033[31m-b\033[m=\033[32mMS\033[m      scale resolution to a frame budget\n"
+      "      \033[31m-c\033[m        cull back faces (closed models)   \n"
       "                                                                \n";
 
   for (int optind = 1; optind < argc; optind++) {
@@ -150,6 +176,15 @@ int main(int argc, char **argv) {
     case 'y':
       sscanf(argv[optind], "-y=%d", &h);
       break;
+    case 'w':
+      sscanf(argv[optind], "-w=%lf", &weld);
+      break;
+    case 'b':
+      sscanf(argv[optind], "-b=%lf", &budget);
+      break;
+    case 'c':
+      cull = true;
+      break;
     case 'h':
       printf(helpstr, argv[0], argv[0]);
       exit(EXIT_SUCCESS);
@@ -161,15 +196,33 @@ int main(int argc, char **argv) {
   }
 
   rd = RD_Init(w, h);
+  RD_SetFrameBudget(rd, budget / 1000);
+  // Avec RD_DrawRaytracing (cf user_loop) : seuls les pixels decouverts ou
+  // expires sont relances
+  // RD_SetRaytracingHistory(rd, RD_HISTORY_MAX_AGE);
 
   unsigned nbMeshes;
   printf("Loading %s...\n", modele);
-  struct Mesh **meshes = PARSER_Load(modele, &nbMeshes);
+  struct Mesh **meshes = PARSER_LoadWelded(modele, &nbMeshes, weld);
   printf("Loaded %u meshs !\n", nbMeshes);
-  for (unsigned i = 0; i < nbMeshes; i++)
+  double *acmr = malloc(sizeof(double) * (nbMeshes ? nbMeshes : 1));
+  for (unsigned i = 0; i < nbMeshes; i++) {
+    if (meshes[i]->nbWelded)
+      printf("  mesh %u : %u welded vertices\n", i, meshes[i]->nbWelded);
+    acmr[i] = MESH_CalcAcmr(meshes[i]);
+    MESH_SetBackfaceCulling(meshes[i], cull);
     RD_AddMesh(rd, meshes[i]);
+  }
 
+  RD_CalcLods(rd);
+  RD_CalcClusters(rd);
+  RD_OptimizeVertexCache(rd);
+  for (unsigned i = 0; i < nbMeshes; i++)
+    printf("  mesh %u : ACMR %.3f -> %.3f\n", i, acmr[i],
+           MESH_CalcAcmr(meshes[i]));
+  free(acmr);
   RD_CalcNormales(rd);
+  RD_CalcBvh(rd);
 
   /**
   RD_Print(rd);
@@ -4,9 +4,10 @@
 
 #include "mesh.h"
 #include "color.h"
-#include "containers/arraylistp.h"
+#include "containers/arraylist.h"
 #include "geo.h"
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,14 +16,88 @@
  * Macros
  ******************************************************************************/
 
+// Sommets par case de la table de fusion, avant agrandissement
+#define MESH_WELD_LOAD 1
+// Pas de sommet (fin de liste de la table de fusion)
+#define MESH_WELD_NONE UINT32_MAX
+
+// Face pas encore rangee dans un cluster
+#define MESH_CLUSTER_NONE UINT32_MAX
+
+// Score des sommets de l'optimisation du cache (Forsyth) : les 3 sommets du
+// dernier triangle, puis decroissance avec la position dans le cache, plus un
+// bonus pour les sommets ayant peu de triangles restants
+#define MESH_VCACHE_LAST_TRI 0.75f
+#define MESH_VCACHE_DECAY 1.5f
+#define MESH_VCACHE_VALENCE_SCALE 2.0f
+#define MESH_VCACHE_VALENCE_POWER 0.5f
+// Sommet hors du cache / pas encore renumerote
+#define MESH_VCACHE_NONE UINT32_MAX
+
 /*******************************************************************************
  * Types
  ******************************************************************************/
 
+/*
+ * Grille de cote epsilon hachee : un sommet a moins de epsilon d'un autre est
+ * dans sa case ou une case voisine. Les sommets d'une case sont chaines.
+ */
+struct MeshWeld {
+  REAL epsilon;
+  uint32_t *heads;    // Premier sommet de chaque case hachee
+  uint32_t nbBuckets; // Puissance de 2
+  ArrayList *next;    // uint32_t : sommet suivant dans la meme case
+};
+
+/*
+ * Sommet alloue par MESH_VERT_Init, hors du mesh : il garde sa position et,
+ * une fois ajoute par MESH_AddVertex, l'indice qu'il a recu
+ */
+typedef struct MeshVertexRef MeshVertexRef;
+struct MeshVertexRef {
+  MeshVertex vertex; // En premier : MeshVertex * <-> MeshVertexRef *
+  Vector world;
+  Mesh *mesh; // Mesh auquel il a ete ajoute, NULL sinon
+  uint32_t index;
+};
+
+/*
+ * Face allouee par MESH_FACE_Init, hors du mesh : ses sommets sont des
+ * MeshVertexRef, traduits en indices par MESH_AddFace
+ */
+typedef struct MeshFaceRef MeshFaceRef;
+struct MeshFaceRef {
+  MeshFace face; // En premier : MeshFace * <-> MeshFaceRef *
+  MeshVertex *p0, *p1, *p2;
+};
+
 /*******************************************************************************
  * Internal function declaration
  ******************************************************************************/
 
+static void resetAdjacency(Mesh *mesh);
+static void resetClusters(Mesh *mesh);
+static void permuteFaces(Mesh *mesh, const uint32_t *order);
+static bool faceNormal(const Mesh *mesh, size_t index, Vector *n);
+static void calcClusterBounds(const Mesh *mesh, MeshCluster *cluster);
+static float vcacheVertexScore(uint32_t cachePos, uint32_t remaining);
+static void vcacheOrderFaces(const Mesh *mesh, const uint32_t *faceIds,
+                             uint32_t start, uint32_t end, uint32_t lookEnd,
+                             uint32_t *order, uint32_t *local, uint32_t *lru,
+                             unsigned *lruSize);
+static double calcAcmr(const Mesh *mesh, const uint32_t *order);
+static void groupClusters(const Mesh *mesh, uint32_t *order,
+                          MeshCluster *clusters);
+static void permuteVertices(Mesh *mesh, const uint32_t *remap);
+static inline uint32_t weldBucket(const MeshWeld *weld, int64_t cx, int64_t cy,
+                                  int64_t cz);
+static inline int64_t weldCell(const MeshWeld *weld, REAL x);
+static uint32_t weldFind(const Mesh *mesh, const Vector *p);
+static void weldInsert(Mesh *mesh, uint32_t index);
+static void weldLink(MeshWeld *weld, const Mesh *mesh, uint32_t index);
+static void weldUnlink(MeshWeld *weld, const Mesh *mesh, uint32_t index);
+static void weldRehash(Mesh *mesh, uint32_t nbBuckets);
+
 /*******************************************************************************
  * Variables
  ******************************************************************************/
@@ -31,29 +106,46 @@
  * Public function
  ******************************************************************************/
 
+/*
+ * Anciennes fonctions, sur des sommets et faces alloues hors du mesh (a
+ * liberer par l'appelant avec free) : MESH_AddVertex et MESH_AddFace les
+ * copient dans le stockage contigu du mesh
+ */
+
 // Initialisation VERTEX
-extern MeshVertex *MESH_VERT_Set(MeshVertex *v, double x, double y, double z) {
+extern MeshVertex *MESH_VERT_Set(MeshVertex *v, REAL x, REAL y, REAL z) {
   assert(v);
-  v->world.x = x;
-  v->world.y = y;
-  v->world.z = z;
+  MeshVertexRef *ref = (MeshVertexRef *)v;
+  ref->world = (Vector){x, y, z};
+  // Deja ajoute : le sommet du mesh suit, comme quand il etait partage
+  if (ref->mesh)
+    MESH_SetVertexPos(ref->mesh, ref->index, &ref->world);
   return v;
 }
 
-extern MeshVertex *MESH_VERT_Init(double x, double y, double z) {
-  return MESH_VERT_Set(malloc(sizeof(MeshVertex)), x, y, z);
+extern MeshVertex *MESH_VERT_Init(REAL x, REAL y, REAL z) {
+  MeshVertexRef *ref = malloc(sizeof(MeshVertexRef));
+  assert(ref);
+  ref->vertex.normal = VECT_0;
+  ref->mesh = NULL;
+  ref->index = 0;
+  return MESH_VERT_Set(&ref->vertex, x, y, z);
+}
+
+extern void MESH_VERT_Print(const MeshVertex *v) {
+  VECT_Print(&((const MeshVertexRef *)v)->world);
 }
 
-extern void MESH_VERT_Print(MeshVertex *v) { VECT_Print(&v->world); }
 /*
  * Set une face
  */
 extern MeshFace *MESH_FACE_Set(MeshFace *mf, MeshVertex *p0, MeshVertex *p1,
                                MeshVertex *p2, color c) {
   assert(mf);
-  mf->p0 = p0;
-  mf->p1 = p1;
-  mf->p2 = p2;
+  MeshFaceRef *ref = (MeshFaceRef *)mf;
+  ref->p0 = p0;
+  ref->p1 = p1;
+  ref->p2 = p2;
   mf->color = c;
   return mf;
 }
@@ -63,7 +155,10 @@ extern MeshFace *MESH_FACE_Set(MeshFace *mf, MeshVertex *p0, MeshVertex *p1,
  */
 extern MeshFace *MESH_FACE_Init(MeshVertex *p1, MeshVertex *p2, MeshVertex *p3,
                                 color c) {
-  return MESH_FACE_Set(malloc(sizeof(MeshFace)), p1, p2, p3, c);
+  MeshFaceRef *ref = malloc(sizeof(MeshFaceRef));
+  assert(ref);
+  ref->face.normal = VECT_0;
+  return MESH_FACE_Set(&ref->face, p1, p2, p3, c);
 }
 
 // Pour des points dans le même plan
@@ -83,10 +178,17 @@ extern MeshFace **MESH_FACE_FromVertices(MeshVertex **vertices,
   return faces;
 }
 
-extern void MESH_FACE_Print(struct MeshFace *face) {
-  MESH_VERT_Print(face->p0);
-  MESH_VERT_Print(face->p1);
-  MESH_VERT_Print(face->p2);
+extern void MESH_FACE_Print(const MeshFace *face) {
+  const MeshFaceRef *ref = (const MeshFaceRef *)face;
+  MESH_VERT_Print(ref->p0);
+  MESH_VERT_Print(ref->p1);
+  MESH_VERT_Print(ref->p2);
+}
+
+extern void MESH_PrintFace(const Mesh *mesh, size_t index) {
+  Vector p;
+  for (unsigned k = 0; k < 3; k++)
+    VECT_Print(MESH_GetFaceVertexPos(mesh, index, k, &p));
 }
 
 /*
@@ -94,69 +196,257 @@ extern void MESH_FACE_Print(struct MeshFace *face) {
  */
 extern Mesh *MESH_Init(void) {
   Mesh *m = malloc(sizeof(Mesh));
-  m->vertices = ARRLISTP_Create();
-  m->faces = ARRLISTP_Create();
+  m->vertices = ARRLIST_Create(sizeof(MeshVertex));
+  m->faces = ARRLIST_Create(sizeof(MeshFace));
+  m->indices = ARRLIST_Create(3 * sizeof(uint32_t));
+  m->posX = m->posY = m->posZ = NULL;
+  m->posAlloc = 0;
   m->name = NULL;
+  m->bvh = NULL;
+  m->triangles = NULL;
+  m->vertexFacesStart = m->vertexFaces = NULL;
+  m->clusters = NULL;
+  m->nbClusters = 0;
+  m->weld = NULL;
+  m->nbWelded = 0;
+  m->nbLods = 0;
+  m->lod = 0;
+  m->backfaceCulling = false;
+  m->version = 0;
   BOX3_Reset(&m->box);
   return m;
 }
 
 /*
- * Set une face statique
+ * Libere le mesh et ses niveaux de detail
  */
-/*
-struct MeshFace *MESH_FACE_SetStatic(struct Vector *p0, struct Vector *p1,
-                                     struct Vector *p2, color c) {
-  static struct MeshFace mf;
-  mf.p0 = p0;
-  mf.p1 = p1;
-  mf.p2 = p2;
-  mf.color = c;
-  return &mf;
+extern void MESH_Free(Mesh *mesh) {
+  for (unsigned i = 0; i < mesh->nbLods; i++)
+    MESH_Free(mesh->lods[i]);
+  MESH_SetWeld(mesh, -1);
+  resetAdjacency(mesh);
+  resetClusters(mesh);
+  BVH_Free(mesh->bvh);
+  free(mesh->triangles);
+  free(mesh->posX);
+  free(mesh->posY);
+  free(mesh->posZ);
+  ARRLIST_Free(mesh->vertices);
+  ARRLIST_Free(mesh->faces);
+  ARRLIST_Free(mesh->indices);
+  free(mesh->name);
+  free(mesh);
 }
-*/
 
 /*
  * Retourne le nombre de faces du mesh
  */
 extern size_t MESH_GetNbFace(const Mesh *mesh) {
-  return ARRLISTP_GetSize(mesh->faces);
+  return ARRLIST_GetSize(mesh->faces);
 }
 
 /*
  * Retourne le nombre de sommets du mesh
  */
 extern size_t MESH_GetNbVertice(const Mesh *mesh) {
-  return ARRLISTP_GetSize(mesh->vertices);
+  return ARRLIST_GetSize(mesh->vertices);
 }
 
 /*
  * Retourne le vecteur de face
  */
 extern MeshFace *MESH_GetFace(const Mesh *mesh, size_t index) {
-  return ARRLISTP_Get(mesh->faces, index);
+  return ARRLIST_Get(mesh->faces, index);
+}
+
+/*
+ * Retourne l'indice d'une face du mesh
+ */
+extern size_t MESH_GetFaceIndex(const Mesh *mesh, const MeshFace *face) {
+  size_t index = face - (MeshFace *)ARRLIST_GetData(mesh->faces);
+  assert(index < MESH_GetNbFace(mesh));
+  return index;
+}
+
+/*
+ * Retourne les indices des trois sommets de la face
+ */
+extern const uint32_t *MESH_GetFaceIndices(const Mesh *mesh, size_t index) {
+  return ARRLIST_Get(mesh->indices, index);
+}
+
+/*
+ * Retourne le k-ieme sommet (0, 1 ou 2) de la face
+ */
+extern MeshVertex *MESH_GetFaceVertex(const Mesh *mesh, size_t index,
+                                      unsigned k) {
+  assert(k < 3);
+  return MESH_GetVertex(mesh, MESH_GetFaceIndices(mesh, index)[k]);
 }
 
 /*
  * Retourne le sommet
  */
 extern MeshVertex *MESH_GetVertex(const Mesh *mesh, size_t index) {
-  return ARRLISTP_Get(mesh->vertices, index);
+  return ARRLIST_Get(mesh->vertices, index);
+}
+
+/*
+ * Copie la position du sommet dans pos et retourne pos
+ */
+extern Vector *MESH_GetVertexPos(const Mesh *mesh, size_t index, Vector *pos) {
+  assert(index < MESH_GetNbVertice(mesh));
+  pos->x = mesh->posX[index];
+  pos->y = mesh->posY[index];
+  pos->z = mesh->posZ[index];
+  return pos;
+}
+
+/*
+ * Position du sommet k (0, 1 ou 2) de la face
+ */
+extern Vector *MESH_GetFaceVertexPos(const Mesh *mesh, size_t index,
+                                     unsigned k, Vector *pos) {
+  assert(k < 3);
+  return MESH_GetVertexPos(mesh, MESH_GetFaceIndices(mesh, index)[k], pos);
+}
+
+/*
+ * Deplace un sommet. La boite englobante ne fait que grandir ; la hierarchie,
+ * les triangles et les clusters sont invalides. Les normales et les niveaux de
+ * detail ne sont pas recalcules.
+ */
+extern void MESH_SetVertexPos(Mesh *mesh, size_t index, const Vector *pos) {
+  assert(index < MESH_GetNbVertice(mesh));
+  Vector p = *pos;
+  // Le sommet change de case de fusion
+  if (mesh->weld)
+    weldUnlink(mesh->weld, mesh, index);
+  mesh->posX[index] = p.x;
+  mesh->posY[index] = p.y;
+  mesh->posZ[index] = p.z;
+  if (mesh->weld)
+    weldLink(mesh->weld, mesh, index);
+  BOX3_AddPoint(&mesh->box, &p);
+  BVH_Free(mesh->bvh);
+  mesh->bvh = NULL;
+  free(mesh->triangles);
+  mesh->triangles = NULL;
+  resetClusters(mesh);
+  mesh->version++;
+}
+
+/*
+ * Active la fusion des sommets ajoutes a moins de epsilon (> 0) d'un sommet
+ * existant, ou la desactive (epsilon < 0) et libere la table
+ */
+extern void MESH_SetWeld(Mesh *mesh, REAL epsilon) {
+  if (mesh->weld) {
+    free(mesh->weld->heads);
+    ARRLIST_Free(mesh->weld->next);
+    free(mesh->weld);
+    mesh->weld = NULL;
+  }
+  if (epsilon < 0)
+    return;
+  assert(epsilon > 0);
+  mesh->weld = malloc(sizeof(MeshWeld));
+  assert(mesh->weld);
+  mesh->weld->epsilon = epsilon;
+  mesh->weld->heads = NULL;
+  mesh->weld->next = ARRLIST_Create(sizeof(uint32_t));
+  // Les sommets deja presents sont indexes
+  weldRehash(mesh, 64);
+}
+
+/*
+ * Ajoute un sommet au mesh et retourne son indice. Si la fusion est active et
+ * qu'un sommet est a moins de epsilon, c'est son indice qui est retourne.
+ */
+extern uint32_t MESH_AddVertexPos(Mesh *mesh, REAL x, REAL y, REAL z) {
+  if (mesh->weld) {
+    Vector p = {x, y, z};
+    uint32_t found = weldFind(mesh, &p);
+    if (found != MESH_WELD_NONE) {
+      mesh->nbWelded++;
+      return found;
+    }
+  }
+  size_t n = MESH_GetNbVertice(mesh);
+  assert(n < MESH_WELD_NONE);
+  if (n == mesh->posAlloc) {
+    size_t alloc = n ? 2 * n : MESH_SOA_WIDTH;
+    REAL **streams[3] = {&mesh->posX, &mesh->posY, &mesh->posZ};
+    for (int k = 0; k < 3; k++) {
+      *streams[k] = realloc(*streams[k], alloc * sizeof(REAL));
+      assert(*streams[k]);
+      memset(*streams[k] + n, 0, (alloc - n) * sizeof(REAL));
+    }
+    mesh->posAlloc = alloc;
+  }
+  mesh->posX[n] = x;
+  mesh->posY[n] = y;
+  mesh->posZ[n] = z;
+  MeshVertex vertex = {.normal = VECT_0};
+  mesh->version++;
+  resetAdjacency(mesh);
+  BOX3_AddPoint(&mesh->box, &(Vector){x, y, z});
+  ARRLIST_Add(mesh->vertices, &vertex);
+  if (mesh->weld)
+    weldInsert(mesh, n);
+  return n;
+}
+
+/*
+ *  Ajoute une face (triangle i0 i1 i2) au mesh
+ */
+extern MeshFace *MESH_AddTriangle(Mesh *mesh, uint32_t i0, uint32_t i1,
+                                  uint32_t i2, color c) {
+  const uint32_t indices[3] = {i0, i1, i2};
+  for (int k = 0; k < 3; k++)
+    assert(indices[k] < MESH_GetNbVertice(mesh));
+  // La hierarchie, les triangles, l'adjacence et les clusters ne sont plus a
+  // jour
+  BVH_Free(mesh->bvh);
+  mesh->bvh = NULL;
+  free(mesh->triangles);
+  mesh->triangles = NULL;
+  resetAdjacency(mesh);
+  resetClusters(mesh);
+  mesh->version++;
+  ARRLIST_Add(mesh->indices, indices);
+  MeshFace face = {.color = c};
+  return ARRLIST_Add(mesh->faces, &face);
 }
 
 /*
- * Ajoute un sommet au mesh si il n'existe pas. On le retourne.
+ * Ajoute au mesh un sommet de MESH_VERT_Init (copie) et le retourne, il
+ * retient son indice pour MESH_AddFace
  */
 extern MeshVertex *MESH_AddVertex(Mesh *mesh, MeshVertex *vertex) {
-  BOX3_AddPoint(&mesh->box, &vertex->world);
-  return ARRLISTP_Add(mesh->vertices, vertex);
+  MeshVertexRef *ref = (MeshVertexRef *)vertex;
+  ref->index =
+      MESH_AddVertexPos(mesh, ref->world.x, ref->world.y, ref->world.z);
+  ref->mesh = mesh;
+  MESH_GetVertex(mesh, ref->index)->normal = vertex->normal;
+  return vertex;
 }
 
 /*
- *  Ajoute une face au mesh
+ *  Ajoute au mesh une face de MESH_FACE_Init (copie), ses sommets doivent y
+ *  avoir ete ajoutes. Retourne la face du mesh.
  */
 extern MeshFace *MESH_AddFace(Mesh *mesh, MeshFace *face) {
-  return ARRLISTP_Add(mesh->faces, face);
+  const MeshFaceRef *ref = (const MeshFaceRef *)face;
+  const MeshVertexRef *p[3] = {(const MeshVertexRef *)ref->p0,
+                               (const MeshVertexRef *)ref->p1,
+                               (const MeshVertexRef *)ref->p2};
+  for (int k = 0; k < 3; k++)
+    assert(p[k]->mesh == mesh);
+  MeshFace *added = MESH_AddTriangle(mesh, p[0]->index, p[1]->index,
+                                     p[2]->index, face->color);
+  added->normal = face->normal;
+  return added;
 }
 
 /*
@@ -167,37 +457,383 @@ extern void MESH_AddFaces(Mesh *mesh, MeshFace **faces, unsigned nbFaces) {
     MESH_AddFace(mesh, faces[i]);
 }
 
+/*
+ * Ajoute un polygone plan, decoupe en eventail de triangles. Les triangles
+ * ayant deux fois le meme sommet (sommets fusionnes) sont ignores.
+ */
+extern void MESH_AddPolygon(Mesh *mesh, const uint32_t *indices,
+                            unsigned nbVertices, color c) {
+  for (unsigned i = 2; i < nbVertices; i++) {
+    uint32_t i0 = indices[0], i1 = indices[i - 1], i2 = indices[i];
+    if (i0 != i1 && i1 != i2 && i2 != i0)
+      MESH_AddTriangle(mesh, i0, i1, i2, c);
+  }
+}
+
 /* Definit le nom de la mesh */
 extern void MESH_SetName(Mesh *mesh, const char *name) {
   mesh->name = realloc(mesh->name, strlen(name) + 1);
   strcpy(mesh->name, name);
 }
 
+/*
+ * Active ou non le rejet des faces de dos, pour le mesh et ses niveaux de
+ * detail. La version n'est incrementee que si le mode change.
+ */
+extern void MESH_SetBackfaceCulling(Mesh *mesh, bool enabled) {
+  for (unsigned i = 0; i < mesh->nbLods; i++)
+    MESH_SetBackfaceCulling(mesh->lods[i], enabled);
+  if (mesh->backfaceCulling == enabled)
+    return;
+  mesh->backfaceCulling = enabled;
+  mesh->version++;
+}
+
+/*
+ * Retourne le niveau de detail a dessiner (cf Mesh.lod)
+ */
+extern Mesh *MESH_GetLod(Mesh *mesh) {
+  assert(mesh->lod <= mesh->nbLods);
+  return mesh->lod ? mesh->lods[mesh->lod - 1] : mesh;
+}
+
 extern void MESH_Print(const Mesh *mesh) {
   printf("MESH : %s\n", mesh->name);
   printf("NBTR : %lu\n", MESH_GetNbFace(mesh));
   for (size_t i_face = 0; i_face < MESH_GetNbFace(mesh); i_face++) {
     printf("TR[%lu]:{", i_face);
-    MESH_FACE_Print(ARRLISTP_Get(mesh->faces, i_face));
+    MESH_PrintFace(mesh, i_face);
     printf("}\n");
   }
 }
 
+/*
+ * Construit l'adjacence sommet -> faces par tri par denombrement, en
+ * O(sommets + faces). Ne fait rien si elle est a jour.
+ */
+extern void MESH_CalcAdjacency(Mesh *mesh) {
+  if (mesh->vertexFacesStart)
+    return;
+  size_t nbVertices = MESH_GetNbVertice(mesh), nbFaces = MESH_GetNbFace(mesh);
+  uint32_t *start = calloc(nbVertices + 1, sizeof(uint32_t));
+  uint32_t *faces = malloc(sizeof(uint32_t) * 3 * (nbFaces ? nbFaces : 1));
+  assert(start && faces);
+
+  // Nombre de faces par sommet, puis sommes prefixes (decalees d'un cran pour
+  // servir de curseurs d'ecriture)
+  for (size_t i = 0; i < nbFaces; i++) {
+    const uint32_t *idx = MESH_GetFaceIndices(mesh, i);
+    for (int k = 0; k < 3; k++)
+      start[idx[k] + 1]++;
+  }
+  for (size_t i = 0; i < nbVertices; i++)
+    start[i + 1] += start[i];
+  for (size_t i = 0; i < nbFaces; i++) {
+    const uint32_t *idx = MESH_GetFaceIndices(mesh, i);
+    for (int k = 0; k < 3; k++)
+      faces[start[idx[k]]++] = i;
+  }
+  // Chaque curseur est au debut du sommet suivant : on decale
+  memmove(start + 1, start, sizeof(uint32_t) * nbVertices);
+  start[0] = 0;
+
+  mesh->vertexFacesStart = start;
+  mesh->vertexFaces = faces;
+}
+
+/*
+ * Retourne les faces contenant le sommet (cf MESH_CalcAdjacency)
+ */
+extern const uint32_t *MESH_GetVertexFaces(const Mesh *mesh, size_t index,
+                                           uint32_t *nbFaces) {
+  assert(mesh->vertexFacesStart && index < MESH_GetNbVertice(mesh));
+  *nbFaces = mesh->vertexFacesStart[index + 1] - mesh->vertexFacesStart[index];
+  return &mesh->vertexFaces[mesh->vertexFacesStart[index]];
+}
+
+/*
+ * Normales des sommets : moyenne des normales des faces adjacentes ponderee
+ * par l'angle de la face au sommet (independante de la triangulation)
+ */
 extern void MESH_CalcVerticesNormales(Mesh *mesh) {
-  static MeshVertex *v;
-  static MeshFace *f;
-  for (size_t iv = 0; iv < MESH_GetNbVertice(mesh); iv++) {
-    v = MESH_GetVertex(mesh, iv);
+  mesh->version++;
+  MESH_CalcAdjacency(mesh);
+  MESH_CalcVerticesNormalesRange(mesh, 0, MESH_GetNbVertice(mesh));
+}
+
+/*
+ * Normales des sommets [start, end[ : chaque sommet ne lit que ses faces, des
+ * intervalles disjoints peuvent etre calcules en parallele. La version du mesh
+ * n'est pas incrementee (cf Mesh.version).
+ */
+extern void MESH_CalcVerticesNormalesRange(Mesh *mesh, size_t start,
+                                           size_t end) {
+  assert(mesh->vertexFacesStart && end <= MESH_GetNbVertice(mesh));
+  for (size_t iv = start; iv < end; iv++) {
+    MeshVertex *v = MESH_GetVertex(mesh, iv);
+    uint32_t nbFaces;
+    const uint32_t *faces = MESH_GetVertexFaces(mesh, iv, &nbFaces);
     VECT_Cpy(&v->normal, &VECT_0);
-    // On somme les normales des faces qui contiennent v;
-    for (size_t i = 0; i < MESH_GetNbFace(mesh); i++) {
-      f = MESH_GetFace(mesh, i);
-      if (v == f->p0 || v == f->p1 || v == f->p2)
-        VECT_Add(&v->normal, &v->normal, &f->normal);
+    for (uint32_t i = 0; i < nbFaces; i++) {
+      const uint32_t *idx = MESH_GetFaceIndices(mesh, faces[i]);
+      // Aretes partant du sommet
+      unsigned k = idx[0] == iv ? 0 : idx[1] == iv ? 1 : 2;
+      Vector p, p1, p2, e1, e2, n;
+      MESH_GetVertexPos(mesh, iv, &p);
+      VECT_Sub(&e1, MESH_GetVertexPos(mesh, idx[(k + 1) % 3], &p1), &p);
+      VECT_Sub(&e2, MESH_GetVertexPos(mesh, idx[(k + 2) % 3], &p2), &p);
+      VECT_CrossProduct(&n, &e1, &e2);
+      REAL norm = sqrt(VECT_NormSquare(&n));
+      if (norm == 0) // Face degeneree
+        continue;
+      REAL angle = atan2(norm, VECT_DotProduct(&e1, &e2));
+      VECT_MultSca(&n, &n, angle / norm);
+      VECT_Add(&v->normal, &v->normal, &n);
     }
     VECT_Normalise(&v->normal);
   }
 }
+/*
+ * Construit la hierarchie de boites englobantes des faces du mesh et les
+ * triangles precalcules, ranges dans l'ordre des feuilles.
+ * Ne fait rien si la geometrie n'a pas change depuis le dernier appel.
+ */
+extern void MESH_CalcBvh(Mesh *mesh) {
+  if (mesh->bvh)
+    return;
+
+  size_t nbFaces = MESH_GetNbFace(mesh);
+  Box3 *boxes = malloc(sizeof(Box3) * (nbFaces ? nbFaces : 1));
+  MeshTriangle *tris = malloc(sizeof(MeshTriangle) * (nbFaces ? nbFaces : 1));
+  assert(boxes && tris);
+  for (size_t i = 0; i < nbFaces; i++) {
+    BOX3_Reset(&boxes[i]);
+    for (unsigned k = 0; k < 3; k++) {
+      Vector p;
+      BOX3_AddPoint(&boxes[i], MESH_GetFaceVertexPos(mesh, i, k, &p));
+    }
+  }
+
+  mesh->bvh = BVH_Build(boxes, nbFaces);
+  free(boxes);
+
+  // Triangles dans l'ordre des feuilles : les feuilles deviennent contigues
+  for (size_t k = 0; k < nbFaces; k++) {
+    size_t i_face = mesh->bvh->indices[k];
+    const uint32_t *v = MESH_GetFaceIndices(mesh, i_face);
+    MeshTriangle *tri = &tris[k];
+    REAL *p[3] = {tri->p0, tri->p1, tri->p2};
+    for (unsigned j = 0; j < 3; j++) {
+      p[j][0] = mesh->posX[v[j]];
+      p[j][1] = mesh->posY[v[j]];
+      p[j][2] = mesh->posZ[v[j]];
+    }
+    tri->face = mesh->bvh->indices[k];
+    // Les primitives des feuilles designent maintenant les triangles
+    mesh->bvh->indices[k] = k;
+  }
+  free(mesh->triangles);
+  mesh->triangles = tris;
+}
+
+/*
+ * Partition des faces en clusters d'au plus MESH_CLUSTER_MAX_FACES faces
+ * voisines (partageant un sommet), grandis en largeur depuis la premiere face
+ * libre. Une face dont la normale s'ecarte trop de la normale moyenne du
+ * cluster est laissee aux suivants pour garder des cones etroits.
+ * Les faces sont reordonnees pour que chaque cluster soit contigu : la
+ * hierarchie et l'adjacence sont a recalculer.
+ */
+extern void MESH_CalcClusters(Mesh *mesh) {
+  size_t nbFaces = MESH_GetNbFace(mesh);
+  resetClusters(mesh);
+  MESH_CalcAdjacency(mesh);
+
+  size_t alloc = nbFaces ? nbFaces : 1;
+  Vector *normals = malloc(sizeof(Vector) * alloc);
+  bool *valid = malloc(sizeof(bool) * alloc);
+  uint32_t *owner = malloc(sizeof(uint32_t) * alloc); // Cluster de la face
+  uint32_t *seen = malloc(sizeof(uint32_t) * alloc);  // Dernier cluster vu
+  uint32_t *queue = malloc(sizeof(uint32_t) * alloc);
+  uint32_t *order = malloc(sizeof(uint32_t) * alloc);
+  ArrayList *clusters = ARRLIST_Create(sizeof(MeshCluster));
+  assert(normals && valid && owner && seen && queue && order);
+  for (size_t i = 0; i < nbFaces; i++) {
+    valid[i] = faceNormal(mesh, i, &normals[i]);
+    owner[i] = seen[i] = MESH_CLUSTER_NONE;
+  }
+
+  uint32_t nbOrdered = 0;
+  for (size_t seed = 0; seed < nbFaces; seed++) {
+    if (owner[seed] != MESH_CLUSTER_NONE)
+      continue;
+    uint32_t id = ARRLIST_GetSize(clusters);
+    MeshCluster cluster = {.start = nbOrdered};
+    Vector axis = VECT_0, dir = VECT_0;
+    uint32_t head = 0, tail = 0;
+    queue[tail++] = seed;
+    seen[seed] = id;
+    while (head < tail && nbOrdered - cluster.start < MESH_CLUSTER_MAX_FACES) {
+      uint32_t f = queue[head++];
+      if (valid[f] && VECT_NormSquare(&axis) > 0 &&
+          VECT_DotProduct(&normals[f], &dir) < MESH_CLUSTER_MIN_COS)
+        continue;
+      owner[f] = id;
+      order[nbOrdered++] = f;
+      if (valid[f]) {
+        VECT_Add(&axis, &axis, &normals[f]);
+        dir = axis;
+        if (VECT_NormSquare(&dir) > 0)
+          VECT_Normalise(&dir);
+      }
+      const uint32_t *idx = MESH_GetFaceIndices(mesh, f);
+      for (int k = 0; k < 3; k++) {
+        uint32_t nb;
+        const uint32_t *faces = MESH_GetVertexFaces(mesh, idx[k], &nb);
+        for (uint32_t j = 0; j < nb; j++) {
+          if (owner[faces[j]] == MESH_CLUSTER_NONE && seen[faces[j]] != id) {
+            seen[faces[j]] = id;
+            queue[tail++] = faces[j];
+          }
+        }
+      }
+    }
+    cluster.end = nbOrdered;
+    ARRLIST_Add(clusters, &cluster);
+  }
+
+  permuteFaces(mesh, order);
+  mesh->nbClusters = ARRLIST_GetSize(clusters);
+  mesh->clusters = ARRLIST_ToArray(clusters);
+  for (uint32_t i = 0; i < mesh->nbClusters; i++)
+    calcClusterBounds(mesh, &mesh->clusters[i]);
+
+  free(normals);
+  free(valid);
+  free(owner);
+  free(seen);
+  free(queue);
+  free(order);
+}
+
+/*
+ * Reordonne les faces pour reutiliser les sommets deja transformes (Forsyth,
+ * "Linear-Speed Vertex Cache Optimisation") puis renumerote les sommets dans
+ * l'ordre de leur premiere utilisation : les faces successives lisent des
+ * sommets proches en memoire. Si les clusters sont calcules, ils gardent
+ * leurs faces : ils sont ranges selon l'ordre du passage global, puis leurs
+ * faces sont reordonnees a l'interieur de chacun, le cache passant d'un
+ * cluster au suivant. Le nouvel ordre n'est garde que s'il reduit l'ACMR. La
+ * hierarchie et l'adjacence sont a recalculer.
+ */
+extern void MESH_OptimizeVertexCache(Mesh *mesh) {
+  size_t nbFaces = MESH_GetNbFace(mesh), nbVertices = MESH_GetNbVertice(mesh);
+  uint32_t *order = malloc(sizeof(uint32_t) * (nbFaces ? nbFaces : 1));
+  uint32_t *local = malloc(sizeof(uint32_t) * (nbVertices ? nbVertices : 1));
+  assert(order && local);
+  for (size_t i = 0; i < nbVertices; i++)
+    local[i] = MESH_VCACHE_NONE;
+  uint32_t lru[MESH_VCACHE_SIZE];
+  unsigned lruSize = 0;
+  vcacheOrderFaces(mesh, NULL, 0, nbFaces, nbFaces, order, local, lru,
+                   &lruSize);
+
+  MeshCluster *clusters = NULL;
+  if (mesh->clusters) {
+    clusters = malloc(sizeof(MeshCluster) * mesh->nbClusters);
+    uint32_t *grouped = malloc(sizeof(uint32_t) * (nbFaces ? nbFaces : 1));
+    assert(clusters && grouped);
+    groupClusters(mesh, order, clusters);
+    memcpy(grouped, order, sizeof(uint32_t) * nbFaces);
+    // Chaque cluster voit aussi les faces du suivant : les sommets partages
+    // sont gardes pour la fin
+    lruSize = 0;
+    for (uint32_t i = 0; i < mesh->nbClusters; i++) {
+      uint32_t lookEnd =
+          i + 1 < mesh->nbClusters ? clusters[i + 1].end : clusters[i].end;
+      vcacheOrderFaces(mesh, grouped, clusters[i].start, clusters[i].end,
+                       lookEnd, order, local, lru, &lruSize);
+    }
+    free(grouped);
+  }
+  free(local);
+  if (calcAcmr(mesh, order) < calcAcmr(mesh, NULL)) {
+    permuteFaces(mesh, order);
+    // Les clusters gardent les memes faces, seuls leur rang et leurs bornes
+    // changent
+    if (clusters)
+      memcpy(mesh->clusters, clusters, sizeof(MeshCluster) * mesh->nbClusters);
+  }
+  free(clusters);
+
+  // Premiere utilisation, les sommets isoles restent a la fin
+  uint32_t *remap = malloc(sizeof(uint32_t) * (nbVertices ? nbVertices : 1));
+  uint32_t nbUsed = 0;
+  assert(remap);
+  for (size_t i = 0; i < nbVertices; i++)
+    remap[i] = MESH_VCACHE_NONE;
+  for (size_t i = 0; i < nbFaces; i++) {
+    const uint32_t *idx = MESH_GetFaceIndices(mesh, i);
+    for (int k = 0; k < 3; k++)
+      if (remap[idx[k]] == MESH_VCACHE_NONE)
+        remap[idx[k]] = nbUsed++;
+  }
+  for (size_t i = 0; i < nbVertices; i++)
+    if (remap[i] == MESH_VCACHE_NONE)
+      remap[i] = nbUsed++;
+  permuteVertices(mesh, remap);
+  free(remap);
+  free(order);
+}
+
+/*
+ * Nombre moyen de sommets transformes par triangle (ACMR) avec un cache FIFO
+ * de MESH_VCACHE_SIZE sommets : entre 0.5 (ideal) et 3 (aucune reutilisation)
+ */
+extern double MESH_CalcAcmr(const Mesh *mesh) { return calcAcmr(mesh, NULL); }
+
+/*
+ * Intersection etanche d'un rayon origin + t * dir avec un triangle
+ * Les fonctions d'arete sont les volumes signes dir . (Pj x Pi) avec les
+ * sommets relatifs a l'origine : une arete commune a deux faces donne
+ * exactement la meme valeur au signe pres, aucun rayon ne passe entre.
+ */
+extern bool MESH_TRI_Intersect(const MeshTriangle *tri, const Vector *origin,
+                               const Vector *dir, REAL *t) {
+  const REAL EPSILON = 0.0000001;
+  REAL ax = tri->p0[0] - origin->x, ay = tri->p0[1] - origin->y,
+         az = tri->p0[2] - origin->z;
+  REAL bx = tri->p1[0] - origin->x, by = tri->p1[1] - origin->y,
+         bz = tri->p1[2] - origin->z;
+  REAL cx = tri->p2[0] - origin->x, cy = tri->p2[1] - origin->y,
+         cz = tri->p2[2] - origin->z;
+
+  // Coordonnees barycentriques non normalisees
+  REAL u = dir->x * (cy * bz - cz * by) + dir->y * (cz * bx - cx * bz) +
+             dir->z * (cx * by - cy * bx);
+  REAL v = dir->x * (ay * cz - az * cy) + dir->y * (az * cx - ax * cz) +
+             dir->z * (ax * cy - ay * cx);
+  REAL w = dir->x * (by * az - bz * ay) + dir->y * (bz * ax - bx * az) +
+             dir->z * (bx * ay - by * ax);
+
+  if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+    return false;
+  REAL det = u + v + w;
+  if (det == 0) // Le rayon est parallèle au triangle.
+    return false;
+
+  // Point touche P = (u A + v B + w C) / det = t dir
+  REAL px = u * ax + v * bx + w * cx;
+  REAL py = u * ay + v * by + w * cy;
+  REAL pz = u * az + v * bz + w * cz;
+  REAL td = (px * dir->x + py * dir->y + pz * dir->z) /
+              (det * VECT_NormSquare(dir));
+  if (td <= EPSILON)
+    return false;
+  *t = td;
+  return true;
+}
+
 /*
  * Translate le mesh suivant le vecteur depl
  */
@@ -207,10 +843,16 @@ void MESH_Translate(struct Mesh *mesh, struct Vector *depl) {
 }
 */
 
-extern void MESH_FACE_CalcNormaleFace(struct MeshFace *f) {
-  Vector s21, s31;
-  VECT_Sub(&s21, &f->p1->world, &f->p0->world);
-  VECT_Sub(&s31, &f->p2->world, &f->p0->world);
+/*
+ * Normale de la face. La version du mesh n'est pas incrementee, a faire une
+ * fois apres toutes les faces (cf RD_CalcNormales).
+ */
+extern void MESH_FACE_CalcNormaleFace(Mesh *mesh, size_t index) {
+  MeshFace *f = MESH_GetFace(mesh, index);
+  Vector p0, p1, p2, s21, s31;
+  MESH_GetFaceVertexPos(mesh, index, 0, &p0);
+  VECT_Sub(&s21, MESH_GetFaceVertexPos(mesh, index, 1, &p1), &p0);
+  VECT_Sub(&s31, MESH_GetFaceVertexPos(mesh, index, 2, &p2), &p0);
   VECT_CrossProduct(&f->normal, &s21, &s31);
   VECT_Normalise(&f->normal);
 }
@@ -218,3 +860,487 @@ extern void MESH_FACE_CalcNormaleFace(struct MeshFace *f) {
 /*******************************************************************************
  * Internal function
  ******************************************************************************/
+
+/*
+ * Supprime les clusters (faces ajoutees ou reordonnees)
+ */
+static void resetClusters(Mesh *mesh) {
+  free(mesh->clusters);
+  mesh->clusters = NULL;
+  mesh->nbClusters = 0;
+}
+
+/*
+ * Reordonne les faces : la face i devient order[i]. La hierarchie et
+ * l'adjacence, qui designent des faces, sont invalidees.
+ */
+static void permuteFaces(Mesh *mesh, const uint32_t *order) {
+  size_t nbFaces = MESH_GetNbFace(mesh), alloc = nbFaces ? nbFaces : 1;
+  MeshFace *faces = ARRLIST_GetData(mesh->faces);
+  uint32_t(*indices)[3] = ARRLIST_GetData(mesh->indices);
+  MeshFace *oldFaces = malloc(sizeof(MeshFace) * alloc);
+  uint32_t(*oldIndices)[3] = malloc(sizeof(uint32_t[3]) * alloc);
+  assert(oldFaces && oldIndices);
+  memcpy(oldFaces, faces, sizeof(MeshFace) * nbFaces);
+  memcpy(oldIndices, indices, sizeof(uint32_t[3]) * nbFaces);
+  for (size_t i = 0; i < nbFaces; i++) {
+    faces[i] = oldFaces[order[i]];
+    memcpy(indices[i], oldIndices[order[i]], sizeof(uint32_t[3]));
+  }
+  free(oldFaces);
+  free(oldIndices);
+
+  BVH_Free(mesh->bvh);
+  mesh->bvh = NULL;
+  free(mesh->triangles);
+  mesh->triangles = NULL;
+  resetAdjacency(mesh);
+  mesh->version++;
+}
+
+/*
+ * Normale unitaire de la face, faux si elle est degeneree
+ */
+static bool faceNormal(const Mesh *mesh, size_t index, Vector *n) {
+  Vector p0, p1, p2, s21, s31;
+  MESH_GetFaceVertexPos(mesh, index, 0, &p0);
+  VECT_Sub(&s21, MESH_GetFaceVertexPos(mesh, index, 1, &p1), &p0);
+  VECT_Sub(&s31, MESH_GetFaceVertexPos(mesh, index, 2, &p2), &p0);
+  VECT_CrossProduct(n, &s21, &s31);
+  if (VECT_NormSquare(n) == 0)
+    return false;
+  VECT_Normalise(n);
+  return true;
+}
+
+/*
+ * Boite, sphere et cone des normales d'un cluster. Toutes ses faces sont de
+ * dos pour une camera c si
+ * (center - c) . coneAxis >= coneCutoff |center - c| + radius
+ * (cone elargi par la sphere, cf RD_CalcZbuffer). Une face degeneree ou un
+ * cone de plus de 90 degres rendent le test impossible (coneCutoff = 1).
+ */
+static void calcClusterBounds(const Mesh *mesh, MeshCluster *cluster) {
+  BOX3_Reset(&cluster->box);
+  Vector axis = VECT_0, n;
+  bool valid = true;
+  Vector p;
+  for (uint32_t i = cluster->start; i < cluster->end; i++) {
+    for (unsigned k = 0; k < 3; k++)
+      BOX3_AddPoint(&cluster->box, MESH_GetFaceVertexPos(mesh, i, k, &p));
+    if (faceNormal(mesh, i, &n))
+      VECT_Add(&axis, &axis, &n);
+    else
+      valid = false;
+  }
+  cluster->center = cluster->box.center;
+  cluster->radius = 0;
+  for (uint32_t i = cluster->start; i < cluster->end; i++) {
+    for (unsigned k = 0; k < 3; k++) {
+      REAL d = VECT_Distance(&cluster->center,
+                             MESH_GetFaceVertexPos(mesh, i, k, &p));
+      cluster->radius = d > cluster->radius ? d : cluster->radius;
+    }
+  }
+
+  cluster->coneAxis = VECT_0;
+  cluster->coneCutoff = 1;
+  if (!valid || VECT_NormSquare(&axis) == 0)
+    return;
+  VECT_Normalise(&axis);
+  REAL minDot = 1;
+  for (uint32_t i = cluster->start; i < cluster->end; i++) {
+    faceNormal(mesh, i, &n);
+    REAL d = VECT_DotProduct(&axis, &n);
+    minDot = d < minDot ? d : minDot;
+  }
+  cluster->coneAxis = axis;
+  if (minDot > 0)
+    cluster->coneCutoff = sqrt(1 - minDot * minDot);
+}
+
+/*
+ * Score d'un sommet selon sa position dans le cache et ses triangles
+ * restants, -1 s'il n'en a plus
+ */
+static float vcacheVertexScore(uint32_t cachePos, uint32_t remaining) {
+  if (!remaining)
+    return -1;
+  float score = 0;
+  if (cachePos < 3) {
+    score = MESH_VCACHE_LAST_TRI;
+  } else if (cachePos < MESH_VCACHE_SIZE) {
+    float scaler = 1.0f / (MESH_VCACHE_SIZE - 3);
+    score = powf(1.0f - (cachePos - 3) * scaler, MESH_VCACHE_DECAY);
+  }
+  return score + MESH_VCACHE_VALENCE_SCALE *
+                     powf(remaining, -MESH_VCACHE_VALENCE_POWER);
+}
+
+/*
+ * Ordre glouton des faces faceIds[start, end[ (NULL : les faces du mesh) dans
+ * order[start, end[ : la suivante est celle de meilleur score parmi celles des
+ * sommets du cache (LRU), a defaut la premiere face restante. Les faces
+ * [end, lookEnd[ comptent dans les scores sans etre placees.
+ * Le cache lru (sommets du mesh) est repris puis rendu en fin d'intervalle.
+ * local (un par sommet du mesh, MESH_VCACHE_NONE) est rendu dans cet etat.
+ */
+static void vcacheOrderFaces(const Mesh *mesh, const uint32_t *faceIds,
+                             uint32_t start, uint32_t end, uint32_t lookEnd,
+                             uint32_t *order, uint32_t *local, uint32_t *lru,
+                             unsigned *lruSize) {
+  uint32_t nbFaces = end - start, nbAll = lookEnd - start;
+  uint32_t alloc = 3 * nbAll + 1;
+  // Sommets de l'intervalle, numerotes localement
+  uint32_t *verts = malloc(sizeof(uint32_t) * alloc);
+  uint32_t *remaining = calloc(alloc, sizeof(uint32_t));
+  uint32_t *trisStart = malloc(sizeof(uint32_t) * (alloc + 1));
+  uint32_t *cachePos = malloc(sizeof(uint32_t) * alloc);
+  float *vertexScore = malloc(sizeof(float) * alloc);
+  uint32_t *tris = malloc(sizeof(uint32_t) * alloc);
+  uint32_t(*faces)[3] = malloc(sizeof(uint32_t[3]) * (nbAll + 1));
+  bool *emitted = calloc(nbFaces + 1, sizeof(bool));
+  assert(verts && remaining && trisStart && cachePos && vertexScore && tris &&
+         faces && emitted);
+  uint32_t nbVertices = 0;
+  for (uint32_t f = 0; f < nbAll; f++) {
+    uint32_t id = faceIds ? faceIds[start + f] : start + f;
+    const uint32_t *idx = MESH_GetFaceIndices(mesh, id);
+    for (int k = 0; k < 3; k++) {
+      if (local[idx[k]] == MESH_VCACHE_NONE) {
+        local[idx[k]] = nbVertices;
+        verts[nbVertices++] = idx[k];
+      }
+      faces[f][k] = local[idx[k]];
+      remaining[faces[f][k]]++;
+    }
+  }
+  // Avec la place des 3 sommets entrants. Les sommets du cache precedent hors
+  // de l'intervalle sont oublies.
+  uint32_t cache[MESH_VCACHE_SIZE + 3], next[MESH_VCACHE_SIZE + 3];
+  unsigned cacheSize = 0;
+  for (unsigned j = 0; j < *lruSize; j++)
+    if (local[lru[j]] != MESH_VCACHE_NONE)
+      cache[cacheSize++] = local[lru[j]];
+
+  // Faces de chaque sommet (CSR), puis sommets rendus a MESH_VCACHE_NONE
+  trisStart[0] = 0;
+  for (uint32_t v = 0; v < nbVertices; v++) {
+    trisStart[v + 1] = trisStart[v] + remaining[v];
+    remaining[v] = 0;
+    cachePos[v] = MESH_VCACHE_NONE;
+    local[verts[v]] = MESH_VCACHE_NONE;
+  }
+  for (uint32_t f = 0; f < nbAll; f++)
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = faces[f][k];
+      tris[trisStart[v] + remaining[v]++] = f;
+    }
+  for (unsigned j = 0; j < cacheSize; j++)
+    cachePos[cache[j]] = j;
+  for (uint32_t v = 0; v < nbVertices; v++)
+    vertexScore[v] = vcacheVertexScore(cachePos[v], remaining[v]);
+
+  // Premiere face : la meilleure de celles du cache repris
+  uint32_t best = MESH_VCACHE_NONE, scan = 0;
+  float bestScore = -1;
+  for (unsigned j = 0; j < cacheSize; j++) {
+    const uint32_t *vtris = &tris[trisStart[cache[j]]];
+    for (uint32_t t = 0; t < remaining[cache[j]]; t++) {
+      if (vtris[t] >= nbFaces)
+        continue;
+      const uint32_t *ti = faces[vtris[t]];
+      float score = vertexScore[ti[0]] + vertexScore[ti[1]] + vertexScore[ti[2]];
+      if (score > bestScore) {
+        bestScore = score;
+        best = vtris[t];
+      }
+    }
+  }
+  for (uint32_t n = 0; n < nbFaces; n++) {
+    if (best == MESH_VCACHE_NONE) {
+      while (emitted[scan])
+        scan++;
+      best = scan;
+    }
+    emitted[best] = true;
+    order[start + n] = faceIds ? faceIds[start + best] : start + best;
+    const uint32_t *idx = faces[best];
+
+    // La face quitte les listes de ses sommets
+    unsigned nextSize = 0;
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = idx[k];
+      uint32_t *vtris = &tris[trisStart[v]];
+      uint32_t j = 0;
+      while (vtris[j] != best)
+        j++;
+      vtris[j] = vtris[--remaining[v]];
+      next[nextSize++] = v;
+    }
+    for (unsigned j = 0; j < cacheSize; j++)
+      if (cache[j] != idx[0] && cache[j] != idx[1] && cache[j] != idx[2])
+        next[nextSize++] = cache[j];
+
+    // Nouvelles positions et scores, y compris des sommets sortis du cache
+    for (unsigned j = 0; j < nextSize; j++) {
+      uint32_t v = next[j];
+      cachePos[v] = j < MESH_VCACHE_SIZE ? j : MESH_VCACHE_NONE;
+      vertexScore[v] = vcacheVertexScore(cachePos[v], remaining[v]);
+    }
+    best = MESH_VCACHE_NONE;
+    bestScore = -1;
+    for (unsigned j = 0; j < nextSize; j++) {
+      const uint32_t *vtris = &tris[trisStart[next[j]]];
+      for (uint32_t t = 0; t < remaining[next[j]]; t++) {
+        if (vtris[t] >= nbFaces)
+          continue;
+        const uint32_t *ti = faces[vtris[t]];
+        float score =
+            vertexScore[ti[0]] + vertexScore[ti[1]] + vertexScore[ti[2]];
+        if (score > bestScore) {
+          bestScore = score;
+          best = vtris[t];
+        }
+      }
+    }
+    cacheSize = nextSize < MESH_VCACHE_SIZE ? nextSize : MESH_VCACHE_SIZE;
+    memcpy(cache, next, sizeof(uint32_t) * cacheSize);
+  }
+  for (unsigned j = 0; j < cacheSize; j++)
+    lru[j] = verts[cache[j]];
+  *lruSize = cacheSize;
+
+  free(verts);
+  free(remaining);
+  free(trisStart);
+  free(cachePos);
+  free(vertexScore);
+  free(tris);
+  free(faces);
+  free(emitted);
+}
+
+/*
+ * ACMR des faces dans l'ordre order (NULL : ordre du mesh)
+ */
+static double calcAcmr(const Mesh *mesh, const uint32_t *order) {
+  size_t nbFaces = MESH_GetNbFace(mesh);
+  if (!nbFaces)
+    return 0;
+  uint32_t fifo[MESH_VCACHE_SIZE];
+  unsigned head = 0, size = 0;
+  size_t misses = 0;
+  for (size_t i = 0; i < nbFaces; i++) {
+    const uint32_t *idx = MESH_GetFaceIndices(mesh, order ? order[i] : i);
+    for (int k = 0; k < 3; k++) {
+      bool hit = false;
+      for (unsigned j = 0; j < size && !hit; j++)
+        hit = fifo[j] == idx[k];
+      if (hit)
+        continue;
+      misses++;
+      if (size < MESH_VCACHE_SIZE)
+        fifo[size++] = idx[k];
+      else
+        fifo[head] = idx[k];
+      head = (head + 1) % MESH_VCACHE_SIZE;
+    }
+  }
+  return (double)misses / nbFaces;
+}
+
+/*
+ * Regroupe l'ordre des faces par cluster en gardant leur ordre relatif, les
+ * clusters etant ranges selon leur premiere face dans order. clusters recoit
+ * les clusters du mesh avec leurs bornes dans l'ordre obtenu.
+ */
+static void groupClusters(const Mesh *mesh, uint32_t *order,
+                          MeshCluster *clusters) {
+  size_t nbFaces = MESH_GetNbFace(mesh);
+  uint32_t nbClusters = mesh->nbClusters;
+  uint32_t *owner = malloc(sizeof(uint32_t) * (nbFaces ? nbFaces : 1));
+  uint32_t *rank = malloc(sizeof(uint32_t) * nbClusters);
+  uint32_t *cursor = malloc(sizeof(uint32_t) * nbClusters);
+  uint32_t *grouped = malloc(sizeof(uint32_t) * (nbFaces ? nbFaces : 1));
+  assert(owner && rank && cursor && grouped);
+  for (uint32_t i = 0; i < nbClusters; i++) {
+    for (uint32_t f = mesh->clusters[i].start; f < mesh->clusters[i].end; f++)
+      owner[f] = i;
+    rank[i] = MESH_VCACHE_NONE;
+  }
+  uint32_t nbRanked = 0;
+  for (size_t i = 0; i < nbFaces; i++)
+    if (rank[owner[order[i]]] == MESH_VCACHE_NONE)
+      rank[owner[order[i]]] = nbRanked++;
+  for (uint32_t i = 0; i < nbClusters; i++)
+    clusters[rank[i]] = mesh->clusters[i];
+  for (uint32_t i = 0, start = 0; i < nbClusters; i++) {
+    uint32_t size = clusters[i].end - clusters[i].start;
+    cursor[i] = clusters[i].start = start;
+    clusters[i].end = start += size;
+  }
+  for (size_t i = 0; i < nbFaces; i++)
+    grouped[cursor[rank[owner[order[i]]]]++] = order[i];
+  memcpy(order, grouped, sizeof(uint32_t) * nbFaces);
+  free(owner);
+  free(rank);
+  free(cursor);
+  free(grouped);
+}
+
+
+/*
+ * Renumerote les sommets : le sommet i devient remap[i]. Les faces sont mises
+ * a jour, l'adjacence et les triangles precalcules sont invalides.
+ */
+static void permuteVertices(Mesh *mesh, const uint32_t *remap) {
+  size_t nbVertices = MESH_GetNbVertice(mesh);
+  size_t alloc = nbVertices ? nbVertices : 1;
+  MeshVertex *vertices = ARRLIST_GetData(mesh->vertices);
+  MeshVertex *old = malloc(sizeof(MeshVertex) * alloc);
+  REAL *oldPos = malloc(sizeof(REAL) * 3 * alloc);
+  assert(old && oldPos);
+  memcpy(old, vertices, sizeof(MeshVertex) * nbVertices);
+  REAL *streams[3] = {mesh->posX, mesh->posY, mesh->posZ};
+  for (int k = 0; k < 3; k++) {
+    memcpy(oldPos, streams[k], sizeof(REAL) * nbVertices);
+    for (size_t i = 0; i < nbVertices; i++)
+      streams[k][remap[i]] = oldPos[i];
+  }
+  for (size_t i = 0; i < nbVertices; i++)
+    vertices[remap[i]] = old[i];
+  free(old);
+  free(oldPos);
+  uint32_t(*indices)[3] = ARRLIST_GetData(mesh->indices);
+  for (size_t i = 0; i < MESH_GetNbFace(mesh); i++)
+    for (int k = 0; k < 3; k++)
+      indices[i][k] = remap[indices[i][k]];
+
+  free(mesh->triangles);
+  mesh->triangles = NULL;
+  BVH_Free(mesh->bvh);
+  mesh->bvh = NULL;
+  resetAdjacency(mesh);
+  mesh->version++;
+  if (mesh->weld)
+    weldRehash(mesh, mesh->weld->nbBuckets);
+}
+
+/*
+ * Invalide l'adjacence (sommets ou faces modifies)
+ */
+static void resetAdjacency(Mesh *mesh) {
+  free(mesh->vertexFacesStart);
+  free(mesh->vertexFaces);
+  mesh->vertexFacesStart = mesh->vertexFaces = NULL;
+}
+
+/*
+ * Case hachee de la cellule (cx, cy, cz) de la grille
+ */
+static inline uint32_t weldBucket(const MeshWeld *weld, int64_t cx, int64_t cy,
+                                  int64_t cz) {
+  uint64_t h = (uint64_t)cx * 73856093 ^ (uint64_t)cy * 19349663 ^
+               (uint64_t)cz * 83492791;
+  return h & (weld->nbBuckets - 1);
+}
+
+static inline int64_t weldCell(const MeshWeld *weld, REAL x) {
+  return (int64_t)floor(x / weld->epsilon);
+}
+
+/*
+ * Sommet le plus proche de p a moins de epsilon, cherche dans les 27 cellules
+ * voisines, ou MESH_WELD_NONE. A egalite, le plus petit indice.
+ */
+static uint32_t weldFind(const Mesh *mesh, const Vector *p) {
+  const MeshWeld *weld = mesh->weld;
+  const uint32_t *next = ARRLIST_GetData(weld->next);
+  int64_t cx = weldCell(weld, p->x), cy = weldCell(weld, p->y),
+          cz = weldCell(weld, p->z);
+  REAL best = weld->epsilon * weld->epsilon;
+  uint32_t found = MESH_WELD_NONE;
+  for (int64_t dz = -1; dz <= 1; dz++) {
+    for (int64_t dy = -1; dy <= 1; dy++) {
+      for (int64_t dx = -1; dx <= 1; dx++) {
+        uint32_t b = weldBucket(weld, cx + dx, cy + dy, cz + dz);
+        for (uint32_t i = weld->heads[b]; i != MESH_WELD_NONE; i = next[i]) {
+          Vector q;
+          REAL d = VECT_DistanceSquare(MESH_GetVertexPos(mesh, i, &q), p);
+          if (d < best || (d == best && i < found)) {
+            best = d;
+            found = i;
+          }
+        }
+      }
+    }
+  }
+  return found;
+}
+
+/*
+ * Chaine le sommet dans sa case, la table double quand elle est trop chargee
+ */
+static void weldInsert(Mesh *mesh, uint32_t index) {
+  MeshWeld *weld = mesh->weld;
+  if (index >= (size_t)weld->nbBuckets * MESH_WELD_LOAD) {
+    weldRehash(mesh, 2 * weld->nbBuckets);
+    return; // Le sommet vient d'etre chaine
+  }
+  uint32_t none = MESH_WELD_NONE;
+  ARRLIST_Add(weld->next, &none);
+  weldLink(weld, mesh, index);
+}
+
+/*
+ * Case hachee de la position courante du sommet
+ */
+static inline uint32_t weldVertexBucket(const MeshWeld *weld,
+                                        const Mesh *mesh, uint32_t index) {
+  return weldBucket(weld, weldCell(weld, mesh->posX[index]),
+                    weldCell(weld, mesh->posY[index]),
+                    weldCell(weld, mesh->posZ[index]));
+}
+
+/*
+ * Chaine le sommet en tete de la case de sa position
+ */
+static void weldLink(MeshWeld *weld, const Mesh *mesh, uint32_t index) {
+  uint32_t *next = ARRLIST_GetData(weld->next);
+  uint32_t b = weldVertexBucket(weld, mesh, index);
+  next[index] = weld->heads[b];
+  weld->heads[b] = index;
+}
+
+/*
+ * Retire le sommet de la case de sa position (avant de la changer)
+ */
+static void weldUnlink(MeshWeld *weld, const Mesh *mesh, uint32_t index) {
+  uint32_t *next = ARRLIST_GetData(weld->next);
+  uint32_t *link = &weld->heads[weldVertexBucket(weld, mesh, index)];
+  while (*link != index) {
+    assert(*link != MESH_WELD_NONE);
+    link = &next[*link];
+  }
+  *link = next[index];
+}
+
+/*
+ * Reconstruit la table avec au moins nbBuckets cases a partir des sommets du
+ * mesh
+ */
+static void weldRehash(Mesh *mesh, uint32_t nbBuckets) {
+  MeshWeld *weld = mesh->weld;
+  size_t n = MESH_GetNbVertice(mesh);
+  while ((size_t)nbBuckets * MESH_WELD_LOAD <= n)
+    nbBuckets *= 2;
+  free(weld->heads);
+  weld->heads = malloc(sizeof(uint32_t) * nbBuckets);
+  assert(weld->heads);
+  memset(weld->heads, 0xFF, sizeof(uint32_t) * nbBuckets); // MESH_WELD_NONE
+  weld->nbBuckets = nbBuckets;
+  ARRLIST_Clear(weld->next);
+  for (size_t i = 0; i < n; i++)
+    weldInsert(mesh, i);
+}
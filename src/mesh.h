@@ -6,6 +6,7 @@
  ******************************************************************************/
 
 #include "box3.h"
+#include "bvh.h"
 #include "color.h"
 #include "containers/arraylist.h"
 #include "geo.h"
@@ -18,41 +19,109 @@
  * Macros
  ******************************************************************************/
 
+// Les flux SoA des sommets sont completes jusqu'a un multiple de cette taille
+// (zeros) pour etre traites par blocs SIMD sans reste
+#define MESH_SOA_WIDTH 8
+
+// Nombre maximal de niveaux de detail simplifies d'un mesh (cf Mesh.lods)
+#define MESH_LOD_MAX 4
+
+// Faces maximales d'un cluster (cf MESH_CalcClusters)
+#define MESH_CLUSTER_MAX_FACES 128
+// Cosinus minimal entre la normale d'une face et celle de son cluster
+#define MESH_CLUSTER_MIN_COS 0.5
+
+// Taille du cache de sommets modelise (cf MESH_OptimizeVertexCache)
+#define MESH_VCACHE_SIZE 32
+
 /*******************************************************************************
  * Types
  ******************************************************************************/
 
+/*
+ * Attributs d'un sommet stockes par valeur dans le mesh. Sa position est dans
+ * les flux SoA du mesh (cf MESH_GetVertexPos), les donnees par image (ecran,
+ * codes de sortie) dans les flux du rendu (cf RenderVertices).
+ */
 typedef struct MeshVertex MeshVertex;
 struct MeshVertex {
-  Vector world;     // Coordonnées dans le monde
-  Vector cam;       // Coordonnées repere camera
-  Vector sc;        // Coordonnées dans l'écran 3
-  RasterPos screen; // Dans ecran 2
-  Vector normal;    // Normale du sommet
+  Vector normal; // Normale du sommet
 };
 
+/*
+ * Attributs d'un triangle, ses sommets sont dans le tampon d'indices du mesh
+ * (cf MESH_GetFaceIndices)
+ */
 typedef struct MeshFace MeshFace;
 struct MeshFace {
-  MeshVertex *p0, *p1, *p2; // Uniquement des triangles
-  color color;              // Couleur du triangle
-  Vector normal;            // Normale du triangle
-  double wp1;               // Cache des sous barycentres
-  double wp2;
-  double wp3;
-  double wp4;
+  color color;   // Couleur du triangle
+  Vector normal; // Normale du triangle
+};
+
+/*
+ * Triangle precalcule pour le lancer de rayons (40 octets en float, 80 en
+ * double). Les sommets sont stockes (et non les aretes) pour que deux faces
+ * voisines voient exactement les memes valeurs sur leur arete commune, et en
+ * REAL pour que le BVH et RayIntersectsTriangle donnent les memes impacts.
+ */
+typedef struct MeshTriangle MeshTriangle;
+struct MeshTriangle {
+  REAL p0[3], p1[3], p2[3]; // Sommets
+  uint32_t face;            // Indice de la MeshFace
+};
+
+/*
+ * Faces voisines consecutives du mesh, rejetees en bloc par le rendu : hors du
+ * frustum, toutes de dos (cone des normales) ou cachees (Hi-Z)
+ */
+typedef struct MeshCluster MeshCluster;
+struct MeshCluster {
+  uint32_t start, end; // Faces [start, end[
+  Box3 box;            // Boite englobante
+  Vector center;       // Sphere englobante
+  REAL radius;
+  Vector coneAxis; // Normale moyenne des faces
+  REAL coneCutoff; // Sinus du demi-angle du cone des normales, 1 si > 90 deg
 };
 
 typedef struct MeshEdge MeshEdge;
 struct MeshEdge {
-  MeshVertex *p0, *p1;
+  uint32_t p0, p1; // Indices des sommets
 };
 
+// Table de hachage spatiale de la fusion des sommets (cf MESH_SetWeld)
+typedef struct MeshWeld MeshWeld;
+
 typedef struct Mesh Mesh;
 struct Mesh {
   char *name;          // Le nom du mesh
-  ArrayList *vertices; // Vector
-  ArrayList *faces;    // MeshFace
+  ArrayList *vertices; // MeshVertex, contigus
+  ArrayList *faces;    // MeshFace, contigues
+  ArrayList *indices;  // uint32_t[3] par face : sommets des triangles
+  REAL *posX, *posY, *posZ; // Positions monde des sommets, en SoA
+  size_t posAlloc;            // Taille allouee, multiple de MESH_SOA_WIDTH
   Box3 box;            // Bonding box
+  Bvh *bvh;            // Hierarchie des faces, NULL si non calculee
+  MeshTriangle *triangles; // Triangles precalcules, dans l'ordre du BVH
+  // Adjacence sommet -> faces (CSR) : les faces du sommet i sont
+  // vertexFaces[vertexFacesStart[i] .. vertexFacesStart[i + 1][, NULL si non
+  // calculee (cf MESH_CalcAdjacency)
+  uint32_t *vertexFacesStart;
+  uint32_t *vertexFaces;
+  MeshCluster *clusters;   // Partition des faces, NULL si non calculee
+  uint32_t nbClusters;
+  MeshWeld *weld;          // Fusion des sommets proches, NULL si desactivee
+  uint32_t nbWelded;       // Sommets fusionnes par MESH_AddVertexPos
+  // Niveaux de detail, de plus en plus simplifies (cf SIMPLIFY_CalcLods)
+  struct Mesh *lods[MESH_LOD_MAX];
+  unsigned nbLods;
+  unsigned lod; // Niveau dessine : 0 le mesh lui meme, i lods[i - 1]
+  // Faces de dos ignorees, pour les meshs fermes (cf MESH_SetBackfaceCulling)
+  bool backfaceCulling;
+  // Incremente a chaque modification des sommets, des faces ou des normales,
+  // a incrementer apres une modification directe (cf RD_CalcProjectionVertices)
+  // sauf par MESH_SetVertexPos
+  uint32_t version;
 };
 
 /*******************************************************************************
@@ -63,36 +132,68 @@ struct Mesh {
  * Prototypes
  ******************************************************************************/
 
-// Initialisation VERTEX
-extern MeshVertex *MESH_VERT_Set(MeshVertex *v, double x, double y, double z);
-extern MeshVertex *MESH_VERT_Init(double x, double y, double z);
-extern void MESH_VERT_Print(MeshVertex *v);
-
-// Initialisation face
+// Sommets et faces hors du mesh (cf MESH_AddVertex, MESH_AddFace)
+extern MeshVertex *MESH_VERT_Set(MeshVertex *v, REAL x, REAL y, REAL z);
+extern MeshVertex *MESH_VERT_Init(REAL x, REAL y, REAL z);
+extern void MESH_VERT_Print(const MeshVertex *v);
 extern MeshFace *MESH_FACE_Set(MeshFace *mf, MeshVertex *p0, MeshVertex *p1,
                                MeshVertex *p2, color c);
 extern MeshFace *MESH_FACE_Init(MeshVertex *p1, MeshVertex *p2, MeshVertex *p3,
                                 color c);
-extern void MESH_FACE_Print(struct MeshFace *face);
-extern void MESH_FACE_CalcNormaleFace(struct MeshFace *f);
+extern void MESH_FACE_Print(const MeshFace *face);
 extern MeshFace **MESH_FACE_FromVertices(MeshVertex **vertices,
                                          unsigned nbVertices, unsigned *nbFaces,
                                          color c);
 
+// Face
+extern void MESH_PrintFace(const Mesh *mesh, size_t index);
+extern void MESH_FACE_CalcNormaleFace(Mesh *mesh, size_t index);
+
 // Mesh
+// Les pointeurs retournes sont invalides par l'ajout de sommets / faces
 extern Mesh *MESH_Init(void);
+extern void MESH_Free(Mesh *mesh);
 extern size_t MESH_GetNbFace(const Mesh *mesh);
 extern size_t MESH_GetNbVertice(const Mesh *mesh);
 extern MeshFace *MESH_GetFace(const Mesh *mesh, size_t index);
+extern size_t MESH_GetFaceIndex(const Mesh *mesh, const MeshFace *face);
+extern const uint32_t *MESH_GetFaceIndices(const Mesh *mesh, size_t index);
+extern MeshVertex *MESH_GetFaceVertex(const Mesh *mesh, size_t index,
+                                      unsigned k);
 extern MeshVertex *MESH_GetVertex(const Mesh *mesh, size_t index);
+extern Vector *MESH_GetVertexPos(const Mesh *mesh, size_t index, Vector *pos);
+extern Vector *MESH_GetFaceVertexPos(const Mesh *mesh, size_t index,
+                                     unsigned k, Vector *pos);
+extern void MESH_SetVertexPos(Mesh *mesh, size_t index, const Vector *pos);
+extern void MESH_SetWeld(Mesh *mesh, REAL epsilon);
+extern uint32_t MESH_AddVertexPos(Mesh *mesh, REAL x, REAL y, REAL z);
+extern MeshFace *MESH_AddTriangle(Mesh *mesh, uint32_t i0, uint32_t i1,
+                                  uint32_t i2, color c);
 extern MeshVertex *MESH_AddVertex(Mesh *mesh, MeshVertex *vertex);
 extern void MESH_AddFaces(Mesh *mesh, MeshFace **faces, unsigned nbFaces);
 extern MeshFace *MESH_AddFace(Mesh *mesh, MeshFace *face);
+extern void MESH_AddPolygon(Mesh *mesh, const uint32_t *indices,
+                            unsigned nbVertices, color c);
 extern void MESH_SetName(Mesh *mesh, const char *name);
-extern Mesh *MESH_InitTetrahedron(MeshVertex *origin);
+extern void MESH_SetBackfaceCulling(Mesh *mesh, bool enabled);
+extern Mesh *MESH_GetLod(Mesh *mesh);
+extern Mesh *MESH_InitTetrahedron(const Vector *origin);
 extern void MESH_Print(const Mesh *mesh);
 
+extern void MESH_CalcAdjacency(Mesh *mesh);
+extern const uint32_t *MESH_GetVertexFaces(const Mesh *mesh, size_t index,
+                                           uint32_t *nbFaces);
 extern void MESH_CalcVerticesNormales(Mesh *mesh);
+extern void MESH_CalcVerticesNormalesRange(Mesh *mesh, size_t start,
+                                           size_t end);
+extern void MESH_CalcBvh(Mesh *mesh);
+extern void MESH_CalcClusters(Mesh *mesh);
+extern void MESH_OptimizeVertexCache(Mesh *mesh);
+extern double MESH_CalcAcmr(const Mesh *mesh);
+
+// Triangles precalcules
+extern bool MESH_TRI_Intersect(const MeshTriangle *tri, const Vector *origin,
+                               const Vector *dir, REAL *t);
 
 
 #endif /* _GEO_H_ */
@@ -17,7 +17,7 @@
 /*******************************************************************************
  * Types
  ******************************************************************************/
-typedef struct Mesh **(*Parser)(FILE *, unsigned *, char *);
+typedef struct Mesh **(*Parser)(FILE *, unsigned *, char *, REAL);
 
 /*******************************************************************************
  * Internal function declaration
@@ -34,6 +34,11 @@ const Parser PARSERS_FUNCS[] = {OBJ_Parse};
  * Public function
  ******************************************************************************/
 struct Mesh **PARSER_Load(const char *filename, unsigned *nbMeshes) {
+  return PARSER_LoadWelded(filename, nbMeshes, -1);
+}
+
+struct Mesh **PARSER_LoadWelded(const char *filename, unsigned *nbMeshes,
+                                REAL weldEpsilon) {
   *nbMeshes = 0;
 
   char *extension = strrchr(filename, '.');
@@ -63,7 +68,7 @@ struct Mesh **PARSER_Load(const char *filename, unsigned *nbMeshes) {
   strcpy(filenameCpy, filename);
   char *fileDir = dirname(filenameCpy);
 
-  struct Mesh **meshes = parse(file, nbMeshes, fileDir);
+  struct Mesh **meshes = parse(file, nbMeshes, fileDir, weldEpsilon);
 
   free(filenameCpy);
   return meshes;
@@ -19,6 +19,12 @@
  * Variables
  ******************************************************************************/
 struct Mesh **PARSER_Load(const char *filename, unsigned *nbMeshes);
+/*
+ * Chargement en fusionnant les sommets a moins de weldEpsilon (> 0) les uns
+ * des autres (cf MESH_SetWeld), Mesh.nbWelded compte les sommets fusionnes
+ */
+struct Mesh **PARSER_LoadWelded(const char *filename, unsigned *nbMeshes,
+                                REAL weldEpsilon);
 
 /*******************************************************************************
  * Prototypes
@@ -70,7 +70,8 @@ void find_material(const ArrayList *materialList, const char *name,
  * Public function
  ******************************************************************************/
 // TODO: utiliser strtok_r pour rendre tous ca thread-safe
-struct Mesh **OBJ_Parse(FILE *file, unsigned *nbMeshes, char *dir) {
+struct Mesh **OBJ_Parse(FILE *file, unsigned *nbMeshes, char *dir,
+                        REAL weldEpsilon) {
   char buffer[256];
 
   entity_type entity;
@@ -81,6 +82,8 @@ struct Mesh **OBJ_Parse(FILE *file, unsigned *nbMeshes, char *dir) {
   struct material currentMaterial = {CL_GRAY, ""};
 
   int verticesIndexOffset = 0;
+  // Indice dans le mesh de chaque sommet du fichier (differe si fusion)
+  ArrayList *vertexRemap = ARRLIST_Create(sizeof(uint32_t));
 
   while ((entity = getNextEntity(buffer, 256, file)) != BLANK) {
     // Si on ne declare pas l'objet alors qu'on en a besoin, on en cree un
@@ -88,42 +91,41 @@ struct Mesh **OBJ_Parse(FILE *file, unsigned *nbMeshes, char *dir) {
       fprintf(stderr, "[OBJ_Parse] Warning : no object definition before "
                       "face definitions, creating one\n");
       currentMesh = MESH_Init();
+      MESH_SetWeld(currentMesh, weldEpsilon);
     }
 
     switch (entity) {
     case VERTEX: {
-      struct Vector v;
-      sscanf(buffer, "v %lf %lf %lf", &v.x, &v.y, &v.z);
-      MESH_AddVertex(currentMesh, MESH_VERT_Init(v.x, v.y, v.z));
+      double x, y, z;
+      sscanf(buffer, "v %lf %lf %lf", &x, &y, &z);
+      uint32_t index = MESH_AddVertexPos(currentMesh, x, y, z);
+      ARRLIST_Add(vertexRemap, &index);
     } break;
     case FACE: {
       unsigned verticesIndex[MAX_VERTICES_PER_FACE];
       unsigned nbVertices = MAX_VERTICES_PER_FACE;
       parseFace(buffer, verticesIndex, &nbVertices);
 
-      MeshVertex **vertices = malloc(sizeof(MeshVertex *) * nbVertices);
       for (unsigned i = 0; i < nbVertices; i++)
-        vertices[i] =
-            MESH_GetVertex(currentMesh, verticesIndex[i] - verticesIndexOffset);
+        verticesIndex[i] = *(uint32_t *)ARRLIST_Get(
+            vertexRemap, verticesIndex[i] - verticesIndexOffset);
 
       // TODO: check if vertices exists (si plusieurs meshs avec les meme
       // sommets)
-      unsigned nbFaces = 0;
-      struct MeshFace **faces = MESH_FACE_FromVertices(
-          vertices, nbVertices, &nbFaces, currentMaterial.color);
-      MESH_AddFaces(currentMesh, faces, nbFaces);
-
-      free(faces);
-      free(vertices);
+      MESH_AddPolygon(currentMesh, verticesIndex, nbVertices,
+                      currentMaterial.color);
     } break;
     case OBJECT:
       // Nouvelle mesh : on ajoute la precedente a la liste et on travaille sur
       // une nouvelle
       if (currentMesh) {
+        MESH_SetWeld(currentMesh, -1);
         ARRLISTP_Add(meshes, currentMesh);
-        verticesIndexOffset += MESH_GetNbVertice(currentMesh);
+        verticesIndexOffset += ARRLIST_GetSize(vertexRemap);
+        ARRLIST_Clear(vertexRemap);
       }
       currentMesh = MESH_Init();
+      MESH_SetWeld(currentMesh, weldEpsilon);
       strtok(buffer, " ");
       char *name = strtok(NULL, " ");
       MESH_SetName(currentMesh, name);
@@ -153,8 +155,11 @@ struct Mesh **OBJ_Parse(FILE *file, unsigned *nbMeshes, char *dir) {
 
   if (materials)
     ARRLIST_Free(materials);
+  ARRLIST_Free(vertexRemap);
 
   // On ajoute la derniere mesh
+  if (currentMesh)
+    MESH_SetWeld(currentMesh, -1);
   ARRLISTP_Add(meshes, currentMesh);
 
   *nbMeshes = ARRLISTP_GetSize(meshes);
@@ -24,6 +24,11 @@
  * Prototypes
  ******************************************************************************/
 
-struct Mesh **OBJ_Parse(FILE *file, unsigned *nbMeshes, char *dir);
+/*
+ * weldEpsilon : distance de fusion des sommets (cf MESH_SetWeld), negative
+ * pour garder les sommets du fichier tels quels
+ */
+struct Mesh **OBJ_Parse(FILE *file, unsigned *nbMeshes, char *dir,
+                        REAL weldEpsilon);
 
 #endif /* _PARSER_OBJ_H_ */
@@ -5,6 +5,7 @@
 #include "raster.h"
 #include "color.h"
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,35 +14,39 @@
  * Macros
  ******************************************************************************/
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Cote des blocs parcourus par le rasteriseur, une ligne de bloc = un vecteur
+#define RASTER_BLOCK_SIZE 8
+
 /*******************************************************************************
  * Types
  ******************************************************************************/
 
+/*
+ * Ligne de RASTER_BLOCK_SIZE pixels : vecteur GCC compile en SSE (2 x 4) ou
+ * AVX2 (8) selon la cible
+ */
+typedef int32_t RasterLane
+    __attribute__((vector_size(RASTER_BLOCK_SIZE * sizeof(int32_t))));
+
+/*
+ * Fonction d'arete E(x, y) = a x + b y + c, positive ou nulle a l'interieur
+ * du triangle (la regle haut-gauche est integree dans c)
+ */
+typedef struct RasterEdge RasterEdge;
+struct RasterEdge {
+  int32_t a, b, c;
+};
+
 /*******************************************************************************
  * Internal function declaration
  ******************************************************************************/
 
-void swap_pos(RasterPos **p1, RasterPos **p2);
+static inline void edgeInit(RasterEdge *e, const RasterPos *p0,
+                            const RasterPos *p1);
 
-// TODO: optimiser en ecrivant tout d'un bloc
-static void RASTER_DrawHorizontalLine(uint32_t x1, uint32_t x2, uint32_t y,
-                                      void (*callbackxy)(uint32_t, uint32_t,
-                                                         void **),
-                                      void **args);
-
-/**
- * http://www.sunshine2k.de/coding/java/TriangleRasterization/TriangleRasterization.html#algo2
- */
-static void RASTER_DrawFillBottomFlatTriangle(
-    RasterPos *p1, RasterPos *p2, RasterPos *p3,
-    void (*callbackxy)(uint32_t, uint32_t, void **), void **args);
-
-static void
-RASTER_DrawFillTopFlatTriangle(RasterPos *p1, RasterPos *p2, RasterPos *p3,
-                               void (*callbackxy)(uint32_t, uint32_t, void **),
-                               void **args);
-
-static void callbackDrawXY(uint32_t x, uint32_t y, void **args);
 
 /*******************************************************************************
  * Variables
@@ -130,59 +135,186 @@ extern void RASTER_DrawTriangle(Matrix *s, RasterPos *p1, RasterPos *p2,
   RASTER_DrawLine(s, p3, p1, c);
 }
 
-extern void
-RASTER_GenerateFillTriangle(RasterPos *p1, RasterPos *p2, RasterPos *p3,
-                            void (*callbackxy)(uint32_t, uint32_t, void **),
-                            void **args) {
-  // On trie p1, p2, p3 par ordre ascendant en ordonnees
-  if (p1->y > p2->y) {
-    if (p2->y > p3->y)      // p3, p2, p1
-      swap_pos(&p1, &p3);   // Ordered
-    else if (p1->y > p3->y) // p2, p3, p1
-    {
-      RasterPos *tmp = p1;
-      p1 = p2;
-      p2 = p3;
-      p3 = tmp;
-    } else // p2, p1, p3
-    {
-      swap_pos(&p1, &p2);
-    }
-  } else // p2 > p1
-  {
-    if (p1->y > p3->y) // p3, p1, p2
-    {
-      RasterPos *tmp = p1;
-      p1 = p3;
-      p3 = p2;
-      p2 = tmp;
-    } else if (p2->y > p3->y) // p1, p3, p2
-      swap_pos(&p2, &p3);
-    // p1, p2, p3
+/*
+ * Rasterisation par demi-plans (fonctions d'arete) par bandes de 8 lignes,
+ * bloc de 8x8 par bloc de 8x8 dans la boite englobante :
+ *  - bloc entierement hors d'une arete : rejete
+ *  - bloc entierement dans les 3 aretes : toutes ses lignes sont couvertes
+ *  - sinon les 3 fonctions sont evaluees sur une ligne entiere a la fois
+ * Le triangle etant convexe, chaque ligne de la bande est un unique segment,
+ * emis une fois la bande parcourue.
+ * Les pixels sont echantillonnes aux coordonnees entieres. Regle haut-gauche :
+ * un pixel sur une arete n'est dessine que si l'arete est haute ou gauche,
+ * deux triangles partageant une arete ne se recouvrent donc pas et ne laissent
+ * pas de trou.
+ * https://fgiesen.wordpress.com/2013/02/10/optimizing-the-basic-rasterizer/
+ */
+extern void RASTER_GenerateFillTriangle(RasterPos *p1, RasterPos *p2,
+                                        RasterPos *p3,
+                                        const RasterRect *scissor,
+                                        const REAL *attribs,
+                                        unsigned nbAttribs,
+                                        RasterSpanKernel kernel, void **args) {
+  assert(nbAttribs <= RASTER_MAX_ATTRIBS);
+  const REAL *a1 = attribs, *a2 = attribs + nbAttribs,
+             *a3 = attribs + 2 * nbAttribs;
+
+  // Aire signee (x2), les triangles sont remis dans le sens positif
+  int64_t area = (int64_t)((int32_t)p2->x - (int32_t)p1->x) *
+                     ((int32_t)p3->y - (int32_t)p1->y) -
+                 (int64_t)((int32_t)p2->y - (int32_t)p1->y) *
+                     ((int32_t)p3->x - (int32_t)p1->x);
+  if (area == 0) // Triangle degenere : aucun pixel
+    return;
+  if (area < 0) {
+    RasterPos *tmp = p2;
+    p2 = p3;
+    p3 = tmp;
+    const REAL *atmp = a2;
+    a2 = a3;
+    a3 = atmp;
+    area = -area;
   }
 
-  // On a p1.y <= p2.y <= p3.y
-  // Cas triviaux :
-  // Triangle plat en bas
-  if (p2->y == p3->y)
-    RASTER_DrawFillBottomFlatTriangle(p1, p2, p3, callbackxy, args);
-  // Triangle plat en haut
-  else if (p1->y == p2->y) {
-    RASTER_DrawFillTopFlatTriangle(p1, p2, p3, callbackxy, args);
-  } else {
-    // Cas general n split le triangle en deux triangles plats
-    float x1 = p1->x, y1 = p1->y, y2 = p2->y, x3 = p3->x, y3 = p3->y;
-    RasterPos intersection = {
-        (uint32_t)(x1 + ((y2 - y1) / (y3 - y1)) * (x3 - x1)), (uint32_t)y2};
-    RASTER_DrawFillBottomFlatTriangle(p1, p2, &intersection, callbackxy, args);
-    RASTER_DrawFillTopFlatTriangle(p2, &intersection, p3, callbackxy, args);
+  // Les coordonnees sont lues en signe : un sommet peut sortir de l'ecran
+  // (bande de garde)
+  int32_t vx1 = p1->x, vx2 = p2->x, vx3 = p3->x;
+  int32_t vy1 = p1->y, vy2 = p2->y, vy3 = p3->y;
+
+  RasterEdge e[3];
+  edgeInit(&e[0], p2, p3);
+  edgeInit(&e[1], p3, p1);
+  edgeInit(&e[2], p1, p2);
+
+  // Plans des attributs : A(x, y) = A1 + steps (x - x1) + dAdy (y - y1)
+  RasterSpan span;
+  double dAdy[RASTER_MAX_ATTRIBS];
+  double x21 = (double)vx2 - vx1, y21 = (double)vy2 - vy1;
+  double x31 = (double)vx3 - vx1, y31 = (double)vy3 - vy1;
+  span.nbAttribs = nbAttribs;
+  for (unsigned k = 0; k < nbAttribs; k++) {
+    double d2 = a2[k] - a1[k], d3 = a3[k] - a1[k];
+    span.steps[k] = (d2 * y31 - d3 * y21) / area;
+    dAdy[k] = (d3 * x21 - d2 * x31) / area;
+  }
+
+  // Boite englobante, alignee sur les blocs
+  int32_t xmin = MIN(MIN(vx1, vx2), vx3);
+  int32_t ymin = MIN(MIN(vy1, vy2), vy3);
+  int32_t xmax = MAX(MAX(vx1, vx2), vx3);
+  int32_t ymax = MAX(MAX(vy1, vy2), vy3);
+  int32_t sx0 = INT32_MIN, sx1 = INT32_MAX, sy0 = INT32_MIN, sy1 = INT32_MAX;
+  if (scissor) {
+    sx0 = scissor->x0;
+    sx1 = scissor->x1;
+    sy0 = scissor->y0;
+    sy1 = scissor->y1;
+    xmin = MAX(xmin, sx0);
+    ymin = MAX(ymin, sy0);
+    xmax = MIN(xmax, sx1 - 1);
+    ymax = MIN(ymax, sy1 - 1);
+    if (xmin > xmax || ymin > ymax)
+      return;
+  }
+  xmin &= ~(RASTER_BLOCK_SIZE - 1);
+  ymin &= ~(RASTER_BLOCK_SIZE - 1);
+
+  RasterLane lane;
+  for (int i = 0; i < RASTER_BLOCK_SIZE; i++)
+    lane[i] = i;
+
+  // Segment [rowX0, rowX1[ de chaque ligne de la bande
+  int32_t rowX0[RASTER_BLOCK_SIZE], rowX1[RASTER_BLOCK_SIZE];
+
+  for (int32_t by = ymin; by <= ymax; by += RASTER_BLOCK_SIZE) {
+    for (int r = 0; r < RASTER_BLOCK_SIZE; r++) {
+      rowX0[r] = INT32_MAX;
+      rowX1[r] = INT32_MIN;
+    }
+
+    bool covered = false;
+    for (int32_t bx = xmin; bx <= xmax; bx += RASTER_BLOCK_SIZE) {
+      // Min et max de chaque fonction d'arete sur le bloc (aux coins)
+      bool reject = false, accept = true;
+      for (int i = 0; i < 3; i++) {
+        int32_t e0 = e[i].a * bx + e[i].b * by + e[i].c;
+        int32_t da = e[i].a * (RASTER_BLOCK_SIZE - 1);
+        int32_t db = e[i].b * (RASTER_BLOCK_SIZE - 1);
+        int32_t emin = e0 + MIN(da, 0) + MIN(db, 0);
+        int32_t emax = e0 + MAX(da, 0) + MAX(db, 0);
+        reject |= emax < 0;
+        accept &= emin >= 0;
+      }
+      if (reject) {
+        // La bande coupe le triangle sur un intervalle de blocs
+        if (covered)
+          break;
+        continue;
+      }
+      covered = true;
+
+      if (accept) {
+        for (int r = 0; r < RASTER_BLOCK_SIZE; r++) {
+          rowX0[r] = MIN(rowX0[r], bx);
+          rowX1[r] = bx + RASTER_BLOCK_SIZE;
+        }
+        continue;
+      }
+
+      // Bloc partiel : une ligne du bloc par pas
+      RasterLane w0 = e[0].a * (bx + lane) + (e[0].b * by + e[0].c);
+      RasterLane w1 = e[1].a * (bx + lane) + (e[1].b * by + e[1].c);
+      RasterLane w2 = e[2].a * (bx + lane) + (e[2].b * by + e[2].c);
+      for (int r = 0; r < RASTER_BLOCK_SIZE; r++) {
+        // Bit de signe nul sur les 3 aretes
+        RasterLane inside = (w0 | w1 | w2) >= 0;
+        for (int i = 0; i < RASTER_BLOCK_SIZE; i++) {
+          if (inside[i]) {
+            rowX0[r] = MIN(rowX0[r], bx + i);
+            rowX1[r] = bx + i + 1;
+          }
+        }
+        w0 += e[0].b;
+        w1 += e[1].b;
+        w2 += e[2].b;
+      }
+    }
+
+    // Emission des segments de la bande
+    for (int r = 0; r < RASTER_BLOCK_SIZE; r++) {
+      int32_t x0 = MAX(rowX0[r], sx0), x1 = MIN(rowX1[r], sx1);
+      if (x0 >= x1 || by + r < sy0 || by + r >= sy1)
+        continue;
+      span.y = by + r;
+      span.x0 = x0;
+      span.x1 = x1;
+      double dx = (double)span.x0 - vx1, dy = (double)span.y - vy1;
+      for (unsigned k = 0; k < nbAttribs; k++)
+        span.attribs[k] = a1[k] + span.steps[k] * dx + dAdy[k] * dy;
+      kernel(&span, args);
+    }
   }
 }
 
 extern void RASTER_DrawFillTriangle(Matrix *s, RasterPos *p1, RasterPos *p2,
                                     RasterPos *p3, color c) {
   void *args[2] = {s, &c};
-  RASTER_GenerateFillTriangle(p1, p2, p3, callbackDrawXY, args);
+  RASTER_GenerateFillTriangle(p1, p2, p3, NULL, NULL, 0, RASTER_SpanFill,
+                              args);
+}
+
+/*
+ * Remplissage d'un segment, ecrit d'un bloc sur la ligne
+ */
+extern void RASTER_SpanFill(const RasterSpan *span, void **args) {
+  Matrix *s = args[0];
+  color c = *(color *)args[1];
+  uint32_t x1 = MIN(span->x1, s->xmax);
+  if (span->y >= s->ymax || span->x0 >= x1)
+    return;
+  color *row = MATRIX_Edit(s, span->x0, span->y);
+  for (uint32_t x = span->x0; x < x1; x++)
+    *row++ = c;
 }
 
 extern void RASTER_DrawCircle(Matrix *s, RasterPos *p, int r, color c) {
@@ -228,74 +360,19 @@ for (int i = 0; i < area; i++)
 /*******************************************************************************
  * Internal function
  ******************************************************************************/
-inline void swap_pos(RasterPos **p1, RasterPos **p2) {
-  RasterPos *tmp = *p1;
-  *p1 = *p2;
-  *p2 = tmp;
-}
-
-// TODO: optimiser en ecrivant tout d'un bloc
-static void RASTER_DrawHorizontalLine(uint32_t x1, uint32_t x2, uint32_t y,
-                                      void (*callbackxy)(uint32_t, uint32_t,
-                                                         void **),
-                                      void **args) {
-  // swap si pas en ordre
-  if (x1 > x2) {
-    x1 ^= x2;
-    x2 ^= x1;
-    x1 ^= x2;
-  }
-
-  for (uint32_t i = x1; i <= x2; i++) {
-    callbackxy(i, y, args);
-    // printf("Writing %u %u\n", i, y);
-  }
-}
-/**
- * http://www.sunshine2k.de/coding/java/TriangleRasterization/TriangleRasterization.html#algo2
+/*
+ * Arete p0 -> p1 d'un triangle dans le sens positif
+ * Haute : horizontale, interieur en dessous (y croissant). Gauche : interieur a
+ * droite. Sur les autres aretes le cas E = 0 est exclu (E >= 1, soit c - 1).
  */
-static void RASTER_DrawFillBottomFlatTriangle(
-    RasterPos *p1, RasterPos *p2, RasterPos *p3,
-    void (*callbackxy)(uint32_t, uint32_t, void **), void **args) {
-
-  float x1 = p1->x, y1 = p1->y, x2 = p2->x, y2 = p2->y, x3 = p3->x, y3 = p3->y;
-
-  float invslope1 = (x2 - x1) / (y2 - y1);
-  float invslope2 = (x3 - x1) / (y3 - y1);
-
-  float curx1 = x1;
-  float curx2 = x1;
-
-  for (int32_t scanlineY = y1; scanlineY <= y2; scanlineY++) {
-    RASTER_DrawHorizontalLine((int)curx1, (int)curx2, scanlineY, callbackxy,
-                              args);
-    curx1 += invslope1;
-    curx2 += invslope2;
-  }
-}
-
-static void
-RASTER_DrawFillTopFlatTriangle(RasterPos *p1, RasterPos *p2, RasterPos *p3,
-                               void (*callbackxy)(uint32_t, uint32_t, void **),
-                               void **args) {
-
-  float x1 = p1->x, y1 = p1->y, x2 = p2->x, y2 = p2->y, x3 = p3->x, y3 = p3->y;
-  float invslope1 = (x3 - x1) / (y3 - y1);
-  float invslope2 = (x3 - x2) / (y3 - y2);
-
-  float curx1 = x3;
-  float curx2 = x3;
-
-  for (int32_t scanlineY = y3; scanlineY >= y1; scanlineY--) {
-    RASTER_DrawHorizontalLine((int)curx1, (int)curx2, scanlineY, callbackxy,
-                              args);
-    curx1 -= invslope1;
-    curx2 -= invslope2;
-  }
-}
-
-static void callbackDrawXY(uint32_t x, uint32_t y, void **args) {
-  Matrix *s = args[0];
-  color c = *(color *)args[1];
-  RASTER_DrawPixelxy(s, x, y, c);
+static inline void edgeInit(RasterEdge *e, const RasterPos *p0,
+                            const RasterPos *p1) {
+  int32_t dx = (int32_t)p1->x - (int32_t)p0->x;
+  int32_t dy = (int32_t)p1->y - (int32_t)p0->y;
+  e->a = -dy;
+  e->b = dx;
+  e->c = dy * (int32_t)p0->x - dx * (int32_t)p0->y;
+  bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+  if (!topLeft)
+    e->c -= 1;
 }
@@ -16,6 +16,9 @@
  * Macros
  ******************************************************************************/
 
+// Nombre maximal d'attributs interpoles le long des segments
+#define RASTER_MAX_ATTRIBS 4
+
 /*******************************************************************************
  * Types
  ******************************************************************************/
@@ -27,6 +30,29 @@ struct RasterPos {
 
 typedef struct RasterPos RasterPos;
 
+/* Rectangle [x0, x1[ x [y0, y1[ */
+typedef struct RasterRect RasterRect;
+struct RasterRect {
+  uint32_t x0, y0;
+  uint32_t x1, y1;
+};
+
+/*
+ * Segment horizontal [x0, x1[ de la ligne y couvert par un triangle
+ * Les attributs valent attribs[k] en x0 et augmentent de steps[k] par pixel.
+ */
+typedef struct RasterSpan RasterSpan;
+struct RasterSpan {
+  uint32_t y;
+  uint32_t x0, x1;
+  unsigned nbAttribs;
+  REAL attribs[RASTER_MAX_ATTRIBS];
+  REAL steps[RASTER_MAX_ATTRIBS];
+};
+
+/* Traitement d'un segment entier (test de profondeur, remplissage...) */
+typedef void (*RasterSpanKernel)(const RasterSpan *span, void **args);
+
 /*******************************************************************************
  * Variables
  ******************************************************************************/
@@ -55,10 +81,22 @@ void RASTER_DrawCircle(Matrix *s, RasterPos *p, int r, color c);
 void RASTER_DrawFillTriangle(Matrix *s, RasterPos *p1, RasterPos *p2,
                              RasterPos *p3, color c);
 
+/*
+ * Rasterise le triangle en segments, transmis au kernel ligne par ligne
+ * scissor : seuls les pixels du rectangle sont emis, NULL pour tous
+ * attribs : nbAttribs valeurs par sommet (p1 puis p2 puis p3), interpolees
+ * lineairement a l'ecran. NULL si nbAttribs = 0.
+ */
 void RASTER_GenerateFillTriangle(RasterPos *p1, RasterPos *p2, RasterPos *p3,
-                                 void (*callbackxy)(uint32_t, uint32_t,
-                                                    void **),
-                                 void **args);
+                                 const RasterRect *scissor,
+                                 const REAL *attribs, unsigned nbAttribs,
+                                 RasterSpanKernel kernel, void **args);
+
+/*
+ * Kernel de remplissage, args : {Matrix *s, color *c}
+ * Les segments hors de la matrice sont tronques.
+ */
+void RASTER_SpanFill(const RasterSpan *span, void **args);
 
 void RASTER_Negate(Matrix *s);
 
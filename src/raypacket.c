@@ -0,0 +1,214 @@
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+
+#include "raypacket.h"
+#include <assert.h>
+#include <math.h>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+/*******************************************************************************
+ * Macros
+ ******************************************************************************/
+
+#define PACKET_EPSILON 0.0000001f
+
+// 1 + 2 * gamma(3) en float, cf BOX3_ROBUST_FACTOR
+#define PACKET_ROBUST_FACTOR 1.00000036f
+
+/*******************************************************************************
+ * Types
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Internal function declaration
+ ******************************************************************************/
+
+static inline PacketFloat packetSelect(PacketMask m, PacketFloat a,
+                                       PacketFloat b);
+static inline PacketFloat packetMin(PacketFloat a, PacketFloat b);
+static inline PacketFloat packetMax(PacketFloat a, PacketFloat b);
+static inline unsigned packetBits(PacketMask m);
+static inline float floatDown(REAL x);
+static inline float floatUp(REAL x);
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Public function
+ ******************************************************************************/
+
+/*
+ * Initialisation d'un paquet de nbRays <= PACKET_SIZE rayons
+ */
+void PACKET_Init(RayPacket *packet, const Vector *origin, const Vector *dirs,
+                 const REAL *tmax, unsigned nbRays) {
+  assert(nbRays <= PACKET_SIZE);
+  packet->ox = origin->x;
+  packet->oy = origin->y;
+  packet->oz = origin->z;
+  for (unsigned i = 0; i < PACKET_SIZE; i++) {
+    // Les rayons absents dupliquent le premier mais sont desactives
+    const Vector *d = &dirs[i < nbRays ? i : 0];
+    packet->dx[i] = d->x;
+    packet->dy[i] = d->y;
+    packet->dz[i] = d->z;
+    packet->tmax[i] = i < nbRays ? tmax[i] : -1;
+  }
+  packet->idx = 1 / packet->dx;
+  packet->idy = 1 / packet->dy;
+  packet->idz = 1 / packet->dz;
+  packet->dd = packet->dx * packet->dx + packet->dy * packet->dy +
+               packet->dz * packet->dz;
+}
+
+/*
+ * Fonctions d'arete dir . (Pj x Pi), sommets relatifs a l'origine. L'origine
+ * etant commune, les produits vectoriels sont scalaires et identiques (au
+ * signe pres) pour deux faces partageant une arete.
+ */
+unsigned PACKET_IntersectTriangle(RayPacket *packet, const REAL *p0,
+                                  const REAL *p1, const REAL *p2) {
+  float ax = p0[0] - packet->ox, ay = p0[1] - packet->oy,
+        az = p0[2] - packet->oz;
+  float bx = p1[0] - packet->ox, by = p1[1] - packet->oy,
+        bz = p1[2] - packet->oz;
+  float cx = p2[0] - packet->ox, cy = p2[1] - packet->oy,
+        cz = p2[2] - packet->oz;
+
+  PacketFloat u = packet->dx * (cy * bz - cz * by) +
+                  packet->dy * (cz * bx - cx * bz) +
+                  packet->dz * (cx * by - cy * bx);
+  PacketFloat v = packet->dx * (ay * cz - az * cy) +
+                  packet->dy * (az * cx - ax * cz) +
+                  packet->dz * (ax * cy - ay * cx);
+  PacketFloat w = packet->dx * (by * az - bz * ay) +
+                  packet->dy * (bz * ax - bx * az) +
+                  packet->dz * (bx * ay - by * ax);
+  PacketFloat det = u + v + w;
+
+  PacketMask hit = ((u >= 0) & (v >= 0) & (w >= 0)) |
+                   ((u <= 0) & (v <= 0) & (w <= 0));
+  hit &= det != 0;
+  // La plupart des triangles d'une feuille sont manques par tout le paquet
+  if (!packetBits(hit))
+    return 0;
+
+  // Point touche P = (u A + v B + w C) / det = t dir
+  PacketFloat px = u * ax + v * bx + w * cx;
+  PacketFloat py = u * ay + v * by + w * cy;
+  PacketFloat pz = u * az + v * bz + w * cz;
+  PacketFloat t = (px * packet->dx + py * packet->dy + pz * packet->dz) /
+                  (det * packet->dd);
+  hit &= (t > PACKET_EPSILON) & (t < packet->tmax);
+
+  packet->tmax = packetSelect(hit, t, packet->tmax);
+  return packetBits(hit);
+}
+
+/*
+ * Boite en float arrondie vers l'exterieur : jamais plus petite que la boite
+ * en REAL
+ */
+void PACKET_BoxBounds(const Vector *min, const Vector *max, float bounds[6]) {
+  bounds[0] = floatDown(min->x);
+  bounds[1] = floatDown(min->y);
+  bounds[2] = floatDown(min->z);
+  bounds[3] = floatUp(max->x);
+  bounds[4] = floatUp(max->y);
+  bounds[5] = floatUp(max->z);
+}
+
+/*
+ * Intersection du paquet avec une boite (slabs). Comme BOX3_RayIntersectBounds
+ * le test est conservatif : la boite est deja arrondie vers l'exterieur et la
+ * sortie de chaque slab multipliee par PACKET_ROBUST_FACTOR.
+ */
+unsigned PACKET_IntersectBox(const RayPacket *packet, const float bounds[6],
+                             float *tnear) {
+  PacketFloat t1, t2;
+  PacketFloat tmin = {0}, tmax = packet->tmax;
+
+  t1 = (bounds[0] - packet->ox) * packet->idx;
+  t2 = (bounds[3] - packet->ox) * packet->idx;
+  tmin = packetMax(tmin, packetMin(t1, t2));
+  tmax = packetMin(tmax, packetMax(t1, t2) * PACKET_ROBUST_FACTOR);
+
+  t1 = (bounds[1] - packet->oy) * packet->idy;
+  t2 = (bounds[4] - packet->oy) * packet->idy;
+  tmin = packetMax(tmin, packetMin(t1, t2));
+  tmax = packetMin(tmax, packetMax(t1, t2) * PACKET_ROBUST_FACTOR);
+
+  t1 = (bounds[2] - packet->oz) * packet->idz;
+  t2 = (bounds[5] - packet->oz) * packet->idz;
+  tmin = packetMax(tmin, packetMin(t1, t2));
+  tmax = packetMin(tmax, packetMax(t1, t2) * PACKET_ROBUST_FACTOR);
+
+  PacketMask in = tmin <= tmax;
+  unsigned bits = packetBits(in);
+  *tnear = INFINITY;
+  if (!bits)
+    return 0;
+  tmin = packetSelect(in, tmin, (PacketFloat){0} + INFINITY);
+  for (unsigned i = 0; i < PACKET_SIZE; i++)
+    *tnear = tmin[i] < *tnear ? tmin[i] : *tnear;
+  return bits;
+}
+
+/* Plus grand tmax du paquet */
+float PACKET_MaxT(const RayPacket *packet) {
+  float t = packet->tmax[0];
+  for (unsigned i = 1; i < PACKET_SIZE; i++)
+    t = packet->tmax[i] > t ? packet->tmax[i] : t;
+  return t;
+}
+
+/*******************************************************************************
+ * Internal function
+ ******************************************************************************/
+
+static inline PacketFloat packetSelect(PacketMask m, PacketFloat a,
+                                       PacketFloat b) {
+  return (PacketFloat)((m & (PacketMask)a) | (~m & (PacketMask)b));
+}
+
+static inline PacketFloat packetMin(PacketFloat a, PacketFloat b) {
+  return packetSelect(a < b, a, b);
+}
+
+static inline PacketFloat packetMax(PacketFloat a, PacketFloat b) {
+  return packetSelect(a > b, a, b);
+}
+
+/* Un bit par rayon, comme movemask */
+static inline unsigned packetBits(PacketMask m) {
+#if defined(__AVX__)
+  return _mm256_movemask_ps((__m256)m);
+#elif defined(__SSE__)
+  return _mm_movemask_ps((__m128)m);
+#else
+  unsigned bits = 0;
+  for (unsigned i = 0; i < PACKET_SIZE; i++)
+    bits |= m[i] ? 1u << i : 0;
+  return bits;
+#endif
+}
+
+/*
+ * Conversion en float arrondie vers le bas / le haut, pour ne jamais
+ * retrecir une boite en double
+ */
+static inline float floatDown(REAL x) {
+  float f = (float)x;
+  return f > x ? nextafterf(f, -INFINITY) : f;
+}
+
+static inline float floatUp(REAL x) {
+  float f = (float)x;
+  return f < x ? nextafterf(f, INFINITY) : f;
+}
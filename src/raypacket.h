@@ -0,0 +1,90 @@
+#ifndef _RAYPACKET_H_
+#define _RAYPACKET_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+
+#include "geo.h"
+
+#include <stdint.h>
+
+/*******************************************************************************
+ * Macros
+ ******************************************************************************/
+
+/* Nombre de rayons par paquet : un registre SSE (4 float) ou AVX (8 float) */
+#if defined(__AVX__)
+#define PACKET_SIZE 8
+#else
+#define PACKET_SIZE 4
+#endif
+
+/* Masque de tous les rayons du paquet */
+#define PACKET_ALL ((1u << PACKET_SIZE) - 1)
+
+/*******************************************************************************
+ * Types
+ ******************************************************************************/
+
+/*
+ * Vecteurs GCC : compiles en SSE/AVX selon la cible, en scalaire sinon
+ */
+typedef float PacketFloat
+    __attribute__((vector_size(PACKET_SIZE * sizeof(float))));
+typedef int32_t PacketMask
+    __attribute__((vector_size(PACKET_SIZE * sizeof(int32_t))));
+
+/*
+ * Paquet de rayons coherents partageant la meme origine (rayons primaires)
+ * Un rayon inactif a un tmax negatif, il ne touche jamais rien.
+ */
+typedef struct RayPacket RayPacket;
+struct RayPacket {
+  float ox, oy, oz;         // Origine commune
+  PacketFloat dx, dy, dz;    // Directions
+  PacketFloat idx, idy, idz; // Inverses des directions
+  PacketFloat dd;            // Normes au carre des directions
+  PacketFloat tmax;          // Distance (parametre t) de la plus proche collision
+};
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/*
+ * Initialisation d'un paquet de nbRays <= PACKET_SIZE rayons
+ * origin + t * dirs[i], t dans ]0, tmax[i][
+ */
+void PACKET_Init(RayPacket *packet, const Vector *origin, const Vector *dirs,
+                 const REAL *tmax, unsigned nbRays);
+
+/*
+ * Intersection etanche du paquet avec un triangle (cf MESH_TRI_Intersect)
+ * Met a jour tmax des rayons touches et retourne leur masque (1 bit / rayon)
+ */
+unsigned PACKET_IntersectTriangle(RayPacket *packet, const REAL *p0,
+                                  const REAL *p1, const REAL *p2);
+
+/*
+ * Boite en float {min x, y, z, max x, y, z} arrondie vers l'exterieur, a
+ * calculer une fois par boite pour PACKET_IntersectBox
+ */
+void PACKET_BoxBounds(const Vector *min, const Vector *max, float bounds[6]);
+
+/*
+ * Intersection du paquet avec une boite (slabs, cf PACKET_BoxBounds)
+ * Retourne le masque des rayons qui entrent dans la boite avant leur tmax et
+ * la plus petite distance d'entree parmi eux.
+ */
+unsigned PACKET_IntersectBox(const RayPacket *packet, const float bounds[6],
+                             float *tnear);
+
+/* Plus grand tmax du paquet */
+float PACKET_MaxT(const RayPacket *packet);
+
+#endif /* _RAYPACKET_H_ */
@@ -7,41 +7,148 @@
 #include "geo.h"
 #include "mesh.h"
 #include "raster.h"
+#include "simplify.h"
 
 #include <assert.h>
 #include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 /*******************************************************************************
  * Macros
  ******************************************************************************/
-// D'apres nos savants calculs
-#define MAX_VERTICES_AFTER_CLIP 7
+// 3 sommets + 1 par plan de clipping (proche et bande de garde)
+#define MAX_VERTICES_AFTER_CLIP 8
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Distance maximale de collision d'un rayon
+#define RAYTRACE_MAX_DIST 10000
+
+// Taille des tuiles distribuees aux threads de raytracing
+#define RAYTRACE_TILE_SIZE 16
+// Distance (pixels) a la geometrie en deca de laquelle un rayon dans le vide
+// de l'historique est relance
+#define RAYTRACE_MISS_MARGIN 2
+
+// Sommets transformes par voie SIMD, 32 octets (divise MESH_SOA_WIDTH)
+#define RD_LANE_SIZE (32 / sizeof(REAL))
+
+// Sommets par job du calcul des normales
+#define RD_NORMALS_BLOCK_SIZE 4096
 
 /*******************************************************************************
  * Types
  ******************************************************************************/
 
+/*
+ * Vecteurs GCC (cf raypacket.h) : 32 octets par operation, 4 sommets en double
+ * ou 8 en float, en SSE2 ou AVX selon la cible
+ */
+typedef REAL RenderLane
+    __attribute__((vector_size(RD_LANE_SIZE * sizeof(REAL))));
+// Resultat d'une comparaison : entiers de la taille de REAL
+typedef __typeof__((RenderLane){0} < (RenderLane){0}) RenderMask;
+
 /*******************************************************************************
  * Internal function declaration
  ******************************************************************************/
 
-static void calcProjectionVertex3(struct Render *rd, struct MeshVertex *p);
-
-static void calcCacheBarycentreFace(struct MeshFace *f);
-
-static void calcWbarycentre(struct MeshFace *f, uint32_t x, uint32_t y,
-                            Vector *outW);
-
-static int computePlaneSegmentIntersection(const Vector segment[2],
-                                           const Vector **facePoints,
-                                           Vector *intersection);
-static void RD_ClipAndRasterFace(struct Render *rd, const MeshFace *face,
-                                 void (*callback)(uint32_t, uint32_t, void **),
+static RasterPos projectWorld(const struct Render *rd, const Vector *world);
+static void transformVertices(const struct Render *rd, const Mesh *mesh,
+                              struct RenderVertices *rv);
+static void reserveVertices(struct RenderVertices *rv, size_t n);
+static void reserveFaces(struct RenderVertices *rv, const Mesh *mesh);
+static inline RasterPos vertexScreen(const struct RenderVertices *rv,
+                                     uint32_t index);
+
+static bool isBoxInFrustum(const struct Render *rd, const Box3 *b);
+
+static REAL boxDepthNear(const struct Render *rd, const Box3 *b);
+static Mesh *selectLod(struct Render *rd, Mesh *mesh);
+static void calcMeshNormales(struct Render *rd, Mesh *mesh);
+
+static void jobVerticesNormales(uint32_t iblock, unsigned ithread,
+                                void **args);
+static void jobMeshLods(uint32_t i_mesh, unsigned ithread, void **args);
+static void jobMeshClusters(uint32_t i_mesh, unsigned ithread, void **args);
+static void jobMeshVertexCache(uint32_t i_mesh, unsigned ithread,
+                               void **args);
+static void clipBatchFaces(struct Render *rd, struct RenderBatch *batch,
+                           uint32_t start, uint32_t end,
+                           const struct RenderCluster *cluster);
+static bool isClusterCulled(const struct Render *rd, const Mesh *mesh,
+                            const MeshCluster *cluster,
+                            struct RenderCluster *rc);
+static void clipAndBinFaces(struct Render *rd);
+static void rasterTile(struct Render *rd, uint32_t itile, RasterRect *tile);
+static void sumTileStats(struct Render *rd);
+static void calcCamera(struct Render *rd);
+static void allocTiles(struct Render *rd);
+static void freeTiles(struct Render *rd);
+static double now(void);
+static inline void calcTileRect(const struct Render *rd, uint32_t itile,
+                                RasterRect *tile);
+static void jobShadeTile(uint32_t itile, unsigned ithread, void **args);
+static void jobRaytracingHistoryTile(uint32_t itile, unsigned ithread,
+                                     void **args);
+static uint32_t geometryVersion(const struct Render *rd);
+static inline void calcRaytracingTileRect(const struct Render *rd,
+                                          uint32_t itile, RasterRect *tile);
+static void jobReprojectMissesTile(uint32_t itile, unsigned ithread,
+                                   void **args);
+static void jobReprojectHitsTile(uint32_t itile, unsigned ithread,
+                                 void **args);
+static void jobResolveHitsTile(uint32_t itile, unsigned ithread,
+                               void **args);
+static bool reuseHistory(const struct Render *rd, struct RenderHistoryHit *h,
+                         const Vector *ray);
+static void jobExpireMissesTile(uint32_t itile, unsigned ithread,
+                                void **args);
+static unsigned traceHistoryPixels(struct Render *rd,
+                                   const RasterPos *pixels, unsigned nb);
+static void shadeTile(struct Render *rd, const struct RenderDeferred *params,
+                      const RasterRect *tile, const MeshFace *const *only);
+static bool isDeferredEqual(const struct RenderDeferred *a,
+                            const struct RenderDeferred *b);
+static const struct RenderPlane *facePlanes(const struct Render *rd,
+                                            const MeshFace *f,
+                                            unsigned *i_mesh);
+static inline void stepNormal(const struct RenderPlane *pl, bool next,
+                              uint32_t x, uint32_t y, Vector *n);
+static inline color shadeNormal(const Vector *n,
+                                const struct RenderDeferred *params);
+
+static inline REAL depthClamp(REAL d);
+static inline REAL depthLoad(const struct Render *rd, uint32_t x,
+                               uint32_t y);
+
+static inline bool isFaceCulled(const struct Render *rd, const Mesh *mesh,
+                                size_t i_face);
+
+static void calcCacheFacePlanes(struct RenderVertices *rv, const Mesh *mesh,
+                                size_t i_face);
+
+static inline void projectClip(const struct Render *rd, const Vector *clip,
+                               Vector *sc);
+static inline RasterPos rasterPos(const Vector *sc);
+static inline bool triangleBounds(const struct RenderTriangle *t,
+                                  const RasterRect *clip, RasterRect *out);
+static unsigned clipPolygonNear(const Vector *in, unsigned nb, Vector *out);
+static unsigned clipPolygonGuard(const struct Render *rd, const Vector *in,
+                                 unsigned nb, Vector *out);
+static unsigned clipFace(const struct Render *rd,
+                         const struct RenderVertices *rv, const uint32_t v[3],
+                         Vector facePoints[MAX_VERTICES_AFTER_CLIP]);
+static void RD_ClipAndRasterFace(struct Render *rd,
+                                 const struct RenderVertices *rv,
+                                 const uint32_t v[3], RasterSpanKernel kernel,
                                  void **args);
 
 /*
@@ -56,11 +163,68 @@ void RD_CalcRayDir(struct Render *rd, unsigned int sx, unsigned int sy,
   // Vec3f ray_dir = normalize(x * u + y * (-v) + w_p);
 }
 
+/*
+ * Parametre t du point x = cam_pos + t * cam_ray
+ */
+static inline REAL rayParam(const struct Vector *cam_pos,
+                              const struct Vector *cam_ray,
+                              const struct Vector *x) {
+  struct Vector d;
+  VECT_Sub(&d, x, cam_pos);
+  return VECT_DotProduct(&d, cam_ray) / VECT_NormSquare(cam_ray);
+}
+
+/*
+ * Intersection du rayon avec une face du mesh (callback du BVH)
+ * args : {mesh, cam_pos, cam_ray, x, face}
+ * Si la face est plus proche que *tmax, on met a jour tmax, x et face
+ */
+static bool callbackRayFace(uint32_t i_face, REAL *tmax, void **args) {
+  const struct Mesh *mesh = args[0];
+  const struct Vector *cam_pos = args[1];
+  const struct Vector *cam_ray = args[2];
+  struct Vector hit, p0, p1, p2;
+  struct MeshFace *mf = MESH_GetFace(mesh, i_face);
+
+  if (!RayIntersectsTriangle(cam_pos, cam_ray,
+                             MESH_GetFaceVertexPos(mesh, i_face, 0, &p0),
+                             MESH_GetFaceVertexPos(mesh, i_face, 1, &p1),
+                             MESH_GetFaceVertexPos(mesh, i_face, 2, &p2), &hit))
+    return false;
+  REAL t = rayParam(cam_pos, cam_ray, &hit);
+  if (t >= *tmax)
+    return false;
+  *tmax = t;
+  VECT_Cpy(args[3], &hit);
+  *(struct MeshFace **)args[4] = mf;
+  return true;
+}
+
+/*
+ * Intersection du rayon avec un triangle precalcule (callback du BVH)
+ * args : {mesh, cam_pos, cam_ray, x, face}
+ */
+static bool callbackRayTriangle(uint32_t i_tri, REAL *tmax, void **args) {
+  const struct Mesh *mesh = args[0];
+  const struct Vector *cam_pos = args[1];
+  const struct Vector *cam_ray = args[2];
+  const MeshTriangle *tri = &mesh->triangles[i_tri];
+  struct Vector rab;
+  REAL t;
+
+  if (!MESH_TRI_Intersect(tri, cam_pos, cam_ray, &t) || t >= *tmax)
+    return false;
+  *tmax = t;
+  VECT_Add(args[3], cam_pos, VECT_MultSca(&rab, cam_ray, t));
+  *(struct MeshFace **)args[4] = MESH_GetFace(mesh, tri->face);
+  return true;
+}
+
 /*
  * Retourne l'intersection de la ray, sa couleur et la distance de collsion
  * return bool : etat du succes. 1 si collision
  * vector x       : POint de croisement                     [OUT]
- * distanceSquare : la distance maximale (dernier valide).  [IN/OUT]
+ * tmax           : parametre t maximal (dernier valide).   [IN/OUT]
  * face           : Pointeur sur la plus proche face pour l'instant [OUT]
  *
  * La couleur et la distance sont mit à jour si collision dans ce mesh
@@ -68,27 +232,37 @@ void RD_CalcRayDir(struct Render *rd, unsigned int sx, unsigned int sy,
 static bool RD_RayTraceOnMesh(const struct Mesh *mesh,
                               const struct Vector *cam_pos,
                               const struct Vector *cam_ray, struct Vector *x,
-                              double *distance, struct MeshFace **face) {
-  static bool hit;
-  static double d;
-  static struct MeshFace *mf;
+                              REAL *tmax, struct MeshFace **face) {
+  void *args[5] = {(void *)mesh, (void *)cam_pos, (void *)cam_ray, x, face};
+  if (mesh->bvh)
+    return BVH_Intersect(mesh->bvh, cam_pos, cam_ray, tmax,
+                         callbackRayTriangle, args);
 
-  hit = false;
+  bool hit = false;
   for (unsigned int i_face = 0; i_face < MESH_GetNbFace(mesh); i_face++) {
-    mf = MESH_GetFace(mesh, i_face);
-    if (RayIntersectsTriangle(cam_pos, cam_ray, &mf->p0->world, &mf->p1->world,
-                              &mf->p2->world, x)) {
-      d = VECT_DistanceSquare(cam_pos, x);
-      if (d < *distance) {
-        *face = MESH_GetFace(mesh, i_face);
-        *distance = d;
-        hit = true;
-      }
-    }
+    if (callbackRayFace(i_face, tmax, args))
+      hit = true;
   }
   return hit;
 }
 
+/*
+ * Intersection du rayon avec un mesh (callback du BVH des meshs)
+ * args : {rd, cam_ray, x, mesh, face, ray precalcule}
+ */
+static bool callbackRayMesh(uint32_t i_mesh, REAL *tmax, void **args) {
+  const struct Render *rd = args[0];
+  REAL tnear;
+  // Rejet du mesh entier par sa boite englobante
+  if (!BOX3_RayIntersect(&rd->meshs[i_mesh]->box, args[5], *tmax, &tnear))
+    return false;
+  if (!RD_RayTraceOnMesh(MESH_GetLod(rd->meshs[i_mesh]), &rd->cam_pos,
+                         args[1], args[2], tmax, args[4]))
+    return false;
+  *(struct Mesh **)args[3] = rd->meshs[i_mesh];
+  return true;
+}
+
 /*
  * Intersection d'un rayon avec toutes les meshs, on retourne le point, la
  * face et la mesh en collision
@@ -96,18 +270,204 @@ static bool RD_RayTraceOnMesh(const struct Mesh *mesh,
 extern bool RD_RayCastOnRD(const struct Render *rd, const struct Vector *ray,
                            struct Vector *x, struct Mesh **mesh,
                            struct MeshFace **face) {
-  double distance = 99999999; // Max dist
-  int hit = false;
+  REAL tmax = RAYTRACE_MAX_DIST / sqrt(VECT_NormSquare(ray));
+  Ray r;
+  RAY_Init(&r, &rd->cam_pos, ray);
+  void *args[6] = {(void *)rd, (void *)ray, x, mesh, face, &r};
+  if (rd->bvh)
+    return BVH_Intersect(rd->bvh, &rd->cam_pos, ray, &tmax, callbackRayMesh,
+                         args);
+
+  bool hit = false;
   for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++) {
-    if (RD_RayTraceOnMesh(rd->meshs[i_mesh], &rd->cam_pos, ray, x, &distance,
-                          face)) {
+    if (callbackRayMesh(i_mesh, &tmax, args))
       hit = true;
-      *mesh = rd->meshs[i_mesh];
-    }
   }
   return hit;
 }
 
+/*
+ * Rayon arrete par un triangle precalcule (callback du BVH) : le parcours
+ * s'arrete au premier trouve
+ * args : {mesh, cam_pos, cam_ray}
+ */
+static bool callbackOccludeTriangle(uint32_t i_tri, REAL *tmax, void **args) {
+  const struct Mesh *mesh = args[0];
+  REAL t;
+  if (!MESH_TRI_Intersect(&mesh->triangles[i_tri], args[1], args[2], &t) ||
+      t >= *tmax)
+    return false;
+  *tmax = 0;
+  return true;
+}
+
+/*
+ * Rayon arrete par un mesh (callback du BVH des meshs)
+ * args : {rd, cam_ray, ray precalcule}
+ */
+static bool callbackOccludeMesh(uint32_t i_mesh, REAL *tmax, void **args) {
+  const struct Render *rd = args[0];
+  REAL tnear, t = *tmax;
+  if (!BOX3_RayIntersect(&rd->meshs[i_mesh]->box, args[2], t, &tnear))
+    return false;
+  const struct Mesh *lod = MESH_GetLod(rd->meshs[i_mesh]);
+  bool hit;
+  if (lod->bvh) {
+    void *argsTri[3] = {(void *)lod, (void *)&rd->cam_pos, args[1]};
+    hit = BVH_Intersect(lod->bvh, &rd->cam_pos, args[1], &t,
+                        callbackOccludeTriangle, argsTri);
+  } else {
+    struct Vector x;
+    struct MeshFace *face;
+    hit = RD_RayTraceOnMesh(lod, &rd->cam_pos, args[1], &x, &t, &face);
+  }
+  if (hit)
+    *tmax = 0;
+  return hit;
+}
+
+/*
+ * Vrai si le rayon touche une face pour t dans ]0, tmax[, sans chercher la
+ * plus proche
+ */
+static bool isRayOccluded(const struct Render *rd, const struct Vector *ray,
+                          REAL tmax) {
+  Ray r;
+  RAY_Init(&r, &rd->cam_pos, ray);
+  void *args[3] = {(void *)rd, (void *)ray, &r};
+  if (rd->bvh)
+    return BVH_Intersect(rd->bvh, &rd->cam_pos, ray, &tmax,
+                         callbackOccludeMesh, args);
+
+  for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++) {
+    if (callbackOccludeMesh(i_mesh, &tmax, args))
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Intersection d'un paquet avec un triangle precalcule (callback du BVH)
+ * args : {mesh, faces}
+ */
+static unsigned callbackPacketTriangle(uint32_t i_tri, RayPacket *packet,
+                                       void **args) {
+  const struct Mesh *mesh = args[0];
+  const MeshTriangle *tri = &mesh->triangles[i_tri];
+  struct MeshFace **faces = args[1];
+  unsigned hits = PACKET_IntersectTriangle(packet, tri->p0, tri->p1, tri->p2);
+  for (unsigned i = 0; i < PACKET_SIZE; i++) {
+    if (hits & (1u << i))
+      faces[i] = MESH_GetFace(mesh, tri->face);
+  }
+  return hits;
+}
+
+/*
+ * Intersection d'un paquet avec une face du mesh, sans triangles precalcules
+ * args : {mesh, faces}
+ */
+static unsigned callbackPacketFace(uint32_t i_face, RayPacket *packet,
+                                   void **args) {
+  const struct Mesh *mesh = args[0];
+  struct MeshFace *mf = MESH_GetFace(mesh, i_face);
+  struct MeshFace **faces = args[1];
+  const uint32_t *v = MESH_GetFaceIndices(mesh, i_face);
+  REAL p[3][3];
+  for (unsigned k = 0; k < 3; k++) {
+    p[k][0] = mesh->posX[v[k]];
+    p[k][1] = mesh->posY[v[k]];
+    p[k][2] = mesh->posZ[v[k]];
+  }
+  unsigned hits = PACKET_IntersectTriangle(packet, p[0], p[1], p[2]);
+  for (unsigned i = 0; i < PACKET_SIZE; i++) {
+    if (hits & (1u << i))
+      faces[i] = mf;
+  }
+  return hits;
+}
+
+/*
+ * Intersection d'un paquet avec un mesh (callback du BVH des meshs)
+ * args : {rd, meshs, faces}
+ */
+static unsigned callbackPacketMesh(uint32_t i_mesh, RayPacket *packet,
+                                   void **args) {
+  const struct Render *rd = args[0];
+  struct Mesh *mesh = rd->meshs[i_mesh];
+  struct Mesh *lod = MESH_GetLod(mesh);
+  struct Mesh **meshs = args[1];
+  void *argsFace[2] = {lod, args[2]};
+  unsigned hits = 0;
+  float tnear, bounds[6];
+
+  // Rejet du mesh entier par sa boite englobante
+  if (!mesh->box.cpt)
+    return 0;
+  PACKET_BoxBounds(&mesh->box.min, &mesh->box.max, bounds);
+  if (!PACKET_IntersectBox(packet, bounds, &tnear))
+    return 0;
+
+  if (lod->bvh) {
+    hits = BVH_IntersectPacket(lod->bvh, packet, callbackPacketTriangle,
+                               argsFace);
+  } else {
+    for (unsigned int i_face = 0; i_face < MESH_GetNbFace(lod); i_face++)
+      hits |= callbackPacketFace(i_face, packet, argsFace);
+  }
+  for (unsigned i = 0; i < PACKET_SIZE; i++) {
+    if (hits & (1u << i))
+      meshs[i] = mesh;
+  }
+  return hits;
+}
+
+/*
+ * Intersection d'un paquet de rayons primaires avec toutes les meshs
+ */
+extern unsigned RD_RayCastPacket(const struct Render *rd,
+                                 const struct Vector *rays, unsigned nbRays,
+                                 struct Vector *x, struct Mesh **mesh,
+                                 struct MeshFace **face) {
+  RayPacket packet;
+  REAL tmax[PACKET_SIZE];
+  for (unsigned i = 0; i < nbRays; i++)
+    tmax[i] = RAYTRACE_MAX_DIST / sqrt(VECT_NormSquare(&rays[i]));
+  PACKET_Init(&packet, &rd->cam_pos, rays, tmax, nbRays);
+
+  // Tableaux pleine taille : les rayons inactifs ne sont jamais touches
+  struct Mesh *meshs[PACKET_SIZE];
+  struct MeshFace *faces[PACKET_SIZE];
+  void *args[3] = {(void *)rd, meshs, faces};
+  unsigned hits = 0;
+  if (rd->bvh) {
+    hits = BVH_IntersectPacket(rd->bvh, &packet, callbackPacketMesh, args);
+  } else {
+    for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++)
+      hits |= callbackPacketMesh(i_mesh, &packet, args);
+  }
+
+  struct Vector rab;
+  for (unsigned i = 0; i < nbRays; i++) {
+    if (hits & (1u << i)) {
+      VECT_Add(&x[i], &rd->cam_pos, VECT_MultSca(&rab, &rays[i], packet.tmax[i]));
+      mesh[i] = meshs[i];
+      face[i] = faces[i];
+    }
+  }
+  return hits;
+}
+
+/*
+ * Couleur d'un pixel touchant la face face du mesh mesh
+ */
+static inline color rayColor(const struct Render *rd, const struct Mesh *mesh,
+                             const struct MeshFace *face) {
+  if (mesh == rd->highlightedMesh && face == rd->highlightedFace)
+    return CL_Negate(face->color);
+  return face->color;
+}
+
 /*
  * Intersection avec tout les meshs
  * On retourne le point de croisement x
@@ -116,11 +476,8 @@ extern color RD_RayTraceOnRD(const struct Render *rd, const struct Vector *ray,
                              struct Vector *x) {
   struct Mesh *mesh = NULL;
   struct MeshFace *face = NULL;
-  if (RD_RayCastOnRD(rd, ray, x, &mesh, &face)) {
-    if (mesh == rd->highlightedMesh && face == rd->highlightedFace)
-      return CL_Negate(face->color);
-    return face->color;
-  }
+  if (RD_RayCastOnRD(rd, ray, x, &mesh, &face))
+    return rayColor(rd, mesh, face);
   return CL_BLACK; // background color
 }
 
@@ -130,6 +487,13 @@ extern color RD_RayTraceOnRD(const struct Render *rd, const struct Vector *ray,
 void RD_SetCam(struct Render *rd, const struct Vector *cam_pos,
                const struct Vector *cam_forward,
                const struct Vector *cam_up_world) {
+  // Camera inchangee : les precalculs et les projections restent valides
+  if (rd->camVersion && (!cam_pos || VECT_Eq(cam_pos, &rd->cam_pos)) &&
+      (!cam_forward || VECT_Eq(cam_forward, &rd->cam_forward)) &&
+      (!cam_up_world || VECT_Eq(cam_up_world, &rd->cam_up_world)))
+    return;
+  rd->camVersion++;
+
   // Mise a jout des variables maitresses
   if (cam_pos != NULL)
     VECT_Cpy(&rd->cam_pos, cam_pos);
@@ -137,7 +501,13 @@ void RD_SetCam(struct Render *rd, const struct Vector *cam_pos,
     VECT_Cpy(&rd->cam_forward, cam_forward);
   if (cam_up_world != NULL)
     VECT_Cpy(&rd->cam_up_world, cam_up_world);
+  calcCamera(rd);
+}
 
+/*
+ * Repere, rayons, projection et frustum de la camera pour la taille du raster
+ */
+static void calcCamera(struct Render *rd) {
   // forward
   VECT_Cpy(&rd->cam_w, &rd->cam_forward);
   VECT_Normalise(&rd->cam_w);
@@ -162,6 +532,32 @@ void RD_SetCam(struct Render *rd, const struct Vector *cam_pos,
   rd->tx = -VECT_DotProduct(&rd->cam_u, &rd->cam_pos);
   rd->ty = -VECT_DotProduct(&rd->cam_v, &rd->cam_pos);
   rd->tz = +VECT_DotProduct(&rd->cam_w, &rd->cam_pos);
+  // Matrice world to clip : x et y mis a l'echelle de l'ecran (|x| <= w a
+  // l'ecran), w = cam.z
+  const struct Vector *rows[3] = {&rd->cam_u, &rd->cam_v, &rd->cam_w};
+  const double k[3] = {rd->s * rd->scalex, rd->s * rd->scaley, -1};
+  const double t[3] = {rd->tx, rd->ty, -rd->tz};
+  for (int i = 0; i < 3; i++) {
+    rd->viewProj[i][0] = k[i] * rows[i]->x;
+    rd->viewProj[i][1] = k[i] * rows[i]->y;
+    rd->viewProj[i][2] = k[i] * rows[i]->z;
+    rd->viewProj[i][3] = k[i] * t[i];
+  }
+
+  /* Précalcul frustum */
+  // Un point est a l'ecran si |cam.x| <= cam.z * kx et |cam.y| <= cam.z * ky
+  double kx = 1 / (rd->s * rd->scalex), ky = 1 / (rd->s * rd->scaley);
+  struct Vector back, side;
+  VECT_MultSca(&back, &rd->cam_w, -1);
+  for (int i = 0; i < 4; i++) {
+    VECT_MultSca(&rd->frustum_n[i], &back, i < 2 ? kx : ky);
+    VECT_MultSca(&side, i < 2 ? &rd->cam_u : &rd->cam_v, i % 2 ? 1 : -1);
+    VECT_Add(&rd->frustum_n[i], &rd->frustum_n[i], &side);
+  }
+  rd->frustum_n[4] = back;
+  for (int i = 0; i < RD_FRUSTUM_NB_PLANES; i++)
+    rd->frustum_d[i] = VECT_DotProduct(&rd->frustum_n[i], &rd->cam_pos);
+  rd->frustum_d[4] += RD_NEAR;
 }
 
 /*******************************************************************************
@@ -182,39 +578,153 @@ extern struct Render *RD_Init(unsigned int xmax, unsigned int ymax) {
   ret->nb_meshs = 0;
   ret->meshs = malloc(sizeof(struct mesh *) * ret->nb_meshs);
   assert(ret->meshs);
+  ret->vertices = NULL;
+  ret->bvh = NULL;
   ret->raster = MATRIX_Init(xmax, ymax, sizeof(color), "color");
-  ret->zbuffer = MATRIX_Init(xmax, ymax, sizeof(double), "double");
+  ret->outputX = xmax;
+  ret->outputY = ymax;
+  ret->frameBudget = ret->frameTime = ret->frameStart = 0;
+  ret->scale = 1;
+  ret->zbuffer = NULL;
+  ret->zbufferVersion = 0;
+  RD_SetDepthFormat(ret, RD_DEPTH_FLOAT);
   ret->fbuffer = MATRIX_Init(xmax, ymax, sizeof(MeshFace *), "MF*");
   ret->gbuffer = MATRIX_Init(xmax, ymax, sizeof(Vector), "VECT");
+  ret->pool = TP_Init(0);
+
+  allocTiles(ret);
+  ret->batches = NULL;
+  ret->nbBatches = 0;
+  ret->nbBatchesAlloc = 0;
 
   // Repere
-  VECT_Cpy(&ret->p0.world, &VECT_0);
-  VECT_Cpy(&ret->px.world, &VECT_X);
-  VECT_Cpy(&ret->py.world, &VECT_Y);
-  VECT_Cpy(&ret->pz.world, &VECT_Z);
+  VECT_Cpy(&ret->axis[0], &VECT_0);
+  VECT_Cpy(&ret->axis[1], &VECT_X);
+  VECT_Cpy(&ret->axis[2], &VECT_Y);
+  VECT_Cpy(&ret->axis[3], &VECT_Z);
 
   ret->highlightedMesh = NULL;
   ret->highlightedFace = NULL;
+  ret->raytracingPackets = true;
+  ret->historyMaxAge = 0;
+  ret->history = ret->historyNext = NULL;
+  ret->historyHits = ret->historyHitsNext = NULL;
+  ret->historyTarget = NULL;
+  ret->historyValid = false;
+  ret->historyVersion = ret->historyCamVersion = 0;
+  ret->camVersion = 0;
+  ret->sceneVersion = 1;
+  ret->zbufferVersion = ret->planesVersion = ret->gbufferVersion = 0;
+  ret->rasterVersion = 0;
+  ret->rasterHighlight = NULL;
+  memset(&ret->stats, 0, sizeof(struct RenderStats));
 
   // cam
   ret->fov_rad = 1.0;
-  struct Vector cam_pos = {100000, 100000, 100000};
-  struct Vector cam_forward = {100000, 100000, 100000};
-  struct Vector cam_up = {0, 1, 0};
-  RD_SetCam(ret, &cam_pos, &cam_forward, &cam_up);
 
-  // Projection values
+  // Projection values (utilisees par RD_SetCam pour le frustum)
   ret->s = 1 / (tan(ret->fov_rad / 2));
   ret->scalex = (double)ret->raster->ymax / (double)ret->raster->xmax;
   ret->scaley = 1;
+
+  struct Vector cam_pos = {100000, 100000, 100000};
+  struct Vector cam_forward = {100000, 100000, 100000};
+  struct Vector cam_up = {0, 1, 0};
+  RD_SetCam(ret, &cam_pos, &cam_forward, &cam_up);
   return ret;
 }
 
+/*
+ * Change le format du z buffer (realloue, son contenu est perdu)
+ */
+extern void RD_SetDepthFormat(struct Render *rd,
+                              enum RenderDepthFormat format) {
+  static const struct {
+    uint32_t size;
+    char *name;
+  } formats[] = {[RD_DEPTH_FLOAT] = {sizeof(float), "float"},
+                 [RD_DEPTH_UNORM24] = {sizeof(uint32_t), "unorm24"},
+                 [RD_DEPTH_UNORM16] = {sizeof(uint16_t), "unorm16"}};
+  if (rd->zbuffer)
+    MATRIX_Free(rd->zbuffer);
+  rd->zbufferVersion = 0;
+  rd->depthFormat = format;
+  rd->zbuffer = MATRIX_Init(rd->raster->xmax, rd->raster->ymax,
+                            formats[format].size, formats[format].name);
+  memset(rd->zbuffer->data, 0,
+         rd->zbuffer->elemsize * rd->zbuffer->xmax * rd->zbuffer->ymax);
+}
+
+extern void RD_SetResolution(struct Render *rd, unsigned int xmax,
+                             unsigned int ymax) {
+  MATRIX_Resize(rd->raster, xmax, ymax);
+  MATRIX_Resize(rd->fbuffer, xmax, ymax);
+  MATRIX_Resize(rd->gbuffer, xmax, ymax);
+  RD_SetDepthFormat(rd, rd->depthFormat);
+  freeTiles(rd);
+  allocTiles(rd);
+  rd->scalex = (double)ymax / (double)xmax;
+  calcCamera(rd);
+  // Projections, tampons et raster a recalculer
+  rd->camVersion++;
+  rd->gbufferVersion = rd->rasterVersion = 0;
+  rd->historyValid = false;
+}
+
+extern void RD_SetFrameBudget(struct Render *rd, double budget) {
+  rd->frameBudget = budget > 0 ? budget : 0;
+  rd->frameTime = rd->frameStart = 0;
+  if (!rd->frameBudget && rd->scale != 1) {
+    rd->scale = 1;
+    RD_SetResolution(rd, rd->outputX, rd->outputY);
+  }
+}
+
+extern bool RD_AdaptResolutionTime(struct Render *rd, double elapsed) {
+  if (!rd->frameBudget || elapsed <= 0)
+    return false;
+  rd->frameTime = rd->frameTime ? rd->frameTime + RD_DYNRES_SMOOTHING *
+                                                      (elapsed - rd->frameTime)
+                                : elapsed;
+  if (fabs(rd->frameTime - rd->frameBudget) <=
+      RD_DYNRES_TOLERANCE * rd->frameBudget)
+    return false;
+
+  double scale = rd->scale * sqrt(rd->frameBudget / rd->frameTime);
+  scale = scale < RD_DYNRES_MIN_SCALE ? RD_DYNRES_MIN_SCALE
+                                      : scale > 1 ? 1 : scale;
+  unsigned int xmax = MAX(1, (unsigned int)round(scale * rd->outputX));
+  unsigned int ymax = MAX(1, (unsigned int)round(scale * rd->outputY));
+  if (xmax == rd->raster->xmax && ymax == rd->raster->ymax)
+    return false;
+  rd->scale = scale;
+  RD_SetResolution(rd, xmax, ymax);
+  // Les temps sont a remesurer a la nouvelle taille
+  rd->frameTime = 0;
+  return true;
+}
+
+extern void RD_AdaptResolution(struct Render *rd) {
+  double t = now();
+  double elapsed = rd->frameStart ? t - rd->frameStart : 0;
+  rd->frameStart = t;
+  // Sans compter le redimensionnement
+  if (RD_AdaptResolutionTime(rd, elapsed))
+    rd->frameStart = now();
+}
+
 /* Ajoute une mesh au render, aucune copie n'est faite */
 extern void RD_AddMesh(struct Render *rd, struct Mesh *m) {
   rd->nb_meshs++;
   rd->meshs = realloc(rd->meshs, sizeof(struct mesh *) * rd->nb_meshs);
   rd->meshs[rd->nb_meshs - 1] = m;
+  rd->vertices =
+      realloc(rd->vertices, sizeof(struct RenderVertices) * rd->nb_meshs);
+  assert(rd->vertices);
+  memset(&rd->vertices[rd->nb_meshs - 1], 0, sizeof(struct RenderVertices));
+  // La hierarchie des meshs n'est plus a jour
+  BVH_Free(rd->bvh);
+  rd->bvh = NULL;
 }
 
 void RD_Print(struct Render *rd) {
@@ -237,169 +747,1220 @@ void RD_Print(struct Render *rd) {
   printf("\n");
 }
 
+void RD_PrintStats(struct Render *rd) {
+  printf("meshs culled: %u/%u, faces culled: %u\n", rd->stats.nbMeshsCulled,
+         rd->nb_meshs, rd->stats.nbFacesCulled);
+  printf("lod: faces drawn %u/%u\n", rd->stats.nbFacesDrawn,
+         rd->stats.nbFacesLoaded);
+  printf("clusters culled: %u\n", rd->stats.nbClustersCulled);
+  printf("projections reused: %u meshs\n", rd->stats.nbMeshsReused);
+  printf("raytracing: %u rays, %u pixels reprojected, %u occlusion rays\n",
+         rd->stats.nbRaysTraced, rd->stats.nbPixelsReprojected,
+         rd->stats.nbOcclusionRays);
+  printf("occluded (per tile): meshs %u, clusters %u, triangles %u\n",
+         rd->stats.nbMeshsOccluded, rd->stats.nbClustersOccluded,
+         rd->stats.nbTrianglesOccluded);
+}
+
+/*
+ * Projection des sommets des meshs visibles, au niveau de detail choisi pour
+ * l'image. Les meshs hors du frustum sont marques invisibles et ignores par le
+ * rendu. Un mesh dont le niveau, la version et la camera n'ont pas change
+ * garde sa projection ; si rien ne change, sceneVersion n'est pas incremente
+ * et les tampons ecran sont repris tels quels.
+ */
 extern void RD_CalcProjectionVertices(struct Render *rd) {
   Mesh *mesh;
+  bool changed = false;
   // Vertices
+  rd->stats.nbMeshsCulled = 0;
+  rd->stats.nbFacesLoaded = 0;
+  rd->stats.nbFacesDrawn = 0;
+  rd->stats.nbMeshsReused = 0;
   for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++) {
     mesh = rd->meshs[i_mesh];
-    for (unsigned int i_v = 0; i_v < MESH_GetNbVertice(mesh); i_v++) {
-      calcProjectionVertex3(rd, MESH_GetVertex(mesh, i_v));
+    struct RenderVertices *rv = &rd->vertices[i_mesh];
+    bool wasVisible = rv->visible;
+    rv->visible = isBoxInFrustum(rd, &mesh->box);
+    changed |= rv->visible != wasVisible;
+    if (!rv->visible) {
+      rd->stats.nbMeshsCulled++;
+      continue;
+    }
+    rv->depthNear = boxDepthNear(rd, &mesh->box);
+    Mesh *lod = selectLod(rd, mesh);
+    if (rv->mesh == lod && rv->meshVersion == lod->version &&
+        rv->camVersion == rd->camVersion) {
+      rd->stats.nbMeshsReused++;
+      continue;
     }
+    transformVertices(rd, lod, rv);
+    rv->mesh = lod;
+    rv->meshVersion = lod->version;
+    rv->camVersion = rd->camVersion;
+    changed = true;
   }
+  if (changed)
+    rd->sceneVersion++;
   // Repere
-  calcProjectionVertex3(rd, &rd->p0);
-  calcProjectionVertex3(rd, &rd->px);
-  calcProjectionVertex3(rd, &rd->py);
-  calcProjectionVertex3(rd, &rd->pz);
+  for (int i = 0; i < 4; i++)
+    rd->axisScreen[i] = projectWorld(rd, &rd->axis[i]);
 }
 
 extern void RD_CalcNormales(struct Render *rd) {
   Mesh *mesh;
   for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++) {
     mesh = rd->meshs[i_mesh];
-    // Calcul des normales de face
-    for (unsigned int i = 0; i < MESH_GetNbFace(mesh); i++) {
-      MESH_FACE_CalcNormaleFace(MESH_GetFace(mesh, i));
-    }
-    // Calcul des normales de sommets
-    MESH_CalcVerticesNormales(mesh);
+    calcMeshNormales(rd, mesh);
+    for (unsigned int i = 0; i < mesh->nbLods; i++)
+      calcMeshNormales(rd, mesh->lods[i]);
   }
 }
 
+/*
+ * Un mesh simplifie par job : les meshs sont independants
+ */
+extern void RD_CalcLods(struct Render *rd) {
+  void *args[1] = {rd};
+  TP_Run(rd->pool, rd->nb_meshs, jobMeshLods, args);
+}
+
+extern void RD_CalcClusters(struct Render *rd) {
+  void *args[1] = {rd};
+  TP_Run(rd->pool, rd->nb_meshs, jobMeshClusters, args);
+}
+
+extern void RD_OptimizeVertexCache(struct Render *rd) {
+  void *args[1] = {rd};
+  TP_Run(rd->pool, rd->nb_meshs, jobMeshVertexCache, args);
+}
+
+/*
+ * Construit les hierarchies de chaque mesh puis celle des meshs
+ */
+extern void RD_CalcBvh(struct Render *rd) {
+  Box3 *boxes = malloc(sizeof(Box3) * (rd->nb_meshs ? rd->nb_meshs : 1));
+  assert(boxes);
+  for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++) {
+    MESH_CalcBvh(rd->meshs[i_mesh]);
+    for (unsigned int i = 0; i < rd->meshs[i_mesh]->nbLods; i++)
+      MESH_CalcBvh(rd->meshs[i_mesh]->lods[i]);
+    // Les niveaux de detail restent dans la boite du mesh
+    boxes[i_mesh] = rd->meshs[i_mesh]->box;
+    if (!boxes[i_mesh].cpt) // Mesh vide
+      BOX3_AddPoint(&boxes[i_mesh], (Vector *)&VECT_0);
+  }
+  BVH_Free(rd->bvh);
+  rd->bvh = BVH_Build(boxes, rd->nb_meshs);
+  free(boxes);
+}
+
 extern void RD_calcCacheBarycentres(struct Render *rd) {
   Mesh *mesh;
+  if (rd->planesVersion == rd->sceneVersion)
+    return;
+  rd->planesVersion = rd->sceneVersion;
   for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++) {
-    mesh = rd->meshs[i_mesh];
+    if (!rd->vertices[i_mesh].visible)
+      continue;
+    mesh = MESH_GetLod(rd->meshs[i_mesh]);
     for (unsigned int i = 0; i < MESH_GetNbFace(mesh); i++) {
-      calcCacheBarycentreFace(MESH_GetFace(mesh, i));
+      calcCacheFacePlanes(&rd->vertices[i_mesh], mesh, i);
     }
   }
 }
 
 /*
- * https://codeplea.com/triangular-interpolation?fbclid=IwAR38TFpipmfuQ5bM2P0Y07eym1ZHlt7-ZlcZAnEIb7EeOYU3uJzqWxuK0Ws
+ * Test et ecriture de profondeur d'un segment, la profondeur inversee est le
+ * premier attribut interpole. Les blocs Hi-Z couverts sont marques sales.
+ * args : {rd, face, hiz, tile}
  */
-static void callbackWriteZbuffer(uint32_t x, uint32_t y, void **args) {
-  // Args
-  MeshFace *f = (struct MeshFace *)args[1];
-  struct Render *rd = (struct Render *)args[0];
+static void kernelWriteZbuffer(const RasterSpan *span, void **args) {
+  struct Render *rd = args[0];
+  MeshFace *f = args[1];
+  struct RenderHiZ *hiz = args[2];
+  const RasterRect *tile = args[3];
 
   // Check args
-  assert(x < rd->zbuffer->xmax || y < rd->zbuffer->ymax);
+  assert(span->x1 <= rd->zbuffer->xmax && span->y < rd->zbuffer->ymax);
+
+  MeshFace **frow = MATRIX_Edit(rd->fbuffer, span->x0, span->y);
+  REAL d = span->attribs[0], dd = span->steps[0];
+  uint32_t n = span->x1 - span->x0;
+  // Les sommets etant arrondis, d peut etre extrapole hors de [0, 1] au bord
+  switch (rd->depthFormat) {
+  case RD_DEPTH_FLOAT: {
+    float *zrow = MATRIX_Edit(rd->zbuffer, span->x0, span->y);
+    for (uint32_t i = 0; i < n; i++, d += dd) {
+      float df = depthClamp(d);
+      if (df > zrow[i]) { // SI plus proche
+        zrow[i] = df;
+        frow[i] = f;
+      }
+    }
+    break;
+  }
+  case RD_DEPTH_UNORM24: {
+    uint32_t *zrow = MATRIX_Edit(rd->zbuffer, span->x0, span->y);
+    for (uint32_t i = 0; i < n; i++, d += dd) {
+      uint32_t q = depthClamp(d) * RD_DEPTH_UNORM24_MAX + 0.5;
+      if (q > zrow[i]) {
+        zrow[i] = q;
+        frow[i] = f;
+      }
+    }
+    break;
+  }
+  case RD_DEPTH_UNORM16: {
+    uint16_t *zrow = MATRIX_Edit(rd->zbuffer, span->x0, span->y);
+    for (uint32_t i = 0; i < n; i++, d += dd) {
+      uint16_t q = depthClamp(d) * RD_DEPTH_UNORM16_MAX + 0.5;
+      if (q > zrow[i]) {
+        zrow[i] = q;
+        frow[i] = f;
+      }
+    }
+    break;
+  }
+  }
 
-  static struct Vector w; // C'est plus un triplet de 3 coefs qu'un vector
-  calcWbarycentre(f, x, y, &w);
-  double z4 = w.x * f->p0->sc.z + w.y * f->p1->sc.z + w.z * f->p2->sc.z;
+  uint32_t by = (span->y - tile->y0) / RD_HIZ_BLOCK_SIZE;
+  uint32_t bx0 = (span->x0 - tile->x0) / RD_HIZ_BLOCK_SIZE;
+  uint32_t bx1 = (span->x1 - 1 - tile->x0) / RD_HIZ_BLOCK_SIZE;
+  for (uint32_t bx = bx0; bx <= bx1; bx++)
+    hiz->dirty |= (uint64_t)1 << (by * RD_HIZ_NB_BLOCKS + bx);
+}
 
-  if (z4 > 1000000000 || z4 < 0 || isnan(z4)) {
-    printf("Z = %f\n", z4);
-    printf("w1 = %f, w2 = %f, w3 = %f\n", w.x, w.y, w.z);
-    VECT_Print(&f->p0->sc);
-    VECT_Print(&f->p1->sc);
-    VECT_Print(&f->p2->sc);
-    printf("\n");
-    assert(0);
+/*
+ * Profondeur inversee minimale du bloc (bx, by) de la tuile, recalculee si
+ * sale
+ */
+static REAL hizBlockMin(const struct Render *rd, struct RenderHiZ *hiz,
+                          const RasterRect *tile, uint32_t bx, uint32_t by) {
+  uint32_t ib = by * RD_HIZ_NB_BLOCKS + bx;
+  if (!(hiz->dirty & ((uint64_t)1 << ib)))
+    return hiz->blockMin[ib];
+
+  uint32_t x0 = tile->x0 + bx * RD_HIZ_BLOCK_SIZE;
+  uint32_t y0 = tile->y0 + by * RD_HIZ_BLOCK_SIZE;
+  uint32_t x1 = MIN(x0 + RD_HIZ_BLOCK_SIZE, tile->x1);
+  uint32_t y1 = MIN(y0 + RD_HIZ_BLOCK_SIZE, tile->y1);
+  REAL dmin = INFINITY;
+  // Un pixel vide (0) donne directement le minimum
+  for (uint32_t y = y0; y < y1 && dmin > 0; y++) {
+    for (uint32_t x = x0; x < x1; x++) {
+      REAL d = depthLoad(rd, x, y);
+      dmin = d < dmin ? d : dmin;
+    }
+  }
+  hiz->blockMin[ib] = dmin;
+  hiz->dirty &= ~((uint64_t)1 << ib);
+  return dmin;
+}
+
+/*
+ * Vrai si tous les pixels deja ecrits du rectangle r (inclus dans la tuile)
+ * sont plus proches que la profondeur inversee dmax
+ */
+static bool hizIsOccluded(const struct Render *rd, struct RenderHiZ *hiz,
+                          const RasterRect *tile, const RasterRect *r,
+                          REAL dmax) {
+  for (uint32_t by = (r->y0 - tile->y0) / RD_HIZ_BLOCK_SIZE;
+       by <= (r->y1 - 1 - tile->y0) / RD_HIZ_BLOCK_SIZE; by++) {
+    for (uint32_t bx = (r->x0 - tile->x0) / RD_HIZ_BLOCK_SIZE;
+         bx <= (r->x1 - 1 - tile->x0) / RD_HIZ_BLOCK_SIZE; bx++) {
+      if (hizBlockMin(rd, hiz, tile, bx, by) <= dmax)
+        return false;
+    }
   }
+  return true;
+}
+
+/*
+ * Normales d'un bloc de sommets (job du pool)
+ * args : {mesh}
+ */
+static void jobVerticesNormales(uint32_t iblock, unsigned ithread,
+                                void **args) {
+  (void)ithread;
+  Mesh *mesh = args[0];
+  size_t start = (size_t)iblock * RD_NORMALS_BLOCK_SIZE;
+  size_t end = MIN(start + RD_NORMALS_BLOCK_SIZE, MESH_GetNbVertice(mesh));
+  MESH_CalcVerticesNormalesRange(mesh, start, end);
+}
+
+/*
+ * Niveaux de detail d'un mesh (job du pool)
+ * args : {rd}
+ */
+static void jobMeshLods(uint32_t i_mesh, unsigned ithread, void **args) {
+  (void)ithread;
+  struct Render *rd = args[0];
+  SIMPLIFY_CalcLods(rd->meshs[i_mesh]);
+}
+
+/*
+ * Clusters d'un mesh et de ses niveaux (job du pool)
+ * args : {rd}
+ */
+static void jobMeshClusters(uint32_t i_mesh, unsigned ithread, void **args) {
+  (void)ithread;
+  struct Render *rd = args[0];
+  Mesh *mesh = rd->meshs[i_mesh];
+  MESH_CalcClusters(mesh);
+  for (unsigned int i = 0; i < mesh->nbLods; i++)
+    MESH_CalcClusters(mesh->lods[i]);
+}
 
-  if (*(double *)MATRIX_Edit(rd->zbuffer, x, y) > z4 ||
-      *(double *)MATRIX_Edit(rd->zbuffer, x, y) < 0.f) { // SI plus proche
-    *(double *)MATRIX_Edit(rd->zbuffer, x, y) = z4;
-    *(MeshFace **)MATRIX_Edit(rd->fbuffer, x, y) = f;
+/*
+ * Ordre des faces et sommets d'un mesh et de ses niveaux (job du pool)
+ * args : {rd}
+ */
+static void jobMeshVertexCache(uint32_t i_mesh, unsigned ithread,
+                               void **args) {
+  (void)ithread;
+  struct Render *rd = args[0];
+  Mesh *mesh = rd->meshs[i_mesh];
+  MESH_OptimizeVertexCache(mesh);
+  for (unsigned int i = 0; i < mesh->nbLods; i++)
+    MESH_OptimizeVertexCache(mesh->lods[i]);
+}
+
+/*
+ * Clipping d'un lot de faces (job du pool), les clusters rejetes sont
+ * ignores en bloc
+ * args : {rd}
+ */
+static void jobClipBatch(uint32_t ibatch, unsigned ithread, void **args) {
+  (void)ithread;
+  struct Render *rd = args[0];
+  struct RenderBatch *batch = &rd->batches[ibatch];
+
+  ARRLIST_Clear(batch->triangles);
+  batch->nbFacesCulled = 0;
+  batch->nbClustersCulled = 0;
+  if (batch->clusterStart == batch->clusterEnd) {
+    clipBatchFaces(rd, batch, batch->start, batch->end, NULL);
+    return;
+  }
+  for (uint32_t i = batch->clusterStart; i < batch->clusterEnd; i++) {
+    const MeshCluster *cluster = &batch->lod->clusters[i];
+    struct RenderCluster *rc = &batch->vertices->clusters[i];
+    if (isClusterCulled(rd, batch->lod, cluster, rc)) {
+      batch->nbClustersCulled++;
+      continue;
+    }
+    clipBatchFaces(rd, batch, cluster->start, cluster->end, rc);
   }
 }
 
+/*
+ * Clipping des faces [start, end[ du lot
+ */
+static void clipBatchFaces(struct Render *rd, struct RenderBatch *batch,
+                           uint32_t start, uint32_t end,
+                           const struct RenderCluster *cluster) {
+  Vector facePoints[MAX_VERTICES_AFTER_CLIP];
+  struct RenderTriangle tri;
+  tri.vertices = batch->vertices;
+  tri.cluster = cluster;
+  for (uint32_t i_f = start; i_f < end; i_f++) {
+    if (isFaceCulled(rd, batch->lod, i_f)) {
+      batch->nbFacesCulled++;
+      continue;
+    }
+    // Chaque face n'appartient qu'a un lot : le cache est ecrit sans verrou
+    calcCacheFacePlanes(batch->vertices, batch->lod, i_f);
+    unsigned facePointsNb =
+        clipFace(rd, batch->vertices, MESH_GetFaceIndices(batch->lod, i_f),
+                 facePoints);
+    // Triangulation en eventail du polygone clippe
+    tri.face = MESH_GetFace(batch->lod, i_f);
+    for (unsigned i = 2; i < facePointsNb; i++) {
+      const Vector *p[3] = {&facePoints[0], &facePoints[i - 1], &facePoints[i]};
+      for (int k = 0; k < 3; k++) {
+        tri.p[k] = rasterPos(p[k]);
+        tri.depth[k] = RD_NEAR / p[k]->z;
+      }
+      ARRLIST_Add(batch->triangles, &tri);
+    }
+  }
+}
+
+/*
+ * Rasterisation des triangles d'une tuile dans sa partie des z et f buffers
+ * (job du pool). Les tuiles etant disjointes, aucun verrou n'est necessaire.
+ * args : {rd}
+ */
+static void jobRasterTile(uint32_t itile, unsigned ithread, void **args) {
+  (void)ithread;
+  RasterRect tile;
+  rasterTile(args[0], itile, &tile);
+}
+
+/*
+ * Rasterisation puis ombrage d'une tuile (job du pool) : ses z et f buffers
+ * sont encore en cache quand ses pixels sont resolus
+ * args : {rd, params}
+ */
+static void jobDeferredTile(uint32_t itile, unsigned ithread, void **args) {
+  (void)ithread;
+  struct Render *rd = args[0];
+  RasterRect tile;
+  rasterTile(rd, itile, &tile);
+  shadeTile(rd, args[1], &tile, NULL);
+}
+
+/*
+ * Ombrage seul d'une tuile deja rasterisee (job du pool), limite aux pixels
+ * des deux faces de only si non NULL
+ * args : {rd, params, only}
+ */
+static void jobShadeTile(uint32_t itile, unsigned ithread, void **args) {
+  (void)ithread;
+  struct Render *rd = args[0];
+  RasterRect tile;
+  calcTileRect(rd, itile, &tile);
+  shadeTile(rd, args[1], &tile, args[2]);
+}
+
+/*
+ * Ombrage et filtre des pixels de la tuile d'apres le f buffer, la face
+ * surlignee est inversee. Si only n'est pas NULL, seuls les pixels de ses deux
+ * faces sont ecrits.
+ */
+static void shadeTile(struct Render *rd, const struct RenderDeferred *params,
+                      const RasterRect *tile, const MeshFace *const *only) {
+  for (uint32_t y = tile->y0; y < tile->y1; y++) {
+    MeshFace **frow = MATRIX_Edit(rd->fbuffer, tile->x0, y);
+    color *crow = MATRIX_Edit(rd->raster, tile->x0, y);
+    const MeshFace *prev = NULL;
+    const struct RenderPlane *pl = NULL;
+    unsigned i_mesh = 0;
+    Vector n;
+    for (uint32_t x = tile->x0; x < tile->x1; x++, frow++, crow++) {
+      if (only && *frow != only[0] && *frow != only[1]) {
+        prev = NULL;
+        continue;
+      }
+      color c = params->background;
+      if (*frow) {
+        if (*frow != prev)
+          pl = facePlanes(rd, *frow, &i_mesh);
+        stepNormal(pl, *frow == prev, x, y, &n);
+        c = shadeNormal(&n, params);
+        if (*frow == rd->highlightedFace)
+          c = CL_Negate(c);
+      }
+      prev = *frow;
+      *crow = params->negate ? CL_Negate(c) : c;
+    }
+  }
+}
+
+/*
+ * Z buffer par tri au milieu :
+ *  - les faces visibles sont clippees par lots en parallele
+ *  - chaque triangle clippe est range dans les tuiles qu'il recouvre (dans
+ *    l'ordre des faces, pour garder le meme resultat a profondeur egale)
+ *  - les tuiles sont rasterisees en parallele
+ */
 extern void RD_CalcZbuffer(struct Render *rd) {
-  Mesh *mesh;
-  MeshFace *f;
-  for (size_t x = 0; x < rd->zbuffer->xmax; x++) {
-    for (size_t y = 0; y < rd->zbuffer->ymax; y++) {
-      *(double *)MATRIX_Edit(rd->zbuffer, x, y) = -1.f;
-      *(MeshFace **)MATRIX_Edit(rd->fbuffer, x, y) = NULL;
+  void *args[1] = {rd};
+  if (rd->zbufferVersion == rd->sceneVersion)
+    return;
+  clipAndBinFaces(rd);
+  TP_Run(rd->pool, rd->nbTilesX * rd->nbTilesY, jobRasterTile, args);
+  sumTileStats(rd);
+  rd->zbufferVersion = rd->sceneVersion;
+}
+
+/*
+ * Si le z buffer est a jour, seul l'ombrage est refait : sur tout l'ecran si
+ * les parametres ont change, sinon sur les pixels des faces surlignees avant
+ * et apres (cf Render.rasterVersion)
+ */
+extern void RD_RenderDeferred(struct Render *rd,
+                              const struct RenderDeferred *params) {
+  const MeshFace *faces[2] = {rd->rasterHighlight, rd->highlightedFace};
+  void *args[3] = {rd, (void *)params, NULL};
+  uint32_t nbTiles = rd->nbTilesX * rd->nbTilesY;
+  if (rd->zbufferVersion != rd->sceneVersion) {
+    clipAndBinFaces(rd);
+    TP_Run(rd->pool, nbTiles, jobDeferredTile, args);
+    sumTileStats(rd);
+    rd->zbufferVersion = rd->sceneVersion;
+  } else if (rd->rasterVersion != rd->zbufferVersion ||
+             !isDeferredEqual(&rd->rasterParams, params)) {
+    TP_Run(rd->pool, nbTiles, jobShadeTile, args);
+  } else if (faces[0] != faces[1]) {
+    args[2] = faces;
+    TP_Run(rd->pool, nbTiles, jobShadeTile, args);
+  }
+  rd->rasterVersion = rd->zbufferVersion;
+  rd->rasterParams = *params;
+  rd->rasterHighlight = rd->highlightedFace;
+}
+
+/*
+ * Tuiles couvrant le raster : listes de triangles et pyramides de profondeur
+ */
+static void allocTiles(struct Render *rd) {
+  rd->nbTilesX = (rd->raster->xmax + RD_TILE_SIZE - 1) / RD_TILE_SIZE;
+  rd->nbTilesY = (rd->raster->ymax + RD_TILE_SIZE - 1) / RD_TILE_SIZE;
+  rd->bins = malloc(sizeof(ArrayList *) * rd->nbTilesX * rd->nbTilesY);
+  assert(rd->bins);
+  for (unsigned int i = 0; i < rd->nbTilesX * rd->nbTilesY; i++)
+    rd->bins[i] = ARRLIST_Create(sizeof(struct RenderTriangle *));
+  rd->hiz = malloc(sizeof(struct RenderHiZ) * rd->nbTilesX * rd->nbTilesY);
+  assert(rd->hiz);
+}
+
+static void freeTiles(struct Render *rd) {
+  for (unsigned int i = 0; i < rd->nbTilesX * rd->nbTilesY; i++)
+    ARRLIST_Free(rd->bins[i]);
+  free(rd->bins);
+  free(rd->hiz);
+}
+
+/*
+ * Horloge monotone (s)
+ */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Rectangle ecran de la tuile itile
+ */
+static inline void calcTileRect(const struct Render *rd, uint32_t itile,
+                                RasterRect *tile) {
+  tile->x0 = (itile % rd->nbTilesX) * RD_TILE_SIZE;
+  tile->y0 = (itile / rd->nbTilesX) * RD_TILE_SIZE;
+  tile->x1 = MIN(tile->x0 + RD_TILE_SIZE, rd->zbuffer->xmax);
+  tile->y1 = MIN(tile->y0 + RD_TILE_SIZE, rd->zbuffer->ymax);
+}
+
+/*
+ * Memes parametres de rendu differe (champ par champ : la structure a du
+ * remplissage)
+ */
+static bool isDeferredEqual(const struct RenderDeferred *a,
+                            const struct RenderDeferred *b) {
+  return a->shading == b->shading && VECT_Eq(&a->lum, &b->lum) &&
+         a->lumColor.raw == b->lumColor.raw &&
+         a->background.raw == b->background.raw && a->negate == b->negate;
+}
+
+/*
+ * Rasterisation du z buffer de la tuile itile, dont le rectangle est retourne
+ */
+static void rasterTile(struct Render *rd, uint32_t itile, RasterRect *tile) {
+  calcTileRect(rd, itile, tile);
+
+  // Profondeur inversee nulle : pixel vide, infiniment loin
+  for (uint32_t y = tile->y0; y < tile->y1; y++) {
+    memset(MATRIX_Edit(rd->zbuffer, tile->x0, y), 0,
+           (tile->x1 - tile->x0) * rd->zbuffer->elemsize);
+    memset(MATRIX_Edit(rd->fbuffer, tile->x0, y), 0,
+           (tile->x1 - tile->x0) * sizeof(MeshFace *));
+  }
+
+  struct RenderHiZ *hiz = &rd->hiz[itile];
+  for (unsigned int i = 0; i < RD_HIZ_NB_BLOCKS * RD_HIZ_NB_BLOCKS; i++)
+    hiz->blockMin[i] = 0;
+  hiz->dirty = 0;
+  hiz->nbMeshsOccluded = 0;
+  hiz->nbClustersOccluded = 0;
+  hiz->nbTrianglesOccluded = 0;
+
+  // Les triangles d'un meme mesh (et d'un meme cluster) sont consecutifs dans
+  // la tuile
+  ArrayList *bin = rd->bins[itile];
+  struct RenderTriangle **tris = ARRLIST_GetData(bin);
+  const struct RenderVertices *rv = NULL;
+  const struct RenderCluster *cluster = NULL;
+  bool meshOccluded = false, clusterOccluded = false;
+  for (size_t i = 0; i < ARRLIST_GetSize(bin); i++) {
+    struct RenderTriangle *t = tris[i];
+
+    // Rejet du mesh entier par la profondeur la plus proche de sa boite
+    if (t->vertices != rv) {
+      rv = t->vertices;
+      REAL dNear = rv->depthNear > RD_NEAR ? RD_NEAR / rv->depthNear : 1;
+      meshOccluded = hizIsOccluded(rd, hiz, tile, tile, dNear);
+      hiz->nbMeshsOccluded += meshOccluded;
+    }
+    if (meshOccluded)
+      continue;
+
+    // Puis du cluster, sur la partie de son rectangle ecran dans la tuile
+    if (t->cluster != cluster) {
+      cluster = t->cluster;
+      clusterOccluded = false;
+      if (cluster) {
+        const RasterRect *r = &cluster->rect;
+        RasterRect part = {MAX(r->x0, tile->x0), MAX(r->y0, tile->y0),
+                           MIN(r->x1, tile->x1), MIN(r->y1, tile->y1)};
+        REAL dNear =
+            cluster->depthNear > RD_NEAR ? RD_NEAR / cluster->depthNear : 1;
+        clusterOccluded = part.x0 < part.x1 && part.y0 < part.y1 &&
+                          hizIsOccluded(rd, hiz, tile, &part, dNear);
+        hiz->nbClustersOccluded += clusterOccluded;
+      }
+    }
+    if (clusterOccluded)
+      continue;
+
+    // Rejet du triangle
+    REAL dmax = MAX(MAX(t->depth[0], t->depth[1]), t->depth[2]);
+    RasterRect bounds;
+    if (!triangleBounds(t, tile, &bounds))
+      continue;
+    if (hizIsOccluded(rd, hiz, tile, &bounds, dmax)) {
+      hiz->nbTrianglesOccluded++;
+      continue;
+    }
+
+    void *argsKernel[4] = {rd, t->face, hiz, tile};
+    RASTER_GenerateFillTriangle(&t->p[0], &t->p[1], &t->p[2], tile,
+                                t->depth, 1, kernelWriteZbuffer, argsKernel);
+  }
+}
+
+/*
+ * Clipping des faces visibles par lots en parallele puis rangement de chaque
+ * triangle dans les tuiles qu'il recouvre (dans l'ordre des faces, pour
+ * garder le meme resultat a profondeur egale)
+ */
+static void clipAndBinFaces(struct Render *rd) {
+  void *args[1] = {rd};
+
+  // Decoupage des meshs visibles en lots
+  rd->nbBatches = 0;
+  for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++) {
+    Mesh *mesh = rd->meshs[i_mesh];
+    if (!rd->vertices[i_mesh].visible)
+      continue;
+    Mesh *lod = MESH_GetLod(mesh);
+    uint32_t nbFaces = MESH_GetNbFace(lod);
+    uint32_t clusterEnd = 0;
+    for (uint32_t start = 0; start < nbFaces;) {
+      if (rd->nbBatches == rd->nbBatchesAlloc) {
+        rd->nbBatchesAlloc = rd->nbBatchesAlloc ? 2 * rd->nbBatchesAlloc : 16;
+        rd->batches = realloc(rd->batches, sizeof(struct RenderBatch) *
+                                               rd->nbBatchesAlloc);
+        assert(rd->batches);
+        for (unsigned int i = rd->nbBatches; i < rd->nbBatchesAlloc; i++)
+          rd->batches[i].triangles =
+              ARRLIST_Create(sizeof(struct RenderTriangle));
+      }
+      struct RenderBatch *batch = &rd->batches[rd->nbBatches++];
+      batch->mesh = mesh;
+      batch->lod = lod;
+      batch->vertices = &rd->vertices[i_mesh];
+      batch->start = start;
+      batch->end = MIN(start + RD_BATCH_SIZE, nbFaces);
+      // Avec des clusters, le lot s'arrete a la fin d'un cluster
+      batch->clusterStart = batch->clusterEnd = clusterEnd;
+      if (lod->nbClusters) {
+        do
+          batch->end = lod->clusters[clusterEnd++].end;
+        while (clusterEnd < lod->nbClusters &&
+               batch->end - start < RD_BATCH_SIZE);
+        batch->clusterEnd = clusterEnd;
+      }
+      start = batch->end;
+    }
+  }
+  TP_Run(rd->pool, rd->nbBatches, jobClipBatch, args);
+
+  // Tri des triangles par tuile
+  const RasterRect screen = {0, 0, rd->zbuffer->xmax, rd->zbuffer->ymax};
+  for (unsigned int i = 0; i < rd->nbTilesX * rd->nbTilesY; i++)
+    ARRLIST_Clear(rd->bins[i]);
+  rd->stats.nbFacesCulled = 0;
+  rd->stats.nbClustersCulled = 0;
+  for (unsigned int b = 0; b < rd->nbBatches; b++) {
+    struct RenderBatch *batch = &rd->batches[b];
+    struct RenderTriangle *tris = ARRLIST_GetData(batch->triangles);
+    rd->stats.nbFacesCulled += batch->nbFacesCulled;
+    rd->stats.nbClustersCulled += batch->nbClustersCulled;
+    for (size_t i = 0; i < ARRLIST_GetSize(batch->triangles); i++) {
+      struct RenderTriangle *t = &tris[i];
+      RasterRect b;
+      if (!triangleBounds(t, &screen, &b))
+        continue;
+      for (uint32_t ty = b.y0 / RD_TILE_SIZE; ty <= (b.y1 - 1) / RD_TILE_SIZE;
+           ty++)
+        for (uint32_t tx = b.x0 / RD_TILE_SIZE;
+             tx <= (b.x1 - 1) / RD_TILE_SIZE; tx++)
+          ARRLIST_Add(rd->bins[ty * rd->nbTilesX + tx], &t);
     }
   }
+}
+
+/*
+ * Somme des compteurs Hi-Z des tuiles
+ */
+static void sumTileStats(struct Render *rd) {
+  rd->stats.nbMeshsOccluded = 0;
+  rd->stats.nbClustersOccluded = 0;
+  rd->stats.nbTrianglesOccluded = 0;
+  for (unsigned int i = 0; i < rd->nbTilesX * rd->nbTilesY; i++) {
+    rd->stats.nbMeshsOccluded += rd->hiz[i].nbMeshsOccluded;
+    rd->stats.nbClustersOccluded += rd->hiz[i].nbClustersOccluded;
+    rd->stats.nbTrianglesOccluded += rd->hiz[i].nbTrianglesOccluded;
+  }
+}
+
+/*
+ * Raytracing d'une tuile du raster (job du pool)
+ * args : {rd}
+ */
+static void jobRaytracingTile(uint32_t itile, unsigned ithread, void **args) {
+  (void)ithread;
+  struct Render *rd = args[0];
+  struct Vector ray;
+  struct Vector hit; // Hit point
+  unsigned int nbTilesX =
+      (rd->raster->xmax + RAYTRACE_TILE_SIZE - 1) / RAYTRACE_TILE_SIZE;
+  unsigned int x0 = (itile % nbTilesX) * RAYTRACE_TILE_SIZE;
+  unsigned int y0 = (itile / nbTilesX) * RAYTRACE_TILE_SIZE;
+  unsigned int x1 = x0 + RAYTRACE_TILE_SIZE, y1 = y0 + RAYTRACE_TILE_SIZE;
+  x1 = x1 < rd->raster->xmax ? x1 : rd->raster->xmax;
+  y1 = y1 < rd->raster->ymax ? y1 : rd->raster->ymax;
+
+  if (!rd->raytracingPackets) {
+    for (unsigned int y = y0; y < y1; y++) {
+      for (unsigned int x = x0; x < x1; x++) {
+        RD_CalcRayDir(rd, x, y, &ray);
+        RASTER_DrawPixelxy(rd->raster, x, y, RD_RayTraceOnRD(rd, &ray, &hit));
+      }
+    }
+    return;
+  }
+
+  // Paquets de PACKET_SIZE pixels consecutifs d'une ligne
+  struct Vector rays[PACKET_SIZE], hits[PACKET_SIZE];
+  struct Mesh *meshs[PACKET_SIZE];
+  struct MeshFace *faces[PACKET_SIZE];
+  for (unsigned int y = y0; y < y1; y++) {
+    for (unsigned int x = x0; x < x1; x += PACKET_SIZE) {
+      unsigned nbRays = x1 - x < PACKET_SIZE ? x1 - x : PACKET_SIZE;
+      for (unsigned i = 0; i < nbRays; i++)
+        RD_CalcRayDir(rd, x + i, y, &rays[i]);
+      unsigned mask = RD_RayCastPacket(rd, rays, nbRays, hits, meshs, faces);
+      for (unsigned i = 0; i < nbRays; i++) {
+        RASTER_DrawPixelxy(rd->raster, x + i, y,
+                           mask & (1u << i) ? rayColor(rd, meshs[i], faces[i])
+                                            : CL_BLACK);
+      }
+    }
+  }
+}
+
+/*
+ * Somme des versions des meshs et de leurs niveaux : croissante, elle change
+ * des qu'un mesh est modifie ou ajoute
+ */
+static uint32_t geometryVersion(const struct Render *rd) {
+  uint32_t version = rd->nb_meshs;
   for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++) {
-    mesh = rd->meshs[i_mesh];
-    for (unsigned int i_f = 0; i_f < MESH_GetNbFace(mesh); i_f++) {
-      f = MESH_GetFace(mesh, i_f);
-      void *args[2];
-      args[0] = rd;
-      args[1] = f;
-      RD_ClipAndRasterFace(rd, f, callbackWriteZbuffer, args);
+    const Mesh *mesh = rd->meshs[i_mesh];
+    version += mesh->version;
+    for (unsigned i = 0; i < mesh->nbLods; i++)
+      version += mesh->lods[i]->version;
+  }
+  return version;
+}
+
+/*
+ * Tuile itile du raytracing (RAYTRACE_TILE_SIZE)
+ */
+static inline void calcRaytracingTileRect(const struct Render *rd,
+                                          uint32_t itile, RasterRect *tile) {
+  uint32_t nbTilesX =
+      (rd->raster->xmax + RAYTRACE_TILE_SIZE - 1) / RAYTRACE_TILE_SIZE;
+  tile->x0 = (itile % nbTilesX) * RAYTRACE_TILE_SIZE;
+  tile->y0 = (itile / nbTilesX) * RAYTRACE_TILE_SIZE;
+  tile->x1 = MIN(tile->x0 + RAYTRACE_TILE_SIZE, rd->raster->xmax);
+  tile->y1 = MIN(tile->y0 + RAYTRACE_TILE_SIZE, rd->raster->ymax);
+}
+
+/*
+ * Reprojection des rayons dans le vide de history, des points a l'infini : la
+ * direction de chaque pixel est projetee par la camera precedente et le pixel
+ * reprend le rayon qu'elle y trouve s'il n'a rien touche. Les autres pixels
+ * de historyNext sont vides, ceux de historyTarget libres. (job du pool)
+ * args : {rd}
+ */
+static void jobReprojectMissesTile(uint32_t itile, unsigned ithread,
+                                   void **args) {
+  (void)ithread;
+  struct Render *rd = args[0];
+  const REAL(*m)[4] = rd->historyViewProj;
+  const Matrix *prev = rd->history;
+  RasterRect tile;
+  calcRaytracingTileRect(rd, itile, &tile);
+  // Rayon du pixel (x, y) : cam_u x - cam_v y + cam_wp, sa projection
+  // k[i] . (x, y, 1) est lineaire
+  const Vector *dir[3] = {&rd->cam_u, &rd->cam_v, &rd->cam_wp};
+  REAL k[3][3];
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++)
+      k[i][j] = (j == 1 ? -1 : 1) * (m[i][0] * dir[j]->x +
+                                     m[i][1] * dir[j]->y + m[i][2] * dir[j]->z);
+  }
+  Vector clip, sc;
+
+  for (uint32_t y = tile.y0; y < tile.y1; y++) {
+    struct RenderHistory *row = MATRIX_Edit(rd->historyNext, tile.x0, y);
+    uint64_t *trow = MATRIX_Edit(rd->historyTarget, tile.x0, y);
+    for (uint32_t x = tile.x0; x < tile.x1; x++) {
+      struct RenderHistory *h = &row[x - tile.x0];
+      h->state = RD_HISTORY_EMPTY;
+      trow[x - tile.x0] = UINT64_MAX;
+      if (!rd->historyValid)
+        continue;
+      clip.x = k[0][0] * x + k[0][1] * y + k[0][2];
+      clip.y = k[1][0] * x + k[1][1] * y + k[1][2];
+      clip.z = k[2][0] * x + k[2][1] * y + k[2][2];
+      if (clip.z <= 0)
+        continue;
+      projectClip(rd, &clip, &sc);
+      REAL u = floor(sc.x + 0.5), v = floor(sc.y + 0.5);
+      if (u < 0 || v < 0 || u >= prev->xmax || v >= prev->ymax)
+        continue;
+      const struct RenderHistory *p =
+          (struct RenderHistory *)prev->data + (size_t)v * prev->xmax +
+          (size_t)u;
+      if (p->state != RD_HISTORY_MISS || p->age >= rd->historyMaxAge)
+        continue;
+      h->state = RD_HISTORY_MISS;
+      h->age = p->age + 1;
     }
   }
 }
 
-extern void RD_DrawRaytracing(struct Render *rd) {
-  // Raytracing
-  static struct Vector ray;
-  static struct Vector hit; // Hit point
-  for (unsigned int y = 0; y < rd->raster->ymax; y++) {
-    for (unsigned int x = 0; x < rd->raster->xmax; x++) {
-      RD_CalcRayDir(rd, x, y, &ray);
-      RASTER_DrawPixelxy(rd->raster, x, y, RD_RayTraceOnRD(rd, &ray, &hit));
+/*
+ * Reprojection des points touches de history par la camera courante (job du
+ * pool, par tuile source) : chaque point encore valide vise le pixel le plus
+ * proche de sa projection, historyTarget garde le minimum de (profondeur,
+ * indice source), le plus proche de la camera l'emporte quel que soit l'ordre
+ * des threads
+ * args : {rd}
+ */
+static void jobReprojectHitsTile(uint32_t itile, unsigned ithread,
+                                 void **args) {
+  (void)ithread;
+  struct Render *rd = args[0];
+  const REAL(*m)[4] = rd->viewProj;
+  const Matrix *prev = rd->history;
+  const Matrix *next = rd->historyNext;
+  const struct RenderHistoryHit *srcHits =
+      (struct RenderHistoryHit *)rd->historyHits->data;
+  _Atomic uint64_t *targets = (_Atomic uint64_t *)rd->historyTarget->data;
+  RasterRect tile;
+  calcRaytracingTileRect(rd, itile, &tile);
+  Vector clip, sc;
+
+  for (uint32_t y = tile.y0; y < tile.y1; y++) {
+    for (uint32_t x = tile.x0; x < tile.x1; x++) {
+      size_t i = (size_t)y * prev->xmax + x;
+      const struct RenderHistory *h = (struct RenderHistory *)prev->data + i;
+      if (h->state != RD_HISTORY_HIT || h->age >= rd->historyMaxAge ||
+          h->lod != srcHits[i].mesh->lod)
+        continue;
+      const Vector *q = &srcHits[i].hit;
+      clip.x = m[0][0] * q->x + m[0][1] * q->y + m[0][2] * q->z + m[0][3];
+      clip.y = m[1][0] * q->x + m[1][1] * q->y + m[1][2] * q->z + m[1][3];
+      clip.z = m[2][0] * q->x + m[2][1] * q->y + m[2][2] * q->z + m[2][3];
+      if (clip.z <= RD_NEAR)
+        continue;
+      projectClip(rd, &clip, &sc);
+      REAL u = floor(sc.x + 0.5), v = floor(sc.y + 0.5);
+      if (u < 0 || v < 0 || u >= next->xmax || v >= next->ymax)
+        continue;
+      // Profondeur positive : ses bits de float sont dans le meme ordre
+      union {
+        float f;
+        uint32_t u;
+      } depth = {.f = (float)clip.z};
+      uint64_t key = (uint64_t)depth.u << 32 | (uint32_t)i;
+      _Atomic uint64_t *target = &targets[(size_t)v * next->xmax + (size_t)u];
+      uint64_t cur = atomic_load_explicit(target, memory_order_relaxed);
+      while (key < cur && !atomic_compare_exchange_weak_explicit(
+                              target, &cur, key, memory_order_relaxed,
+                              memory_order_relaxed))
+        ;
+    }
+  }
+}
+
+/*
+ * Pixels de la tuile vises par un point de history (cf jobReprojectHitsTile) :
+ * ils le reprennent, sur un rayon dans le vide aussi (job du pool)
+ * args : {rd}
+ */
+static void jobResolveHitsTile(uint32_t itile, unsigned ithread,
+                               void **args) {
+  (void)ithread;
+  struct Render *rd = args[0];
+  const struct RenderHistory *src = (struct RenderHistory *)rd->history->data;
+  const struct RenderHistoryHit *srcHits =
+      (struct RenderHistoryHit *)rd->historyHits->data;
+  RasterRect tile;
+  calcRaytracingTileRect(rd, itile, &tile);
+
+  for (uint32_t y = tile.y0; y < tile.y1; y++) {
+    struct RenderHistory *row = MATRIX_Edit(rd->historyNext, tile.x0, y);
+    struct RenderHistoryHit *hrow = MATRIX_Edit(rd->historyHitsNext, tile.x0, y);
+    const uint64_t *trow = MATRIX_Edit(rd->historyTarget, tile.x0, y);
+    for (uint32_t x = 0; x < tile.x1 - tile.x0; x++) {
+      if (trow[x] == UINT64_MAX)
+        continue;
+      uint32_t i = (uint32_t)trow[x];
+      row[x] = src[i];
+      row[x].age++;
+      hrow[x] = srcHits[i];
+    }
+  }
+}
+
+/*
+ * Expiration des rayons dans le vide reprojetes a moins de
+ * RAYTRACE_MISS_MARGIN pixels d'un point touche : la geometrie qui apparait
+ * au bord d'une silhouette n'a pas d'echantillon pour les couvrir. Seuls les
+ * etats de historyNext sont lus, l'age marque l'expiration. (job du pool)
+ * args : {rd}
+ */
+static void jobExpireMissesTile(uint32_t itile, unsigned ithread,
+                                void **args) {
+  (void)ithread;
+  struct Render *rd = args[0];
+  Matrix *next = rd->historyNext;
+  const int32_t r = RAYTRACE_MISS_MARGIN;
+  RasterRect tile;
+  calcRaytracingTileRect(rd, itile, &tile);
+
+  // Rien a faire si la tuile et sa marge ne touchent rien
+  int32_t x0 = MAX((int32_t)tile.x0 - r, 0);
+  int32_t y0 = MAX((int32_t)tile.y0 - r, 0);
+  int32_t x1 = MIN((int32_t)tile.x1 + r, (int32_t)next->xmax);
+  int32_t y1 = MIN((int32_t)tile.y1 + r, (int32_t)next->ymax);
+  bool geometry = false;
+  for (int32_t v = y0; v < y1 && !geometry; v++) {
+    const struct RenderHistory *row = MATRIX_Edit(next, x0, v);
+    for (int32_t u = 0; u < x1 - x0 && !geometry; u++)
+      geometry = row[u].state == RD_HISTORY_HIT;
+  }
+  if (!geometry)
+    return;
+
+  for (int32_t y = tile.y0; y < (int32_t)tile.y1; y++) {
+    for (int32_t x = tile.x0; x < (int32_t)tile.x1; x++) {
+      struct RenderHistory *h = MATRIX_Edit(next, x, y);
+      if (h->state != RD_HISTORY_MISS)
+        continue;
+      int32_t u0 = MAX(x - r, 0), u1 = MIN(x + r + 1, (int32_t)next->xmax);
+      int32_t v1 = MIN(y + r + 1, (int32_t)next->ymax);
+      bool near = false;
+      for (int32_t v = MAX(y - r, 0); v < v1 && !near; v++) {
+        const struct RenderHistory *row = MATRIX_Edit(next, u0, v);
+        for (int32_t u = 0; u < u1 - u0 && !near; u++)
+          near = row[u].state == RD_HISTORY_HIT;
+      }
+      if (near)
+        h->age = UINT16_MAX;
     }
   }
 }
 
+/*
+ * Vrai si le rayon du pixel touche encore la face de son echantillon, dont le
+ * point est mis a jour
+ */
+static bool reuseHistory(const struct Render *rd, struct RenderHistoryHit *h,
+                         const Vector *ray) {
+  Mesh *lod = MESH_GetLod(h->mesh);
+  size_t i_face = MESH_GetFaceIndex(lod, h->face);
+  Vector p0, p1, p2;
+  return RayIntersectsTriangle(&rd->cam_pos, ray,
+                               MESH_GetFaceVertexPos(lod, i_face, 0, &p0),
+                               MESH_GetFaceVertexPos(lod, i_face, 1, &p1),
+                               MESH_GetFaceVertexPos(lod, i_face, 2, &p2),
+                               &h->hit);
+}
+
+/*
+ * Lance les rayons des nb <= PACKET_SIZE pixels, les dessine et remplit leur
+ * historique. Retourne le nombre de rayons lances.
+ */
+static unsigned traceHistoryPixels(struct Render *rd,
+                                   const RasterPos *pixels, unsigned nb) {
+  struct Vector rays[PACKET_SIZE], hits[PACKET_SIZE];
+  struct Mesh *meshs[PACKET_SIZE];
+  struct MeshFace *faces[PACKET_SIZE];
+  unsigned mask = 0;
+  for (unsigned i = 0; i < nb; i++)
+    RD_CalcRayDir(rd, pixels[i].x, pixels[i].y, &rays[i]);
+  if (rd->raytracingPackets) {
+    mask = RD_RayCastPacket(rd, rays, nb, hits, meshs, faces);
+  } else {
+    for (unsigned i = 0; i < nb; i++) {
+      if (RD_RayCastOnRD(rd, &rays[i], &hits[i], &meshs[i], &faces[i]))
+        mask |= 1u << i;
+    }
+  }
+
+  for (unsigned i = 0; i < nb; i++) {
+    uint32_t x = pixels[i].x, y = pixels[i].y;
+    struct RenderHistory *h = MATRIX_Edit(rd->historyNext, x, y);
+    // Historique neuf : ages etales pour que les pixels n'expirent pas tous a
+    // la meme image, par segments de PACKET_SIZE pixels relances ensemble
+    h->age = rd->historyValid
+                 ? 0
+                 : (x / PACKET_SIZE * 3 + y * 5) % rd->historyMaxAge;
+    if (mask & (1u << i)) {
+      struct RenderHistoryHit *hit = MATRIX_Edit(rd->historyHitsNext, x, y);
+      h->state = RD_HISTORY_HIT;
+      h->lod = meshs[i]->lod;
+      hit->hit = hits[i];
+      hit->mesh = meshs[i];
+      hit->face = faces[i];
+      RASTER_DrawPixelxy(rd->raster, x, y, rayColor(rd, meshs[i], faces[i]));
+    } else {
+      h->state = RD_HISTORY_MISS;
+      RASTER_DrawPixelxy(rd->raster, x, y, CL_BLACK);
+    }
+  }
+  return nb;
+}
+
+/*
+ * Raytracing d'une tuile avec l'historique (job du pool) : les pixels dont
+ * l'echantillon reprojete est confirme sont repris, les autres lances par
+ * paquets de PACKET_SIZE
+ * args : {rd, compteurs par thread (rayons, pixels repris, rayons d'occlusion)}
+ */
+static void jobRaytracingHistoryTile(uint32_t itile, unsigned ithread,
+                                     void **args) {
+  struct Render *rd = args[0];
+  unsigned(*counts)[3] = args[1];
+  struct Vector ray;
+  RasterRect tile;
+  calcRaytracingTileRect(rd, itile, &tile);
+
+  RasterPos pending[PACKET_SIZE];
+  unsigned nbPending = 0;
+  for (uint32_t y = tile.y0; y < tile.y1; y++) {
+    struct RenderHistory *row = MATRIX_Edit(rd->historyNext, tile.x0, y);
+    struct RenderHistoryHit *hrow = MATRIX_Edit(rd->historyHitsNext, tile.x0, y);
+    color *crow = MATRIX_Edit(rd->raster, tile.x0, y);
+    for (uint32_t x = tile.x0; x < tile.x1; x++) {
+      struct RenderHistory *h = &row[x - tile.x0];
+      if (h->state == RD_HISTORY_MISS && h->age <= rd->historyMaxAge) {
+        crow[x - tile.x0] = CL_BLACK;
+        counts[ithread][1]++;
+        continue;
+      }
+      if (h->state == RD_HISTORY_HIT) {
+        struct RenderHistoryHit *hit = &hrow[x - tile.x0];
+        RD_CalcRayDir(rd, x, y, &ray);
+        if (reuseHistory(rd, hit, &ray)) {
+          // Rien ne doit passer devant le point repris
+          REAL tmax = rayParam(&rd->cam_pos, &ray, &hit->hit) *
+                      (1 - (REAL)RD_HISTORY_OCCLUSION_EPS);
+          counts[ithread][2]++;
+          if (!isRayOccluded(rd, &ray, tmax)) {
+            crow[x - tile.x0] = rayColor(rd, hit->mesh, hit->face);
+            counts[ithread][1]++;
+            continue;
+          }
+        }
+      }
+      pending[nbPending++] = (RasterPos){x, y};
+      if (nbPending == PACKET_SIZE) {
+        counts[ithread][0] += traceHistoryPixels(rd, pending, nbPending);
+        nbPending = 0;
+      }
+    }
+  }
+  if (nbPending)
+    counts[ithread][0] += traceHistoryPixels(rd, pending, nbPending);
+}
+
+extern void RD_SetRaytracingHistory(struct Render *rd, unsigned int maxAge) {
+  assert(maxAge <= UINT16_MAX);
+  rd->historyMaxAge = maxAge;
+  rd->historyValid = false;
+  if (!maxAge && rd->history) {
+    MATRIX_Free(rd->history);
+    MATRIX_Free(rd->historyNext);
+    MATRIX_Free(rd->historyHits);
+    MATRIX_Free(rd->historyHitsNext);
+    MATRIX_Free(rd->historyTarget);
+    rd->history = rd->historyNext = NULL;
+    rd->historyHits = rd->historyHitsNext = NULL;
+    rd->historyTarget = NULL;
+  }
+}
+
+/*
+ * Raytracing par tuiles, reparties sur les threads du pool. Le niveau de
+ * detail de chaque mesh est choisi d'apres la camera courante.
+ */
+extern void RD_DrawRaytracing(struct Render *rd) {
+  rd->rasterVersion = 0;
+  rd->stats.nbFacesLoaded = 0;
+  rd->stats.nbFacesDrawn = 0;
+  for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++)
+    selectLod(rd, rd->meshs[i_mesh]);
+
+  unsigned int nbTilesX =
+      (rd->raster->xmax + RAYTRACE_TILE_SIZE - 1) / RAYTRACE_TILE_SIZE;
+  unsigned int nbTilesY =
+      (rd->raster->ymax + RAYTRACE_TILE_SIZE - 1) / RAYTRACE_TILE_SIZE;
+  if (!rd->historyMaxAge) {
+    void *args[1] = {rd};
+    TP_Run(rd->pool, nbTilesX * nbTilesY, jobRaytracingTile, args);
+    rd->stats.nbRaysTraced = rd->raster->xmax * rd->raster->ymax;
+    rd->stats.nbPixelsReprojected = rd->stats.nbOcclusionRays = 0;
+    return;
+  }
+
+  // Historique a la taille du raster, vide si un mesh a change
+  uint32_t xmax = rd->raster->xmax, ymax = rd->raster->ymax;
+  if (!rd->history) {
+    rd->history = MATRIX_Init(xmax, ymax, sizeof(struct RenderHistory), "HIST");
+    rd->historyNext =
+        MATRIX_Init(xmax, ymax, sizeof(struct RenderHistory), "HIST");
+    rd->historyHits =
+        MATRIX_Init(xmax, ymax, sizeof(struct RenderHistoryHit), "HHIT");
+    rd->historyHitsNext =
+        MATRIX_Init(xmax, ymax, sizeof(struct RenderHistoryHit), "HHIT");
+    rd->historyTarget = MATRIX_Init(xmax, ymax, sizeof(uint64_t), "HKEY");
+    rd->historyValid = false;
+  } else if (rd->history->xmax != xmax || rd->history->ymax != ymax) {
+    MATRIX_Resize(rd->history, xmax, ymax);
+    MATRIX_Resize(rd->historyNext, xmax, ymax);
+    MATRIX_Resize(rd->historyHits, xmax, ymax);
+    MATRIX_Resize(rd->historyHitsNext, xmax, ymax);
+    MATRIX_Resize(rd->historyTarget, xmax, ymax);
+    rd->historyValid = false;
+  }
+  uint32_t version = geometryVersion(rd);
+  if (version != rd->historyVersion)
+    rd->historyValid = false;
+  rd->historyVersion = version;
+  void *args[2] = {rd, NULL};
+  TP_Run(rd->pool, nbTilesX * nbTilesY, jobReprojectMissesTile, args);
+  if (rd->historyValid) {
+    TP_Run(rd->pool, nbTilesX * nbTilesY, jobReprojectHitsTile, args);
+    TP_Run(rd->pool, nbTilesX * nbTilesY, jobResolveHitsTile, args);
+    // Camera fixe : les rayons dans le vide le restent
+    if (rd->historyCamVersion != rd->camVersion)
+      TP_Run(rd->pool, nbTilesX * nbTilesY, jobExpireMissesTile, args);
+  }
+  rd->historyCamVersion = rd->camVersion;
+
+  unsigned nbThreads = TP_GetNbThreads(rd->pool);
+  unsigned(*counts)[3] = calloc(nbThreads, sizeof(*counts));
+  assert(counts);
+  args[1] = counts;
+  TP_Run(rd->pool, nbTilesX * nbTilesY, jobRaytracingHistoryTile, args);
+  rd->stats.nbRaysTraced = rd->stats.nbPixelsReprojected = 0;
+  rd->stats.nbOcclusionRays = 0;
+  for (unsigned i = 0; i < nbThreads; i++) {
+    rd->stats.nbRaysTraced += counts[i][0];
+    rd->stats.nbPixelsReprojected += counts[i][1];
+    rd->stats.nbOcclusionRays += counts[i][2];
+  }
+  free(counts);
+
+  Matrix *swap = rd->history;
+  rd->history = rd->historyNext;
+  rd->historyNext = swap;
+  swap = rd->historyHits;
+  rd->historyHits = rd->historyHitsNext;
+  rd->historyHitsNext = swap;
+  rd->historyValid = true;
+  memcpy(rd->historyViewProj, rd->viewProj, sizeof(rd->viewProj));
+}
+
 extern void RD_DrawWireframe(struct Render *rd) {
+  rd->rasterVersion = 0;
   Mesh *mesh;
-  MeshFace *f;
   // Wirefram
   for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++) {
-    mesh = rd->meshs[i_mesh];
+    if (!rd->vertices[i_mesh].visible)
+      continue;
+    mesh = MESH_GetLod(rd->meshs[i_mesh]);
+    const struct RenderVertices *rv = &rd->vertices[i_mesh];
     for (unsigned int i_f = 0; i_f < MESH_GetNbFace(mesh); i_f++) {
-      f = MESH_GetFace(mesh, i_f);
-      RASTER_DrawTriangle(rd->raster, &f->p0->screen, &f->p1->screen,
-                          &f->p2->screen, CL_ORANGE);
+      const uint32_t *v = MESH_GetFaceIndices(mesh, i_f);
+      RasterPos p0 = vertexScreen(rv, v[0]), p1 = vertexScreen(rv, v[1]),
+                p2 = vertexScreen(rv, v[2]);
+      RASTER_DrawTriangle(rd->raster, &p0, &p1, &p2, CL_ORANGE);
     }
   }
 }
 
 extern void RD_DrawVertices(struct Render *rd) {
+  rd->rasterVersion = 0;
   Mesh *mesh;
   for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++) {
-    mesh = rd->meshs[i_mesh];
+    if (!rd->vertices[i_mesh].visible)
+      continue;
+    mesh = MESH_GetLod(rd->meshs[i_mesh]);
     for (unsigned int i_v = 0; i_v < MESH_GetNbVertice(mesh); i_v++) {
-      RASTER_DrawCircle(rd->raster, &MESH_GetVertex(mesh, i_v)->screen, 5,
-                        CL_GREEN);
+      RasterPos p = vertexScreen(&rd->vertices[i_mesh], i_v);
+      RASTER_DrawCircle(rd->raster, &p, 5, CL_GREEN);
     }
   }
 }
 
 extern void RD_DrawAxis(struct Render *rd) {
+  rd->rasterVersion = 0;
   // Axes
-  RASTER_DrawLine(rd->raster, &rd->p0.screen, &rd->px.screen, CL_RED);
-  RASTER_DrawLine(rd->raster, &rd->p0.screen, &rd->py.screen, CL_GREEN);
-  RASTER_DrawLine(rd->raster, &rd->p0.screen, &rd->pz.screen, CL_BLUE);
+  RASTER_DrawLine(rd->raster, &rd->axisScreen[0], &rd->axisScreen[1], CL_RED);
+  RASTER_DrawLine(rd->raster, &rd->axisScreen[0], &rd->axisScreen[2],
+                  CL_GREEN);
+  RASTER_DrawLine(rd->raster, &rd->axisScreen[0], &rd->axisScreen[3], CL_BLUE);
 }
 
 extern void RD_DrawFill(struct Render *rd) {
+  rd->rasterVersion = 0;
   RASTER_DrawFill(rd->raster, (color)0xFF000000); // Alpha
 }
 
-int isDoubleGreater(void *a, void *b) {
-  double aa = *(double *)a;
-  double bb = *(double *)b;
-  return aa < bb;
-}
-int isDoubleLower(void *a, void *b) {
-  double aa = *(double *)a;
-  double bb = *(double *)b;
-  if (bb < 0)
-    return 0;
-  if (aa < 0)
-    return 1;
-  return bb < aa;
-}
+/*
+ * Visualisation du z buffer : du blanc (le plus proche) au noir (le plus
+ * loin) entre les profondeurs camera extremes des pixels ecrits
+ */
 extern void RD_DrawZbuffer(struct Render *rd) {
-  double maxz = *(double *)MATRIX_Max(rd->zbuffer, isDoubleGreater);
-  double minz = *(double *)MATRIX_Max(rd->zbuffer, isDoubleLower);
-  // printf("maxz : %f, minz : %f\n", maxz, minz);
-  for (size_t x = 0; x < rd->raster->xmax; x++) {
-    for (size_t y = 0; y < rd->raster->ymax; y++) {
-      double z = *(double *)MATRIX_Edit(rd->zbuffer, x, y);
-      if (z >= 0) {
-        double coef = (z - minz) / (maxz - minz);
+  rd->rasterVersion = 0;
+  REAL maxz = 0, minz = INFINITY;
+  for (uint32_t y = 0; y < rd->raster->ymax; y++) {
+    for (uint32_t x = 0; x < rd->raster->xmax; x++) {
+      REAL d = depthLoad(rd, x, y);
+      if (d > 0) {
+        REAL z = RD_NEAR / d;
+        maxz = z > maxz ? z : maxz;
+        minz = z < minz ? z : minz;
+      }
+    }
+  }
+  // Profondeur uniforme (face de front), aux arrondis pres : teinte unique
+  REAL range = maxz - minz > 1e-6 * maxz ? maxz - minz : 0;
+  for (uint32_t y = 0; y < rd->raster->ymax; y++) {
+    for (uint32_t x = 0; x < rd->raster->xmax; x++) {
+      REAL d = depthLoad(rd, x, y);
+      if (d > 0) {
+        REAL coef = range ? (RD_NEAR / d - minz) / range : 0;
         RASTER_DrawPixelxy(rd->raster, x, y, CL_Mix(CL_WHITE, CL_BLACK, coef));
       }
     }
@@ -407,45 +1968,50 @@ extern void RD_DrawZbuffer(struct Render *rd) {
 }
 
 extern void RD_DrawNormales(struct Render *rd) {
+  rd->rasterVersion = 0;
   Mesh *mesh;
-  MeshVertex b1; // b0
+  Vector b0, b1;
   for (unsigned int i_mesh = 0; i_mesh < rd->nb_meshs; i_mesh++) {
-    mesh = rd->meshs[i_mesh];
+    if (!rd->vertices[i_mesh].visible)
+      continue;
+    mesh = MESH_GetLod(rd->meshs[i_mesh]);
     for (unsigned int i = 0; i < MESH_GetNbFace(mesh); i++) {
       MeshFace *f = MESH_GetFace(mesh, i);
-      b1.world.x = f->p0->world.x + f->normal.x;
-      b1.world.y = f->p0->world.y + f->normal.y;
-      b1.world.z = f->p0->world.z + f->normal.z;
-      calcProjectionVertex3(rd, &b1);
-      RASTER_DrawLine(rd->raster, &f->p0->screen, &b1.screen, CL_BLUE);
+      uint32_t i0 = MESH_GetFaceIndices(mesh, i)[0];
+      VECT_Add(&b1, MESH_GetVertexPos(mesh, i0, &b0), &f->normal);
+      RasterPos p0 = vertexScreen(&rd->vertices[i_mesh], i0);
+      RasterPos p1 = projectWorld(rd, &b1);
+      RASTER_DrawLine(rd->raster, &p0, &p1, CL_BLUE);
     }
   }
 }
 
 extern void RD_CalcGbuffer(struct Render *rd) {
-  Vector normal;
-  Vector w;
-  for (size_t x = 0; x < rd->raster->xmax; x++) {
-    for (size_t y = 0; y < rd->raster->ymax; y++) {
-      MeshFace *f = *(MeshFace **)MATRIX_Edit(rd->fbuffer, x, y);
-      if (f != NULL) {
-        calcWbarycentre(f, x, y, &w);
-        normal.x = f->p0->normal.x * w.x + f->p1->normal.x * w.y +
-                   f->p2->normal.x * w.z;
-        normal.y = f->p0->normal.y * w.x + f->p1->normal.y * w.y +
-                   f->p2->normal.y * w.z;
-        normal.z = f->p0->normal.z * w.x + f->p1->normal.z * w.y +
-                   f->p2->normal.z * w.z;
-        VECT_Normalise(&normal);
-        ((Vector *)MATRIX_Edit(rd->gbuffer, x, y))->x = normal.x;
-        ((Vector *)MATRIX_Edit(rd->gbuffer, x, y))->y = normal.y;
-        ((Vector *)MATRIX_Edit(rd->gbuffer, x, y))->z = normal.z;
+  if (rd->gbufferVersion && rd->gbufferVersion == rd->zbufferVersion)
+    return;
+  rd->gbufferVersion = rd->zbufferVersion;
+  for (uint32_t y = 0; y < rd->raster->ymax; y++) {
+    MeshFace **frow = MATRIX_Edit(rd->fbuffer, 0, y);
+    Vector *grow = MATRIX_Edit(rd->gbuffer, 0, y);
+    const MeshFace *prev = NULL;
+    const struct RenderPlane *pl = NULL;
+    unsigned i_mesh = 0;
+    Vector n;
+    for (uint32_t x = 0; x < rd->raster->xmax; x++, frow++, grow++) {
+      if (*frow) {
+        if (*frow != prev)
+          pl = facePlanes(rd, *frow, &i_mesh);
+        stepNormal(pl, *frow == prev, x, y, &n);
+        *grow = n;
+        VECT_Normalise(grow);
       }
+      prev = *frow;
     }
   }
 }
 
 extern void RD_DrawGbuffer(struct Render *rd) {
+  rd->rasterVersion = 0;
   Vector *normal;
   for (size_t x = 0; x < rd->raster->xmax; x++) {
     for (size_t y = 0; y < rd->raster->ymax; y++) {
@@ -463,6 +2029,7 @@ extern void RD_DrawGbuffer(struct Render *rd) {
 
 extern void RD_DrawFbufferWithLum(struct Render *rd, struct Vector *lv,
                                   color lc) {
+  rd->rasterVersion = 0;
   for (size_t x = 0; x < rd->raster->xmax; x++) {
     for (size_t y = 0; y < rd->raster->ymax; y++) {
       MeshFace *f = *(MeshFace **)MATRIX_Edit(rd->fbuffer, x, y);
@@ -479,164 +2046,73 @@ extern void RD_DrawFbufferWithLum(struct Render *rd, struct Vector *lv,
  * Internal function
  ******************************************************************************/
 
-// https://en.wikipedia.org/wiki/Line%E2%80%93plane_intersection
-static int computePlaneSegmentIntersection(const Vector segment[2],
-                                           const Vector **facePoints,
-                                           Vector *intersection) {
-  const Vector *a = &segment[0], *b = &segment[1];
-  Vector ab;
-  VECT_Sub(&ab, b, a);
-
-  const Vector *p0 = facePoints[0], *p1 = facePoints[1], *p2 = facePoints[2];
-  Vector p01, p02;
-  VECT_Sub(&p01, p1, p0);
-  VECT_Sub(&p02, p2, p0);
-
-  Vector num1, num2, denom1, denom2;
-  VECT_CrossProduct(&num1, &p01, &p02);
-  VECT_Sub(&num2, a, p0);
-  double numerateur = VECT_DotProduct(&num1, &num2);
-
-  VECT_MultSca(&denom1, &ab, -1);
-  VECT_CrossProduct(&denom2, &p01, &p02);
-  double denominateur = VECT_DotProduct(&denom1, &denom2);
-
-  // Si parallele : denominateur == 0
-  if (fabs(denominateur) < 0.00001)
-    return 0;
-
-  double t = numerateur / denominateur;
-
-  // Si 0 <= t <= 1, on est sur le segment
-  if (t <= 0 || t >= 1)
-    return 0;
-
-  VECT_MultSca(&ab, &ab, t);
-  VECT_Add(intersection, a, &ab);
-  return 1;
-}
-
-static void callbackDrawXY(uint32_t x, uint32_t y, void **args) {
-  Matrix *s = args[0];
-  color c = *(color *)args[1];
-  RASTER_DrawPixelxy(s, x, y, c);
-}
-
 extern void RD_RenderRaster(struct Render *rd) {
+  rd->rasterVersion = 0;
+  rd->stats.nbFacesCulled = 0;
   for (unsigned i = 0; i < rd->nb_meshs; i++) {
-    struct Mesh *mesh = rd->meshs[i];
+    if (!rd->vertices[i].visible)
+      continue;
+    struct Mesh *mesh = MESH_GetLod(rd->meshs[i]);
     for (unsigned j = 0; j < MESH_GetNbFace(mesh); j++) {
+      if (isFaceCulled(rd, mesh, j)) {
+        rd->stats.nbFacesCulled++;
+        continue;
+      }
       void *args[2] = {rd->raster, &MESH_GetFace(mesh, j)->color};
-      RD_ClipAndRasterFace(rd, MESH_GetFace(mesh, j), callbackDrawXY, args);
+      RD_ClipAndRasterFace(rd, &rd->vertices[i], MESH_GetFaceIndices(mesh, j),
+                           RASTER_SpanFill, args);
     }
   }
 }
 
-// TODO: opti : remplacer les allocations dynamiques par des tableaux
-// statiques avec comme taille le nombre maximum de sommets possibles (7 ?)
-// https://en.wikipedia.org/wiki/Sutherland%E2%80%93Hodgman_algorithm
-static void RD_ClipAndRasterFace(struct Render *rd, const MeshFace *face,
-                                 void (*callback)(uint32_t, uint32_t, void **),
-                                 void **args) {
-  /* Pseudo code
-   *
-   * for (cube_face in projection_cube) {
-   *    newFace = Face.empty();
-   *    prev_point = face.last_point;
-   *    for (current_point in face) {
-   *        intersection =
-   *            Intersection_Segment_Face((prev_point, current_point),
-   *                                    cube_face);
-
-   *        if (current_point inside cube_face)
-   *            newFace.add(current_point);
-   *        if (intersection)
-   *            newFace.add(intersection);
-   *        prev_point = current;
-   *    }
-   *    face = newFace;
-   * }
-   */
-  static const double NEAR = 0.01, FAR = 100000;
-  // Sommets du projectionCube face avant, face arriere, on commence en haut a
-  // gauche, sens trigo
-  static Vector projectionCubeVertices[8] = {
-      {0, 0, NEAR}, {0, 1, NEAR}, {1, 1, NEAR}, {1, 0, NEAR},
-      {0, 0, FAR},  {0, 1, FAR},  {1, 1, FAR},  {1, 0, FAR}};
-
-  for (unsigned i = 0; i < 8; i += 4) {
-    projectionCubeVertices[i + 1].y = rd->raster->ymax - 1;
-
-    projectionCubeVertices[i + 2].x = rd->raster->xmax - 1;
-    projectionCubeVertices[i + 2].y = rd->raster->ymax - 1;
-
-    projectionCubeVertices[i + 3].x = rd->raster->xmax - 1;
-  }
-
-  // projectionCube de projection (seuls les 3 premiers sommets sont utilises
-  // mais pour etre plus clair on met tout, ca coute rien)
-  static const Vector *projectionCube[6][4] = {
-      {projectionCubeVertices, projectionCubeVertices + 1,
-       projectionCubeVertices + 2, projectionCubeVertices + 3}, // Face devant
-      {projectionCubeVertices + 3, projectionCubeVertices + 2,
-       projectionCubeVertices + 6, projectionCubeVertices + 7}, // Face droite
-      {projectionCubeVertices + 7, projectionCubeVertices + 4,
-       projectionCubeVertices + 5, projectionCubeVertices + 6}, // Face arriere
-      {projectionCubeVertices + 4, projectionCubeVertices + 5,
-       projectionCubeVertices + 1, projectionCubeVertices}, // Face gauche
-      {projectionCubeVertices + 4, projectionCubeVertices,
-       projectionCubeVertices + 3, projectionCubeVertices + 7}, // Face dessus
-      {projectionCubeVertices + 5, projectionCubeVertices + 1,
-       projectionCubeVertices + 2, projectionCubeVertices + 6} // Face dessous
-  };
-  static const Vector vecteursNormaux[6] = {{0, 0, -1}, {1, 0, 0},  {0, 0, 1},
-                                            {-1, 0, 0}, {0, -1, 0}, {0, 1, 0}};
-
-  static Vector facePointsBuff[MAX_VERTICES_AFTER_CLIP];
-  Vector *facePoints = facePointsBuff;
-  unsigned facePointsNb = 3;
-  facePoints[0] = face->p0->sc;
-  facePoints[1] = face->p1->sc;
-  facePoints[2] = face->p2->sc;
-
-  static Vector newFacePointsBuff[MAX_VERTICES_AFTER_CLIP];
-  Vector *newFacePoints = newFacePointsBuff;
-  unsigned newFacePointsNb = 0;
-
-  for (unsigned cf = 0; cf < 6; cf++) {
-    newFacePointsNb = 0;
-
-    for (unsigned p = 0; p < facePointsNb; p++) {
-      Vector *currentPoint = &facePoints[p];
-      Vector *prevPoint = &facePoints[(p + facePointsNb - 1) % facePointsNb];
-
-      Vector segment[2] = {*prevPoint, *currentPoint};
-      Vector intersection;
-
-      int hasIntersection = computePlaneSegmentIntersection(
-          segment, projectionCube[cf], &intersection);
-
-      Vector vectPrev;
-      VECT_Sub(&vectPrev, prevPoint, projectionCube[cf][0]);
-
-      if (VECT_DotProduct(&vecteursNormaux[cf], &vectPrev) <= 0) {
-        newFacePoints[newFacePointsNb++] = *prevPoint;
-      }
-      if (hasIntersection) {
-        newFacePoints[newFacePointsNb++] = intersection;
-      }
-    }
-
-    void *tmp = facePoints;
-    facePoints = newFacePoints;
-    newFacePoints = tmp;
-
-    facePointsNb = newFacePointsNb;
-    newFacePointsNb = 0;
+/*
+ * Clipping par codes de sortie (calcules par transformVertices) :
+ *  - face entierement hors d'un plan : rejetee
+ *  - face dans la bande de garde et devant le plan proche : acceptee telle
+ *    quelle, le scissor du rasteriseur fait le reste
+ *  - sinon clipping geometrique par le plan proche en coordonnees homogenes,
+ *    avant la division, puis, si un sommet sort encore de la bande de garde,
+ *    par celle-ci (ecran)
+ * Les sommets retournes sont en coordonnees ecran (x, y, profondeur camera).
+ */
+static unsigned clipFace(const struct Render *rd,
+                         const struct RenderVertices *rv, const uint32_t v[3],
+                         Vector facePoints[MAX_VERTICES_AFTER_CLIP]) {
+  uint8_t codeAnd = rv->outcode[v[0]] & rv->outcode[v[1]] & rv->outcode[v[2]];
+  uint8_t codeOr = rv->outcode[v[0]] | rv->outcode[v[1]] | rv->outcode[v[2]];
+  // La bande de garde n'est pas un plan : elle ne permet pas de rejeter
+  if (codeAnd & ~RD_OUT_GUARD)
+    return 0;
+  if (!(codeOr & (RD_OUT_NEAR | RD_OUT_GUARD))) {
+    for (int i = 0; i < 3; i++)
+      facePoints[i] = (Vector){rv->sx[v[i]], rv->sy[v[i]], rv->w[v[i]]};
+    return 3;
+  }
 
-    if (!facePointsNb)
-      break;
+  // Buffers locaux : le clipping est appele en parallele
+  Vector points[MAX_VERTICES_AFTER_CLIP];
+  unsigned nb = 3;
+  if (codeOr & RD_OUT_NEAR) {
+    Vector clip[3];
+    for (int i = 0; i < 3; i++)
+      clip[i] = (Vector){rv->x[v[i]], rv->y[v[i]], rv->w[v[i]]};
+    nb = clipPolygonNear(clip, 3, points);
+    for (unsigned i = 0; i < nb; i++)
+      projectClip(rd, &points[i], &points[i]);
+  } else {
+    for (int i = 0; i < 3; i++)
+      points[i] = (Vector){rv->sx[v[i]], rv->sy[v[i]], rv->w[v[i]]};
   }
+  return clipPolygonGuard(rd, points, nb, facePoints);
+}
+
+static void RD_ClipAndRasterFace(struct Render *rd,
+                                 const struct RenderVertices *rv,
+                                 const uint32_t v[3], RasterSpanKernel kernel,
+                                 void **args) {
+  Vector facePoints[MAX_VERTICES_AFTER_CLIP];
+  unsigned facePointsNb = clipFace(rd, rv, v, facePoints);
+  const RasterRect screen = {0, 0, rd->raster->xmax, rd->raster->ymax};
 
   // Apres triangulation (comme on la fait ici), on aura nbSommets - 2 faces
   int nbFaces = facePointsNb - 2;
@@ -645,70 +2121,456 @@ static void RD_ClipAndRasterFace(struct Render *rd, const MeshFace *face,
     return;
 
   // On triangule la face puis on rasterise 'on the fly' comme Pierre aime a
-  // le dire
+  // le dire. La profondeur inversee est interpolee le long des segments.
   for (int i = 0; i < nbFaces; i++) {
     Vector *p0 = &facePoints[0];
     Vector *p1 = &facePoints[i + 1];
     Vector *p2 = &facePoints[i + 2];
-    RasterPos a = {p0->x, p0->y}, b = {p1->x, p1->y}, c = {p2->x, p2->y};
-    RASTER_GenerateFillTriangle(&a, &b, &c, callback, args);
+    RasterPos a = rasterPos(p0), b = rasterPos(p1), c = rasterPos(p2);
+    REAL depth[3] = {RD_NEAR / p0->z, RD_NEAR / p1->z, RD_NEAR / p2->z};
+    RASTER_GenerateFillTriangle(&a, &b, &c, &screen, depth, 1, kernel, args);
+  }
+}
+
+/*
+ * Face de dos : la camera est derriere le plan de la face
+ */
+static inline bool isFaceCulled(const struct Render *rd, const Mesh *mesh,
+                                size_t i_face) {
+  Vector p, v;
+  if (!mesh->backfaceCulling)
+    return false;
+  VECT_Sub(&v, MESH_GetFaceVertexPos(mesh, i_face, 0, &p), &rd->cam_pos);
+  // Une normale nulle (pas encore calculee) n'est jamais de dos
+  return VECT_DotProduct(&MESH_GetFace(mesh, i_face)->normal, &v) > 0;
+}
+
+/*
+ * Plans de normale de la face f, cherches parmi les niveaux transformes en
+ * commencant par le mesh i_mesh (celui de la face precedente)
+ */
+static const struct RenderPlane *facePlanes(const struct Render *rd,
+                                            const MeshFace *f,
+                                            unsigned *i_mesh) {
+  for (unsigned k = 0; k < rd->nb_meshs; k++) {
+    unsigned i = (*i_mesh + k) % rd->nb_meshs;
+    const struct RenderVertices *rv = &rd->vertices[i];
+    if (!rv->mesh || !MESH_GetNbFace(rv->mesh))
+      continue;
+    const MeshFace *first = MESH_GetFace(rv->mesh, 0);
+    if (f >= first && f < first + MESH_GetNbFace(rv->mesh)) {
+      *i_mesh = i;
+      return rv->planes[f - first];
+    }
+  }
+  assert(false);
+  return NULL;
+}
+
+/*
+ * Normale (non normee) du pixel (x, y) d'une face de plans pl, interpolee en
+ * perspective : evaluee au premier pixel d'une suite de la meme face puis
+ * incrementee d'un pas en x (next). Seule la direction compte, la division
+ * par 1 / z est inutile.
+ */
+static inline void stepNormal(const struct RenderPlane *pl, bool next,
+                              uint32_t x, uint32_t y, Vector *n) {
+  if (next) {
+    n->x += pl[0].a;
+    n->y += pl[1].a;
+    n->z += pl[2].a;
+    return;
   }
+  n->x = pl[0].a * x + pl[0].b * y + pl[0].c;
+  n->y = pl[1].a * x + pl[1].b * y + pl[1].c;
+  n->z = pl[2].a * x + pl[2].b * y + pl[2].c;
+}
+
+/*
+ * Couleur d'un pixel de normale n (cf RD_DrawGbuffer, RD_DrawFbufferWithLum)
+ */
+static inline color shadeNormal(const Vector *n,
+                                const struct RenderDeferred *params) {
+  Vector normal = *n;
+  VECT_Normalise(&normal);
+
+  switch (params->shading) {
+  case RD_SHADING_NORMALS:
+    return CL_rgb(abs((int)(normal.x * 255)), abs((int)(normal.y * 255)),
+                  abs((int)(normal.z * 255)));
+  case RD_SHADING_LUM: {
+    double k = VECT_DotProduct(&params->lum, &normal);
+    k = k < 0 ? 0 : k;
+    const color *lc = &params->lumColor;
+    return CL_rgb(k * lc->rgb.r, k * lc->rgb.g, k * lc->rgb.b);
+  }
+  }
+  return params->background;
+}
+
+static inline REAL depthClamp(REAL d) { return d < 0 ? 0 : d > 1 ? 1 : d; }
+
+/*
+ * Profondeur inversee du pixel (x, y) du z buffer, 0 si vide
+ */
+static inline REAL depthLoad(const struct Render *rd, uint32_t x,
+                               uint32_t y) {
+  const void *z = MATRIX_Edit(rd->zbuffer, x, y);
+  switch (rd->depthFormat) {
+  case RD_DEPTH_FLOAT:
+    return *(const float *)z;
+  case RD_DEPTH_UNORM24:
+    return *(const uint32_t *)z / (REAL)RD_DEPTH_UNORM24_MAX;
+  case RD_DEPTH_UNORM16:
+    return *(const uint16_t *)z / (REAL)RD_DEPTH_UNORM16_MAX;
+  }
+  return 0;
+}
+
+/*
+ * Profondeur camera (cam.z) du coin de la boite le plus proche : celui le plus
+ * loin dans la direction w
+ */
+static REAL boxDepthNear(const struct Render *rd, const Box3 *b) {
+  const Vector *w = &rd->cam_w;
+  Vector p = {w->x >= 0 ? b->max.x : b->min.x, w->y >= 0 ? b->max.y : b->min.y,
+              w->z >= 0 ? b->max.z : b->min.z};
+  return -VECT_DotProduct(w, &p) + rd->tz;
+}
+
+/*
+ * Choisit le niveau de detail du mesh (cf Mesh.lod) : le plus fin dont le
+ * nombre de faces tient dans l'aire ecran de sa boite, a raison de
+ * RD_LOD_PIXELS_PER_FACE pixels par face. La boite est vue comme une sphere
+ * dont le diametre apparent est pris a sa distance la plus proche.
+ * Retourne le niveau et compte ses faces dans les statistiques.
+ */
+static Mesh *selectLod(struct Render *rd, Mesh *mesh) {
+  mesh->lod = 0;
+  if (mesh->nbLods && mesh->box.cpt) {
+    REAL radius = VECT_Distance(&mesh->box.min, &mesh->box.max) / 2;
+    REAL dist = VECT_Distance(&mesh->box.center, &rd->cam_pos) - radius;
+    if (dist > RD_NEAR) {
+      REAL size = radius * rd->s * rd->raster->ymax / dist;
+      REAL budget = size * size / RD_LOD_PIXELS_PER_FACE;
+      while (mesh->lod < mesh->nbLods &&
+             MESH_GetNbFace(MESH_GetLod(mesh)) > budget)
+        mesh->lod++;
+    }
+  }
+  Mesh *lod = MESH_GetLod(mesh);
+  rd->stats.nbFacesLoaded += MESH_GetNbFace(mesh);
+  rd->stats.nbFacesDrawn += MESH_GetNbFace(lod);
+  return lod;
+}
+
+/*
+ * Vrai si le cluster est hors du frustum ou entierement de dos (cf
+ * MeshCluster.coneCutoff). Sinon sa profondeur la plus proche et son
+ * rectangle ecran sont calcules dans rc pour le rejet par Hi-Z : les coins de
+ * sa boite projetes, ou tout l'ecran si elle coupe le plan proche.
+ */
+static bool isClusterCulled(const struct Render *rd, const Mesh *mesh,
+                            const MeshCluster *cluster,
+                            struct RenderCluster *rc) {
+  if (!isBoxInFrustum(rd, &cluster->box))
+    return true;
+  if (mesh->backfaceCulling) {
+    Vector d;
+    VECT_Sub(&d, &cluster->center, &rd->cam_pos);
+    if (VECT_DotProduct(&d, &cluster->coneAxis) >=
+        cluster->coneCutoff * sqrt(VECT_NormSquare(&d)) + cluster->radius)
+      return true;
+  }
+
+  rc->depthNear = boxDepthNear(rd, &cluster->box);
+  RasterRect *r = &rc->rect;
+  if (rc->depthNear <= RD_NEAR) {
+    *r = (RasterRect){0, 0, rd->zbuffer->xmax, rd->zbuffer->ymax};
+    return false;
+  }
+  const Vector *b[2] = {&cluster->box.min, &cluster->box.max};
+  int32_t x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+  for (int k = 0; k < 8; k++) {
+    Vector corner = {b[k & 1]->x, b[(k >> 1) & 1]->y, b[k >> 2]->z};
+    RasterPos p = projectWorld(rd, &corner);
+    x0 = MIN(x0, (int32_t)p.x);
+    y0 = MIN(y0, (int32_t)p.y);
+    x1 = MAX(x1, (int32_t)p.x);
+    y1 = MAX(y1, (int32_t)p.y);
+  }
+  // Sommets arrondis au pixel : une marge d'un pixel
+  r->x0 = MAX(x0 - 1, 0);
+  r->y0 = MAX(y0 - 1, 0);
+  r->x1 = MAX(MIN(x1 + 2, (int32_t)rd->zbuffer->xmax), 0);
+  r->y1 = MAX(MIN(y1 + 2, (int32_t)rd->zbuffer->ymax), 0);
+  return false;
+}
+
+/*
+ * Normales des faces puis des sommets d'un mesh, par blocs sur l'adjacence
+ */
+static void calcMeshNormales(struct Render *rd, Mesh *mesh) {
+  mesh->version++;
+  for (unsigned int i = 0; i < MESH_GetNbFace(mesh); i++)
+    MESH_FACE_CalcNormaleFace(mesh, i);
+  MESH_CalcAdjacency(mesh);
+  uint32_t nbBlocks = (MESH_GetNbVertice(mesh) + RD_NORMALS_BLOCK_SIZE - 1) /
+                      RD_NORMALS_BLOCK_SIZE;
+  void *args[1] = {mesh};
+  TP_Run(rd->pool, nbBlocks, jobVerticesNormales, args);
+}
+
+/*
+ * Test conservatif : faux seulement si la boite est entierement derriere un
+ * des plans du frustum
+ */
+static bool isBoxInFrustum(const struct Render *rd, const Box3 *b) {
+  for (int i = 0; i < RD_FRUSTUM_NB_PLANES; i++) {
+    if (BOX3_IsBehindPlane(b, &rd->frustum_n[i], rd->frustum_d[i]))
+      return false;
+  }
+  return true;
 }
 
 /*
  * 3D projection
  * http://www.cse.psu.edu/~rtc12/CSE486/lecture12.pdf
  */
-static void calcProjectionVertex3(struct Render *rd, struct MeshVertex *p) {
-  static double nnpx, nnpy;
-  // World to camera
-  p->cam.x = VECT_DotProduct(&rd->cam_u, &p->world) + rd->tx;
-  p->cam.y = VECT_DotProduct(&rd->cam_v, &p->world) + rd->ty;
-  p->cam.z = -VECT_DotProduct(&rd->cam_w, &p->world) + rd->tz;
-  // Projection
-  nnpx = (rd->s * p->cam.x) / p->cam.z;
-  nnpy = (rd->s * p->cam.y) / p->cam.z;
-  // Rendu
-  p->sc.x = ((nnpx * rd->scalex + 1) * 0.5 * rd->raster->xmax);
-  p->sc.y = ((1 - (nnpy * rd->scaley + 1) * 0.5) * rd->raster->ymax);
-  p->sc.z = p->cam.z;
-  //
-  p->screen.x = (int32_t)p->sc.x;
-  p->screen.y = (int32_t)p->sc.y;
-  // printf("ps :[%d, %d]\n", ps.x, ps.y);
-}
-
-static void calcCacheBarycentreFace(struct MeshFace *f) {
-  // Barycentre
-  double denum = (f->p1->sc.y - f->p2->sc.y) * (f->p0->sc.x - f->p2->sc.x) +
-                 (f->p2->sc.x - f->p1->sc.x) * (f->p0->sc.y - f->p2->sc.y);
-  if (denum == 0) { // Face invisible car dans le mauvais plan
-                    // ATTENTION! CHangement comportement !!!
-    f->wp1 = 0;
-    f->wp2 = 0;
-    f->wp3 = 0;
-    f->wp4 = 0;
+/*
+ * Projection d'un point isole (reperes, normales), les sommets des meshs
+ * passent par transformVertices
+ */
+static RasterPos projectWorld(const struct Render *rd, const Vector *q) {
+  const REAL(*m)[4] = rd->viewProj;
+  Vector clip, sc;
+  clip.x = m[0][0] * q->x + m[0][1] * q->y + m[0][2] * q->z + m[0][3];
+  clip.y = m[1][0] * q->x + m[1][1] * q->y + m[1][2] * q->z + m[1][3];
+  clip.z = m[2][0] * q->x + m[2][1] * q->y + m[2][2] * q->z + m[2][3];
+  projectClip(rd, &clip, &sc);
+  return (RasterPos){(int32_t)sc.x, (int32_t)sc.y};
+}
+
+/*
+ * Transformation des sommets d'un mesh, RD_LANE_SIZE a la fois depuis ses
+ * positions SoA : clipping homogene, ecran et codes de sortie (valables aussi
+ * derriere la camera, -w <= x, y <= w a l'ecran)
+ */
+static void transformVertices(const struct Render *rd, const Mesh *mesh,
+                              struct RenderVertices *rv) {
+  size_t n = MESH_GetNbVertice(mesh);
+  reserveVertices(rv, n);
+  reserveFaces(rv, mesh);
+  const REAL(*m)[4] = rd->viewProj;
+  const REAL hx = 0.5 * rd->raster->xmax, hy = 0.5 * rd->raster->ymax;
+  const REAL gx = 1 + 2. * RD_GUARD_BAND / rd->raster->xmax;
+  const REAL gy = 1 + 2. * RD_GUARD_BAND / rd->raster->ymax;
+
+  // Les flux etant completes a MESH_SOA_WIDTH, le dernier bloc est entier
+  for (size_t i = 0; i < n; i += RD_LANE_SIZE) {
+    RenderLane px, py, pz;
+    memcpy(&px, &mesh->posX[i], sizeof(RenderLane));
+    memcpy(&py, &mesh->posY[i], sizeof(RenderLane));
+    memcpy(&pz, &mesh->posZ[i], sizeof(RenderLane));
+    RenderLane x = m[0][0] * px + m[0][1] * py + m[0][2] * pz + m[0][3];
+    RenderLane y = m[1][0] * px + m[1][1] * py + m[1][2] * pz + m[1][3];
+    RenderLane w = m[2][0] * px + m[2][1] * py + m[2][2] * pz + m[2][3];
+    RenderLane iw = 1 / w;
+    RenderLane sx = (x * iw + 1) * hx;
+    RenderLane sy = (1 - y * iw) * hy;
+    RenderMask code = ((x < -w) & RD_OUT_LEFT) | ((x > w) & RD_OUT_RIGHT) |
+                      ((y > w) & RD_OUT_TOP) | ((y < -w) & RD_OUT_BOTTOM) |
+                      ((w < (REAL)RD_NEAR) & RD_OUT_NEAR) |
+                      (((x > gx * w) | (x < -gx * w) | (y > gy * w) |
+                        (y < -gy * w)) &
+                       RD_OUT_GUARD);
+    memcpy(&rv->x[i], &x, sizeof(RenderLane));
+    memcpy(&rv->y[i], &y, sizeof(RenderLane));
+    memcpy(&rv->w[i], &w, sizeof(RenderLane));
+    memcpy(&rv->sx[i], &sx, sizeof(RenderLane));
+    memcpy(&rv->sy[i], &sy, sizeof(RenderLane));
+    for (unsigned k = 0; k < RD_LANE_SIZE; k++)
+      rv->outcode[i + k] = code[k];
+  }
+}
+
+/*
+ * Agrandit les flux pour n sommets (arrondi a MESH_SOA_WIDTH)
+ */
+static void reserveVertices(struct RenderVertices *rv, size_t n) {
+  n = (n + MESH_SOA_WIDTH - 1) / MESH_SOA_WIDTH * MESH_SOA_WIDTH;
+  if (n <= rv->alloc)
     return;
+  REAL **streams[5] = {&rv->x, &rv->y, &rv->w, &rv->sx, &rv->sy};
+  for (int k = 0; k < 5; k++) {
+    *streams[k] = realloc(*streams[k], n * sizeof(REAL));
+    assert(*streams[k]);
   }
-  f->wp1 = (f->p1->sc.y - f->p2->sc.y) / denum;
-  f->wp3 = (f->p2->sc.y - f->p0->sc.y) / denum;
-  f->wp2 = (f->p2->sc.x - f->p1->sc.x) / denum;
-  f->wp4 = (f->p0->sc.x - f->p2->sc.x) / denum;
+  rv->outcode = realloc(rv->outcode, n);
+  assert(rv->outcode);
+  rv->alloc = n;
 }
 
-// Retourne les 3 coefficients du point par rapport au triangle
-static void calcWbarycentre(struct MeshFace *f, uint32_t x, uint32_t y,
-                            Vector *outW) {
-  outW->x = f->wp1 * (x - f->p2->sc.x) + f->wp2 * (y - f->p2->sc.y);
-  outW->y = f->wp3 * (x - f->p2->sc.x) + f->wp4 * (y - f->p2->sc.y);
-  outW->z = 1 - outW->x - outW->y;
+/*
+ * Agrandit les flux des plans et des clusters pour les faces et les clusters
+ * du mesh
+ */
+static void reserveFaces(struct RenderVertices *rv, const Mesh *mesh) {
+  size_t n = MESH_GetNbFace(mesh);
+  if (n > rv->planesAlloc) {
+    rv->planes = realloc(rv->planes, n * sizeof(*rv->planes));
+    assert(rv->planes);
+    rv->planesAlloc = n;
+  }
+  if (mesh->nbClusters > rv->clustersAlloc) {
+    rv->clusters =
+        realloc(rv->clusters, mesh->nbClusters * sizeof(*rv->clusters));
+    assert(rv->clusters);
+    rv->clustersAlloc = mesh->nbClusters;
+  }
+}
 
-  outW->x = outW->x > 0 ? outW->x : 0;
-  outW->y = outW->y > 0 ? outW->y : 0;
-  outW->z = outW->z > 0 ? outW->z : 0;
+/*
+ * Pixel (tronque) d'un sommet transforme, pour les dessins de debug
+ */
+static inline RasterPos vertexScreen(const struct RenderVertices *rv,
+                                     uint32_t index) {
+  return (RasterPos){(int32_t)rv->sx[index], (int32_t)rv->sy[index]};
+}
+
+/*
+ * Division perspective d'un point homogene (x, y, w) vers l'ecran
+ * (sc.z = w, la profondeur camera)
+ */
+static inline void projectClip(const struct Render *rd, const Vector *clip,
+                               Vector *sc) {
+  REAL iw = 1 / clip->z;
+  REAL x = clip->x * iw, y = clip->y * iw;
+  sc->z = clip->z; // clip et sc peuvent etre le meme vecteur
+  sc->x = (x + 1) * 0.5 * rd->raster->xmax;
+  sc->y = (1 - y) * 0.5 * rd->raster->ymax;
+}
 
-  double sum = (outW->x + outW->y + outW->z);
-  outW->x /= sum;
-  outW->y /= sum;
-  outW->z /= sum;
+/*
+ * Pixel d'un sommet ecran, negatif dans la bande de garde (le rasteriseur
+ * lit les coordonnees en signe)
+ */
+static inline RasterPos rasterPos(const Vector *sc) {
+  return (RasterPos){(uint32_t)(int32_t)floor(sc->x),
+                     (uint32_t)(int32_t)floor(sc->y)};
+}
+
+/*
+ * Boite englobante du triangle dans le rectangle clip, faux si vide
+ */
+static inline bool triangleBounds(const struct RenderTriangle *t,
+                                  const RasterRect *clip, RasterRect *out) {
+  int32_t x[3] = {t->p[0].x, t->p[1].x, t->p[2].x};
+  int32_t y[3] = {t->p[0].y, t->p[1].y, t->p[2].y};
+  int32_t x0 = MAX(MIN(MIN(x[0], x[1]), x[2]), (int32_t)clip->x0);
+  int32_t y0 = MAX(MIN(MIN(y[0], y[1]), y[2]), (int32_t)clip->y0);
+  int32_t x1 = MIN(MAX(MAX(x[0], x[1]), x[2]) + 1, (int32_t)clip->x1);
+  int32_t y1 = MIN(MAX(MAX(y[0], y[1]), y[2]) + 1, (int32_t)clip->y1);
+  if (x0 >= x1 || y0 >= y1)
+    return false;
+  *out = (RasterRect){x0, y0, x1, y1};
+  return true;
+}
+
+/*
+ * Clipping d'un polygone homogene (x, y, w) par le plan proche w = RD_NEAR
+ * https://en.wikipedia.org/wiki/Sutherland%E2%80%93Hodgman_algorithm
+ */
+static unsigned clipPolygonNear(const Vector *in, unsigned nb, Vector *out) {
+  unsigned nbOut = 0;
+  for (unsigned i = 0; i < nb; i++) {
+    const Vector *a = &in[(i + nb - 1) % nb], *b = &in[i];
+    bool aIn = a->z >= RD_NEAR, bIn = b->z >= RD_NEAR;
+    if (aIn != bIn) {
+      REAL t = (RD_NEAR - a->z) / (b->z - a->z);
+      assert(nbOut < MAX_VERTICES_AFTER_CLIP);
+      out[nbOut++] = (Vector){a->x + t * (b->x - a->x),
+                              a->y + t * (b->y - a->y), RD_NEAR};
+    }
+    if (bIn) {
+      assert(nbOut < MAX_VERTICES_AFTER_CLIP);
+      out[nbOut++] = *b;
+    }
+  }
+  return nbOut;
+}
+
+/*
+ * Clipping d'un polygone ecran par les 4 bords de la bande de garde. 1 / z
+ * etant affine a l'ecran, c'est lui qui est interpole.
+ */
+static unsigned clipPolygonGuard(const struct Render *rd, const Vector *in,
+                                 unsigned nb, Vector *out) {
+  const REAL bounds[4] = {-RD_GUARD_BAND, rd->raster->xmax + RD_GUARD_BAND,
+                            -RD_GUARD_BAND, rd->raster->ymax + RD_GUARD_BAND};
+  // Les bords 0 et 2 gardent x, y >= borne, 1 et 3 x, y <= borne. Les
+  // polygones passent de in a buff puis alternent entre out et buff.
+  Vector buff[MAX_VERTICES_AFTER_CLIP];
+  const Vector *src = in;
+  for (int edge = 0; edge < 4; edge++) {
+    REAL sign = edge % 2 ? -1 : 1;
+    Vector *dst = edge % 2 ? out : buff;
+    unsigned nbOut = 0;
+    for (unsigned i = 0; i < nb; i++) {
+      const Vector *a = &src[(i + nb - 1) % nb], *b = &src[i];
+      REAL da = sign * ((edge < 2 ? a->x : a->y) - bounds[edge]);
+      REAL db = sign * ((edge < 2 ? b->x : b->y) - bounds[edge]);
+      if ((da >= 0) != (db >= 0)) {
+        REAL t = da / (da - db);
+        REAL iz = 1 / a->z + t * (1 / b->z - 1 / a->z);
+        assert(nbOut < MAX_VERTICES_AFTER_CLIP);
+        dst[nbOut++] = (Vector){a->x + t * (b->x - a->x),
+                                a->y + t * (b->y - a->y), 1 / iz};
+      }
+      if (db >= 0) {
+        assert(nbOut < MAX_VERTICES_AFTER_CLIP);
+        dst[nbOut++] = *b;
+      }
+    }
+    src = dst;
+    nb = nbOut;
+  }
+  return nb;
+}
+
+/*
+ * Plans ecran des attributs divises par z : contrairement aux attributs, ils
+ * sont affines a l'ecran (interpolation perspective). Les sommets derriere la
+ * camera restent valides, leur projection garde la relation homogene.
+ */
+static void calcCacheFacePlanes(struct RenderVertices *rv, const Mesh *mesh,
+                                size_t i_face) {
+  struct RenderPlane *planes = rv->planes[i_face];
+  const uint32_t *v = MESH_GetFaceIndices(mesh, i_face);
+  const MeshVertex *p[3] = {MESH_GetVertex(mesh, v[0]),
+                            MESH_GetVertex(mesh, v[1]),
+                            MESH_GetVertex(mesh, v[2])};
+  REAL x0 = rv->sx[v[0]], y0 = rv->sy[v[0]];
+  REAL x1 = rv->sx[v[1]] - x0, y1 = rv->sy[v[1]] - y0;
+  REAL x2 = rv->sx[v[2]] - x0, y2 = rv->sy[v[2]] - y0;
+  REAL det = x1 * y2 - x2 * y1;
+  if (det == 0 || !isfinite(det)) { // Face vue par la tranche
+    memset(planes, 0, sizeof(rv->planes[i_face]));
+    return;
+  }
+
+  REAL q[3][3]; // q[k][i] : composante k de normale / z du sommet i
+  for (int i = 0; i < 3; i++) {
+    REAL invz = 1 / rv->w[v[i]];
+    q[0][i] = p[i]->normal.x * invz;
+    q[1][i] = p[i]->normal.y * invz;
+    q[2][i] = p[i]->normal.z * invz;
+  }
+  for (int k = 0; k < 3; k++) {
+    REAL q1 = q[k][1] - q[k][0], q2 = q[k][2] - q[k][0];
+    struct RenderPlane *pl = &planes[k];
+    pl->a = (q1 * y2 - q2 * y1) / det;
+    pl->b = (x1 * q2 - x2 * q1) / det;
+    pl->c = q[k][0] - pl->a * x0 - pl->b * y0;
+  }
 }
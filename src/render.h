@@ -5,10 +5,15 @@
  * Includes
  ******************************************************************************/
 
+#include "bvh.h"
 #include "color.h"
 #include "containers/matrix.h"
 #include "geo.h"
+#include "containers/arraylist.h"
 #include "mesh.h"
+#include "raster.h"
+#include "raypacket.h"
+#include "threadpool.h"
 
 #include <stdint.h>
 
@@ -16,18 +21,230 @@
  * Macros
  ******************************************************************************/
 
+// Plan proche de la camera (clipping et frustum)
+#define RD_NEAR 0.01
+
+// Plans du frustum : gauche, droite, haut, bas, proche
+#define RD_FRUSTUM_NB_PLANES 5
+
+// Codes de sortie d'un sommet (cf RenderVertices.outcode)
+#define RD_OUT_LEFT 0x01
+#define RD_OUT_RIGHT 0x02
+#define RD_OUT_TOP 0x04
+#define RD_OUT_BOTTOM 0x08
+#define RD_OUT_NEAR 0x10
+#define RD_OUT_GUARD 0x20 // Hors de la bande de garde
+
+// Bande de garde (pixels autour de l'ecran) : les triangles qui y tiennent ne
+// sont pas clippes, le scissor du rasteriseur s'en charge. Bornee pour que
+// les fonctions d'aretes tiennent sur 32 bits.
+#define RD_GUARD_BAND 4096
+
+// Cote des tuiles de la rasterisation du z buffer
+#define RD_TILE_SIZE 64
+
+// Cote des blocs de la pyramide de profondeur (Hi-Z) d'une tuile
+#define RD_HIZ_BLOCK_SIZE 8
+#define RD_HIZ_NB_BLOCKS (RD_TILE_SIZE / RD_HIZ_BLOCK_SIZE)
+
+// Profondeur maximale des formats a virgule fixe
+#define RD_DEPTH_UNORM24_MAX ((1u << 24) - 1)
+#define RD_DEPTH_UNORM16_MAX ((1u << 16) - 1)
+
+// Nombre de faces clippees par travail
+#define RD_BATCH_SIZE 1024
+
+// Aire ecran (pixels) par face visee par le choix du niveau de detail
+#define RD_LOD_PIXELS_PER_FACE 8
+
+// Resolution dynamique (cf RD_SetFrameBudget) : echelle minimale du raster,
+// poids de la derniere image dans la moyenne des temps et ecart relatif au
+// budget tolere avant de changer de resolution
+#define RD_DYNRES_MIN_SCALE 0.25
+#define RD_DYNRES_SMOOTHING 0.2
+#define RD_DYNRES_TOLERANCE 0.15
+
+// Age maximal (images) d'un pixel repris de l'historique du raytracing (cf
+// RD_SetRaytracingHistory)
+#define RD_HISTORY_MAX_AGE 16
+// Marge relative sur la distance du point repris : une face plus proche d'au
+// moins cette part le cache (les faces voisines sont a egalite)
+#define RD_HISTORY_OCCLUSION_EPS 1e-4
+
 /*******************************************************************************
  * Types
  ******************************************************************************/
 
+/*
+ * Format du z buffer. Tous stockent la profondeur inversee d = RD_NEAR / z
+ * (1 au plan proche, 0 a l'infini et pour un pixel vide), lineaire a l'ecran :
+ * plus d est grand, plus le pixel est proche.
+ */
+enum RenderDepthFormat {
+  RD_DEPTH_FLOAT,   // float 32 bits (reversed-Z)
+  RD_DEPTH_UNORM24, // virgule fixe 24 bits (dans un uint32_t)
+  RD_DEPTH_UNORM16, // virgule fixe 16 bits
+};
+
+/*
+ * Ombrage de la passe differee fusionnee (cf RD_RenderDeferred)
+ */
+enum RenderShading {
+  RD_SHADING_NORMALS, // Normale interpolee en couleur (cf RD_DrawGbuffer)
+  RD_SHADING_LUM,     // Eclairage diffus (cf RD_DrawFbufferWithLum)
+};
+
+/*
+ * Parametres de la passe differee fusionnee
+ */
+struct RenderDeferred {
+  enum RenderShading shading;
+  struct Vector lum; // Direction normalisee de la lumiere (RD_SHADING_LUM)
+  color lumColor;    // Couleur de la lumiere (RD_SHADING_LUM)
+  color background;  // Couleur des pixels vides (cf RD_DrawFill)
+  bool negate;       // Filtre video RASTER_Negate
+};
+
+/*
+ * Compteurs de la derniere image calculee
+ */
+struct RenderStats {
+  unsigned int nbMeshsCulled; // Meshs hors du frustum
+  unsigned int nbFacesCulled; // Faces de dos rejetees avant le clipping
+  unsigned int nbMeshsOccluded;     // Meshs caches (par tuile, Hi-Z)
+  unsigned int nbTrianglesOccluded; // Triangles caches (par tuile, Hi-Z)
+  unsigned int nbClustersCulled;   // Clusters hors du frustum ou de dos
+  unsigned int nbClustersOccluded; // Clusters caches (par tuile, Hi-Z)
+  unsigned int nbFacesLoaded; // Faces des meshs visibles, pleine resolution
+  unsigned int nbFacesDrawn;  // Faces des niveaux de detail choisis
+  unsigned int nbMeshsReused; // Meshs visibles dont la projection est reprise
+  unsigned int nbRaysTraced;  // Rayons primaires lances (raytracing)
+  unsigned int nbPixelsReprojected; // Pixels repris de l'historique
+  unsigned int nbOcclusionRays; // Rayons d'occlusion des pixels repris
+};
+
+/*
+ * Etat d'un pixel de l'historique du raytracing
+ */
+enum RenderHistoryState {
+  RD_HISTORY_EMPTY, // Aucun echantillon : rayon a lancer
+  RD_HISTORY_HIT,   // Rayon en collision
+  RD_HISTORY_MISS,  // Rayon dans le vide
+};
+
+/*
+ * Pixel de l'historique du raytracing : un point touche, reprojete a l'image
+ * suivante, ou un rayon dans le vide, vu comme un point a l'infini dans sa
+ * direction (cf RD_SetRaytracingHistory). Compact, il est parcouru a chaque
+ * image, le point touche est a part.
+ */
+struct RenderHistory {
+  uint16_t age;  // Images depuis le lancer du rayon
+  uint8_t state; // RenderHistoryState
+  uint8_t lod;   // Niveau de detail touche (cf Mesh.lod)
+};
+
+/*
+ * Point touche d'un pixel RD_HISTORY_HIT de l'historique
+ */
+struct RenderHistoryHit {
+  struct Vector hit;
+  struct Mesh *mesh;
+  struct MeshFace *face; // Face du niveau lod du mesh
+};
+
+/*
+ * Equation de plan ecran v(x, y) = a x + b y + c d'un attribut de face
+ */
+struct RenderPlane {
+  REAL a, b, c;
+};
+
+/*
+ * Etat d'un cluster pour l'image courante (cf RD_CalcZbuffer)
+ */
+struct RenderCluster {
+  REAL depthNear;  // Profondeur camera minimale de la boite
+  RasterRect rect; // Rectangle ecran de la boite
+};
+
+/*
+ * Etat d'un mesh pour l'image courante (cf RD_CalcProjectionVertices) : s'il
+ * est dans le frustum, la profondeur camera minimale de sa boite et ses
+ * sommets transformes, en SoA dans l'ordre de ses sommets : coordonnees
+ * homogenes de clipping (x, y, w avec w la profondeur camera), coordonnees
+ * ecran apres division et codes de sortie.
+ * Les plans ecran de normale / z (x, y, z) de ses faces suivent l'ordre des
+ * faces, ils ne sont valides que pour les faces clippees (ou apres
+ * RD_calcCacheBarycentres). Ses clusters suivent l'ordre des clusters du
+ * niveau, valides pour ceux qui ne sont pas rejetes.
+ */
+struct RenderVertices {
+  bool visible;
+  REAL depthNear;
+  REAL *x, *y, *w;
+  REAL *sx, *sy;
+  uint8_t *outcode;
+  size_t alloc; // Multiple de MESH_SOA_WIDTH
+  struct RenderPlane (*planes)[3];
+  size_t planesAlloc;
+  struct RenderCluster *clusters;
+  size_t clustersAlloc;
+  // Entrees du dernier calcul : niveau transforme, sa version, la camera
+  const struct Mesh *mesh;
+  uint32_t meshVersion, camVersion;
+};
+
+/*
+ * Triangle ecran apres clipping, en attente de rasterisation par tuiles
+ */
+struct RenderTriangle {
+  RasterPos p[3];
+  REAL depth[3]; // Profondeurs inversees RD_NEAR / z
+  struct MeshFace *face;
+  const struct RenderVertices *vertices; // Etat du mesh de la face
+  const struct RenderCluster *cluster; // NULL si le niveau n'a pas de clusters
+};
+
+/*
+ * Pyramide de profondeur d'une tuile : profondeur inversee minimale (la plus
+ * loin) de chaque bloc, 0 tant qu'un pixel du bloc est vide. Les blocs ecrits
+ * sont marques sales et recalcules a la demande.
+ */
+struct RenderHiZ {
+  REAL blockMin[RD_HIZ_NB_BLOCKS * RD_HIZ_NB_BLOCKS];
+  uint64_t dirty; // Un bit par bloc
+  unsigned int nbMeshsOccluded;
+  unsigned int nbClustersOccluded;
+  unsigned int nbTrianglesOccluded;
+};
+
+/*
+ * Lot de faces consecutives d'un mesh, clippees par un meme travail. Si le
+ * niveau dessine a des clusters, le lot en regroupe plusieurs entiers.
+ */
+struct RenderBatch {
+  struct Mesh *mesh;
+  struct Mesh *lod;                // Niveau de detail dessine du mesh
+  struct RenderVertices *vertices; // Sommets transformes du mesh
+  uint32_t start, end;      // Faces [start, end[
+  uint32_t clusterStart, clusterEnd; // Clusters [start, end[, vide sinon
+  ArrayList *triangles;     // RenderTriangle produits
+  unsigned int nbFacesCulled; // Faces de dos du lot
+  unsigned int nbClustersCulled; // Clusters hors du frustum ou de dos
+};
+
 struct Render {
 
   /*data*/
   unsigned int nb_meshs;
   struct Mesh **meshs; // Tableau de pointeur de mesh
+  struct RenderVertices *vertices; // Sommets transformes, un par mesh
+  Bvh *bvh;            // Hierarchie des meshs, NULL si non calculee
 
-  /* Repere world */
-  struct MeshVertex p0, px, py, pz;
+  /* Repere world : origine puis axes x, y, z, et leur projection */
+  Vector axis[4];
+  RasterPos axisScreen[4];
 
   /*Plan*/
   struct Mesh *highlightedMesh;
@@ -38,6 +255,7 @@ struct Render {
   struct Vector cam_pos;
   struct Vector cam_forward;
   struct Vector cam_up_world;
+  uint32_t camVersion; // Incremente quand la camera change (cf RD_SetCam)
 
   /* Précalcul world <-> camera*/
   struct Vector cam_u;
@@ -46,23 +264,74 @@ struct Render {
 
   /* Précalcul raytracting */
   struct Vector cam_wp;
+  bool raytracingPackets; // Rayons primaires lances par paquets SIMD
+  // Historique : image precedente et courante
+  unsigned int historyMaxAge; // 0 si desactive
+  Matrix *history, *historyNext;         // RenderHistory par pixel
+  Matrix *historyHits, *historyHitsNext; // RenderHistoryHit par pixel
+  Matrix *historyTarget; // Point de history repris par pixel (uint64_t)
+  bool historyValid;       // history issu de la derniere image
+  uint32_t historyVersion; // Versions des meshs a son calcul
+  uint32_t historyCamVersion; // camVersion a son calcul
+  REAL historyViewProj[3][4];  // viewProj a son calcul
 
   /* Précalul Projection */
   double tx, ty, tz;     // changement de plan de la camera
   double s;              // Fc du fov
   double scalex, scaley; // relations à la taille de l'écran
+  REAL viewProj[3][4]; // Monde -> clipping homogene (x, y, w)
+
+  /* Frustum : un point p est visible si n . p >= d pour les 5 plans */
+  struct Vector frustum_n[RD_FRUSTUM_NB_PLANES];
+  REAL frustum_d[RD_FRUSTUM_NB_PLANES];
 
   /* Ecran */
   Matrix *raster; // Rendu de la scene 2D matrix
+  // Taille de sortie (fenetre), le raster peut etre plus petit
+  unsigned int outputX, outputY;
+
+  /* Resolution dynamique (cf RD_AdaptResolution) */
+  double frameBudget; // Temps d'image vise (s), 0 si desactivee
+  double frameTime;   // Moyenne glissante des temps d'image, 0 si a mesurer
+  double frameStart;  // Debut de l'image en cours, 0 si inconnu
+  double scale;       // Taille du raster / taille de sortie
 
-  /* Z buffer (double)*/
+  /* Z buffer (cf RenderDepthFormat)*/
   Matrix *zbuffer;
+  enum RenderDepthFormat depthFormat;
 
   /* Face buffer (MeshFace*)*/
   Matrix *fbuffer;
 
   /* G buffer (Vertex)*/
   Matrix *gbuffer;
+
+  /* Threads de rendu */
+  ThreadPool *pool;
+
+  /* Rasterisation par tuiles (tri au milieu) */
+  unsigned int nbTilesX, nbTilesY;
+  ArrayList **bins;             // Par tuile : RenderTriangle* a rasteriser
+  struct RenderHiZ *hiz;        // Par tuile : pyramide de profondeur
+  struct RenderBatch *batches;  // Lots de faces de l'image courante
+  unsigned int nbBatches;       // Nombre de lots utilises
+  unsigned int nbBatchesAlloc;  // Nombre de lots alloues
+
+  /* Suivi des modifications : sceneVersion est incremente quand la projection
+   * change (camera, meshs visibles), chaque tampon retient la version dont il
+   * est issu et n'est recalcule que si elle a change (0 : jamais calcule) */
+  uint32_t sceneVersion;
+  uint32_t zbufferVersion; // z et f buffers
+  uint32_t planesVersion;  // Plans de toutes les faces (RD_calcCacheBarycentres)
+  uint32_t gbufferVersion; // zbufferVersion dont est issu le g buffer
+  // Raster ecrit par RD_RenderDeferred : zbufferVersion, parametres et face
+  // surlignee. Remis a 0 par les autres fonctions de dessin.
+  uint32_t rasterVersion;
+  struct RenderDeferred rasterParams;
+  const struct MeshFace *rasterHighlight;
+
+  /* Statistiques */
+  struct RenderStats stats;
 };
 
 /*******************************************************************************
@@ -102,7 +371,18 @@ extern bool RD_RayCastOnRD(const struct Render *rd, const struct Vector *ray,
                            struct Vector *x, struct Mesh **m,
                            struct MeshFace **face);
 
+/*
+ * Intersection d'un paquet de nbRays <= PACKET_SIZE rayons primaires (issus de
+ * la camera) avec toutes les meshs. Retourne le masque des rayons en
+ * collision, les points, faces et meshs sont remplis pour ces rayons.
+ */
+extern unsigned RD_RayCastPacket(const struct Render *rd,
+                                 const struct Vector *rays, unsigned nbRays,
+                                 struct Vector *x, struct Mesh **m,
+                                 struct MeshFace **face);
+
 void RD_Print(struct Render *rd);
+void RD_PrintStats(struct Render *rd);
 
 /*
  * https://www.scratchapixel.com/lessons/mathematics-physics-for-computer-graphics/lookat-function
@@ -111,7 +391,23 @@ void RD_SetCam(struct Render *rd, const struct Vector *cam_pos,
                const struct Vector *cam_forward,
                const struct Vector *cam_up_world);
 
+/*
+ * Raytracing par tuiles. Avec l'historique (cf RD_SetRaytracingHistory), seuls
+ * les pixels sans echantillon reprojete sont relances.
+ */
 void RD_DrawRaytracing(struct Render *rd);
+/*
+ * Historique du raytracing : les points touches a l'image precedente sont
+ * reprojetes par la camera courante (le plus proche l'emporte) et chaque
+ * pixel teste la face qu'il a recue, puis qu'aucune face ne passe devant par
+ * un rayon d'occlusion borne au point, arrete a la premiere face trouvee
+ * (nbOcclusionRays). Les pixels decouverts, caches, dont la face n'est plus
+ * touchee ou plus vieux que maxAge images sont relances : les rayons
+ * primaires suivent les changements a l'ecran plutot que la resolution. Un
+ * rayon dans le vide peut manquer un objet arrivant devant jusqu'a son
+ * expiration. Tout est relance si un mesh change. 0 desactive l'historique.
+ */
+void RD_SetRaytracingHistory(struct Render *rd, unsigned int maxAge);
 void RD_DrawWireframe(struct Render *rd);
 void RD_DrawVertices(struct Render *rd);
 void RD_DrawAxis(struct Render *rd);
@@ -122,10 +418,72 @@ void RD_DrawZbuffer(struct Render *rd);
 void RD_DrawFbufferWithLum(struct Render *rd, struct Vector *lv, color lc);
 
 void RD_CalcZbuffer(struct Render *rd);
+
+/*
+ * Rendu differe fusionne : chaque tuile (RD_TILE_SIZE) calcule son z buffer,
+ * reconstruit les normales, ombre et filtre ses pixels avant de passer a la
+ * suivante, tout restant en cache. Equivalent a RD_CalcZbuffer,
+ * RD_calcCacheBarycentres, RD_DrawFill puis RD_DrawGbuffer (ou
+ * RD_DrawFbufferWithLum) et RASTER_Negate, sans ecrire le g buffer. La face
+ * surlignee est de couleur inversee.
+ * RD_CalcProjectionVertices doit avoir ete appelee. Si la scene n'a pas change
+ * depuis l'image precedente, seuls les pixels dont l'ombrage change sont
+ * recalcules : aucun, ceux des faces surlignees avant et apres, ou tous sans
+ * rasteriser si les parametres changent. Le raster ne doit alors pas avoir
+ * ete modifie hors du rendu (cf Render.rasterVersion).
+ */
+void RD_RenderDeferred(struct Render *rd, const struct RenderDeferred *params);
+void RD_SetDepthFormat(struct Render *rd, enum RenderDepthFormat format);
+/*
+ * Taille du raster et des tampons, leur contenu est perdu. La taille de sortie
+ * ne change pas, les structures Matrix restent les memes.
+ */
+void RD_SetResolution(struct Render *rd, unsigned int xmax, unsigned int ymax);
+/*
+ * Resolution dynamique : le raster est rendu a une echelle de la taille de
+ * sortie choisie a chaque image (cf RD_AdaptResolution) pour tenir le budget
+ * (secondes), la fenetre ou le terminal l'agrandissent. 0 la desactive et
+ * revient a la taille de sortie.
+ */
+void RD_SetFrameBudget(struct Render *rd, double budget);
+/*
+ * A appeler au debut de chaque image : mesure le temps de la precedente et
+ * adapte la taille du raster. Le cout etant proportionnel au nombre de
+ * pixels, l'echelle est multipliee par sqrt(budget / temps moyen).
+ */
+void RD_AdaptResolution(struct Render *rd);
+/*
+ * Meme controleur avec le temps (secondes) de l'image precedente donne par
+ * l'appelant. Retourne true si le raster a ete redimensionne.
+ */
+bool RD_AdaptResolutionTime(struct Render *rd, double elapsed);
 void RD_CalcProjectionVertices(struct Render *rd);
 void RD_CalcNormales(struct Render *rd);
+/*
+ * Niveaux de detail de chaque mesh (cf SIMPLIFY_CalcLods), choisis a chaque
+ * image selon la taille a l'ecran. A appeler avant RD_CalcNormales et
+ * RD_CalcBvh qui traitent aussi les niveaux.
+ */
+void RD_CalcLods(struct Render *rd);
+/*
+ * Clusters des meshs et de leurs niveaux (cf MESH_CalcClusters), rejetes en
+ * bloc par RD_CalcZbuffer. Les faces etant reordonnees, a appeler avant
+ * RD_CalcBvh.
+ */
+void RD_CalcClusters(struct Render *rd);
+/*
+ * Ordre des faces et des sommets des meshs et de leurs niveaux favorisant la
+ * reutilisation des sommets (cf MESH_OptimizeVertexCache). A appeler apres
+ * RD_CalcClusters et avant RD_CalcBvh.
+ */
+void RD_OptimizeVertexCache(struct Render *rd);
+/*
+ * Cache des plans d'interpolation des faces (cf RenderVertices.planes) pour
+ * RD_CalcGbuffer, deja calcule par RD_CalcZbuffer pour les faces dessinees
+ */
 void RD_calcCacheBarycentres(struct Render *rd);
 void RD_CalcGbuffer(struct Render *rd);
+void RD_CalcBvh(struct Render *rd);
 
 void RD_RenderRaster(struct Render *rd);
 
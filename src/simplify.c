@@ -0,0 +1,554 @@
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+
+#include "simplify.h"
+#include "geo.h"
+#include "mesh.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*******************************************************************************
+ * Macros
+ ******************************************************************************/
+
+// Passes maximales de fusion des aretes
+#define SIMPLIFY_MAX_PASSES 100
+
+// Erreur maximale d'une fusion a la passe i :
+// SIMPLIFY_THRESHOLD * (i + 3) ^ SIMPLIFY_AGGRESSIVENESS (mesh dans la boite
+// unite), les aretes les moins couteuses partent en premier
+#define SIMPLIFY_THRESHOLD 1e-9
+#define SIMPLIFY_AGGRESSIVENESS 7
+
+// Passes entre deux compactages des references sommet -> faces
+#define SIMPLIFY_COMPACT_PERIOD 5
+
+// Cosinus minimal entre l'ancienne et la nouvelle normale d'une face voisine
+#define SIMPLIFY_MIN_NORMAL_COS 0.2
+
+// Cosinus maximal d'un angle d'une face voisine (face degeneree)
+#define SIMPLIFY_MAX_CORNER_COS 0.999
+
+// Determinant minimal pour placer le sommet au minimum de la quadrique
+#define SIMPLIFY_MIN_DET 1e-9
+
+/*******************************************************************************
+ * Types
+ ******************************************************************************/
+
+/*
+ * Quadrique symetrique 4x4 (10 coefficients), toujours en double : elle
+ * accumule les plans de nombreuses faces
+ */
+typedef double Quadric[10];
+
+typedef struct SimplifyVertex SimplifyVertex;
+struct SimplifyVertex {
+  Vector p;                    // Position dans la boite unite
+  Quadric q;                   // Somme des plans des faces fusionnees
+  uint32_t refStart, refCount; // Faces du sommet dans Simplify.refs
+  bool border;                 // Sur une arete de bord : jamais fusionne
+};
+
+typedef struct SimplifyFace SimplifyFace;
+struct SimplifyFace {
+  uint32_t v[3];
+  double err[4]; // Cout de fusion des aretes (v[k], v[k + 1]), minimum en 3
+  Vector normal;
+  color color;
+  bool deleted;
+  bool dirty; // Modifiee pendant la passe : ses couts sont perimes
+};
+
+/*
+ * Reference d'un sommet vers une face : coin corner de la face face
+ */
+typedef struct SimplifyRef SimplifyRef;
+struct SimplifyRef {
+  uint32_t face, corner;
+};
+
+typedef struct Simplify Simplify;
+struct Simplify {
+  SimplifyVertex *vertices;
+  uint32_t nbVertices;
+  SimplifyFace *faces;
+  uint32_t nbFaces;
+  uint32_t nbDeleted;
+  SimplifyRef *refs; // Les fusions ajoutent les references en fin
+  size_t nbRefs, refsAlloc;
+  bool *removed[2]; // Par reference d'une extremite : face supprimee
+  size_t removedAlloc;
+  Vector origin; // Passage de la boite unite au monde : p * scale + origin
+  REAL scale;
+  Vector extent; // Coin maximal de la boite du mesh (le minimal est 0)
+};
+
+/*******************************************************************************
+ * Internal function declaration
+ ******************************************************************************/
+
+static void simplifyInit(Simplify *s, const Mesh *mesh);
+static void simplifyFree(Simplify *s);
+static Mesh *simplifyBuild(const Simplify *s, const Mesh *mesh);
+static void compactRefs(Simplify *s);
+static void addRef(Simplify *s, SimplifyRef ref);
+static void calcBorders(Simplify *s);
+static void calcQuadrics(Simplify *s);
+static void calcFaceErrors(Simplify *s, SimplifyFace *f);
+static bool faceNormal(const Simplify *s, const SimplifyFace *f, Vector *n);
+static bool collapseEdge(Simplify *s, uint32_t i0, uint32_t i1);
+static bool isFlipped(Simplify *s, const Vector *p, uint32_t i0, uint32_t i1,
+                      bool *removed);
+static void updateFaces(Simplify *s, uint32_t i0, const SimplifyVertex *v,
+                        const bool *removed);
+static double edgeError(const Simplify *s, uint32_t i0, uint32_t i1,
+                        Vector *p);
+static inline double quadricError(const Quadric q, const Vector *p);
+static inline double quadricDet(const Quadric q, int a11, int a12, int a13,
+                                int a21, int a22, int a23, int a31, int a32,
+                                int a33);
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Public function
+ ******************************************************************************/
+
+/*
+ * Passes a seuil d'erreur croissant : chaque face non modifiee de la passe
+ * fusionne sa premiere arete sous le seuil. Plus simple qu'un tas et d'ordre
+ * presque equivalent.
+ */
+Mesh *SIMPLIFY_Mesh(const Mesh *mesh, size_t nbFaces) {
+  Simplify s;
+  simplifyInit(&s, mesh);
+
+  for (unsigned pass = 0;
+       pass < SIMPLIFY_MAX_PASSES && s.nbFaces - s.nbDeleted > nbFaces;
+       pass++) {
+    if (pass % SIMPLIFY_COMPACT_PERIOD == 0)
+      compactRefs(&s);
+    for (uint32_t i = 0; i < s.nbFaces; i++)
+      s.faces[i].dirty = false;
+
+    double threshold =
+        SIMPLIFY_THRESHOLD * pow(pass + 3, SIMPLIFY_AGGRESSIVENESS);
+    for (uint32_t i = 0;
+         i < s.nbFaces && s.nbFaces - s.nbDeleted > nbFaces; i++) {
+      SimplifyFace *f = &s.faces[i];
+      if (f->deleted || f->dirty || f->err[3] > threshold)
+        continue;
+      for (int k = 0; k < 3; k++) {
+        if (f->err[k] <= threshold &&
+            collapseEdge(&s, f->v[k], f->v[(k + 1) % 3]))
+          break;
+      }
+    }
+  }
+
+  Mesh *ret = simplifyBuild(&s, mesh);
+  simplifyFree(&s);
+  return ret;
+}
+
+void SIMPLIFY_CalcLods(Mesh *mesh) {
+  for (unsigned i = 0; i < mesh->nbLods; i++)
+    MESH_Free(mesh->lods[i]);
+  mesh->nbLods = 0;
+  mesh->lod = 0;
+
+  const Mesh *prev = mesh;
+  while (mesh->nbLods < MESH_LOD_MAX) {
+    size_t nbPrev = MESH_GetNbFace(prev);
+    size_t target = nbPrev * SIMPLIFY_LOD_RATIO;
+    if (target < SIMPLIFY_LOD_MIN_FACES)
+      break;
+    Mesh *lod = SIMPLIFY_Mesh(prev, target);
+    // Bords ou formes bloquant la simplification : niveau inutile
+    if (MESH_GetNbFace(lod) > (nbPrev + target) / 2) {
+      MESH_Free(lod);
+      break;
+    }
+    mesh->lods[mesh->nbLods++] = lod;
+    prev = lod;
+  }
+}
+
+/*******************************************************************************
+ * Internal function
+ ******************************************************************************/
+
+/*
+ * Copie du mesh ramene dans la boite unite (seuils independants de l'echelle)
+ * puis references, bords et quadriques
+ */
+static void simplifyInit(Simplify *s, const Mesh *mesh) {
+  memset(s, 0, sizeof(Simplify));
+  s->nbVertices = MESH_GetNbVertice(mesh);
+  s->nbFaces = MESH_GetNbFace(mesh);
+  s->vertices = calloc(s->nbVertices ? s->nbVertices : 1,
+                       sizeof(SimplifyVertex));
+  s->faces = calloc(s->nbFaces ? s->nbFaces : 1, sizeof(SimplifyFace));
+  assert(s->vertices && s->faces);
+
+  s->origin = mesh->box.min;
+  Vector size;
+  VECT_Sub(&size, &mesh->box.max, &mesh->box.min);
+  s->scale = fmax(size.x, fmax(size.y, size.z));
+  if (!mesh->box.cpt || s->scale <= 0)
+    s->scale = 1;
+  VECT_MultSca(&s->extent, &size, 1 / s->scale);
+
+  for (uint32_t i = 0; i < s->nbVertices; i++) {
+    Vector *p = &s->vertices[i].p;
+    VECT_Sub(p, MESH_GetVertexPos(mesh, i, p), &s->origin);
+    VECT_MultSca(p, p, 1 / s->scale);
+  }
+  for (uint32_t i = 0; i < s->nbFaces; i++) {
+    SimplifyFace *f = &s->faces[i];
+    memcpy(f->v, MESH_GetFaceIndices(mesh, i), sizeof(f->v));
+    f->color = MESH_GetFace(mesh, i)->color;
+    // Faces degenerees du fichier : supprimees d'emblee
+    f->deleted = !faceNormal(s, f, &f->normal);
+    s->nbDeleted += f->deleted;
+  }
+
+  compactRefs(s);
+  calcBorders(s);
+  calcQuadrics(s);
+  for (uint32_t i = 0; i < s->nbFaces; i++)
+    calcFaceErrors(s, &s->faces[i]);
+}
+
+static void simplifyFree(Simplify *s) {
+  free(s->vertices);
+  free(s->faces);
+  free(s->refs);
+  free(s->removed[0]);
+  free(s->removed[1]);
+}
+
+/*
+ * Nouveau mesh des faces restantes, les sommets inutilises sont retires
+ */
+static Mesh *simplifyBuild(const Simplify *s, const Mesh *mesh) {
+  Mesh *ret = MESH_Init();
+  if (mesh->name)
+    MESH_SetName(ret, mesh->name);
+  ret->backfaceCulling = mesh->backfaceCulling;
+
+  uint32_t *remap = malloc(sizeof(uint32_t) * (s->nbVertices ? s->nbVertices : 1));
+  assert(remap);
+  for (uint32_t i = 0; i < s->nbVertices; i++)
+    remap[i] = UINT32_MAX;
+  for (uint32_t i = 0; i < s->nbFaces; i++) {
+    const SimplifyFace *f = &s->faces[i];
+    if (f->deleted)
+      continue;
+    uint32_t v[3];
+    for (int k = 0; k < 3; k++) {
+      if (remap[f->v[k]] == UINT32_MAX) {
+        Vector w;
+        VECT_MultSca(&w, &s->vertices[f->v[k]].p, s->scale);
+        VECT_Add(&w, &w, &s->origin);
+        remap[f->v[k]] = MESH_AddVertexPos(ret, w.x, w.y, w.z);
+      }
+      v[k] = remap[f->v[k]];
+    }
+    MESH_AddTriangle(ret, v[0], v[1], v[2], f->color);
+  }
+  free(remap);
+  return ret;
+}
+
+/*
+ * Reconstruit les references des faces restantes, contigues par sommet
+ */
+static void compactRefs(Simplify *s) {
+  for (uint32_t i = 0; i < s->nbVertices; i++)
+    s->vertices[i].refCount = 0;
+  for (uint32_t i = 0; i < s->nbFaces; i++) {
+    if (s->faces[i].deleted)
+      continue;
+    for (int k = 0; k < 3; k++)
+      s->vertices[s->faces[i].v[k]].refCount++;
+  }
+  uint32_t start = 0;
+  for (uint32_t i = 0; i < s->nbVertices; i++) {
+    s->vertices[i].refStart = start;
+    start += s->vertices[i].refCount;
+    s->vertices[i].refCount = 0;
+  }
+
+  s->nbRefs = 0;
+  for (size_t i = 0; i < start; i++)
+    addRef(s, (SimplifyRef){0, 0});
+  for (uint32_t i = 0; i < s->nbFaces; i++) {
+    if (s->faces[i].deleted)
+      continue;
+    for (uint32_t k = 0; k < 3; k++) {
+      SimplifyVertex *v = &s->vertices[s->faces[i].v[k]];
+      s->refs[v->refStart + v->refCount++] = (SimplifyRef){i, k};
+    }
+  }
+}
+
+static void addRef(Simplify *s, SimplifyRef ref) {
+  if (s->nbRefs == s->refsAlloc) {
+    s->refsAlloc = s->refsAlloc ? 2 * s->refsAlloc : 64;
+    s->refs = realloc(s->refs, sizeof(SimplifyRef) * s->refsAlloc);
+    assert(s->refs);
+  }
+  s->refs[s->nbRefs++] = ref;
+}
+
+/*
+ * Un sommet est au bord s'il a un voisin avec lequel il ne partage qu'une
+ * face
+ */
+static void calcBorders(Simplify *s) {
+  size_t alloc = 16;
+  uint32_t *ids = malloc(sizeof(uint32_t) * alloc);
+  uint32_t *counts = malloc(sizeof(uint32_t) * alloc);
+  assert(ids && counts);
+  for (uint32_t i = 0; i < s->nbVertices; i++) {
+    SimplifyVertex *v = &s->vertices[i];
+    if (2 * v->refCount > alloc) {
+      alloc = 2 * v->refCount;
+      ids = realloc(ids, sizeof(uint32_t) * alloc);
+      counts = realloc(counts, sizeof(uint32_t) * alloc);
+      assert(ids && counts);
+    }
+    size_t nb = 0;
+    for (uint32_t r = 0; r < v->refCount; r++) {
+      const SimplifyRef *ref = &s->refs[v->refStart + r];
+      const SimplifyFace *f = &s->faces[ref->face];
+      for (uint32_t k = 1; k < 3; k++) {
+        uint32_t id = f->v[(ref->corner + k) % 3];
+        size_t j = 0;
+        while (j < nb && ids[j] != id)
+          j++;
+        if (j == nb) {
+          ids[nb] = id;
+          counts[nb++] = 0;
+        }
+        counts[j]++;
+      }
+    }
+    for (size_t j = 0; j < nb; j++) {
+      if (counts[j] == 1) {
+        v->border = true;
+        s->vertices[ids[j]].border = true;
+      }
+    }
+  }
+  free(ids);
+  free(counts);
+}
+
+/*
+ * Quadrique de chaque sommet : somme des plans (a, b, c, d) de ses faces
+ */
+static void calcQuadrics(Simplify *s) {
+  for (uint32_t i = 0; i < s->nbFaces; i++) {
+    const SimplifyFace *f = &s->faces[i];
+    if (f->deleted)
+      continue;
+    double a = f->normal.x, b = f->normal.y, c = f->normal.z;
+    double d = -VECT_DotProduct(&f->normal, &s->vertices[f->v[0]].p);
+    const Quadric plane = {a * a, a * b, a * c, a * d, b * b,
+                           b * c, b * d, c * c, c * d, d * d};
+    for (int k = 0; k < 3; k++) {
+      double *q = s->vertices[f->v[k]].q;
+      for (int j = 0; j < 10; j++)
+        q[j] += plane[j];
+    }
+  }
+}
+
+static void calcFaceErrors(Simplify *s, SimplifyFace *f) {
+  Vector p;
+  for (int k = 0; k < 3; k++)
+    f->err[k] = edgeError(s, f->v[k], f->v[(k + 1) % 3], &p);
+  f->err[3] = fmin(f->err[0], fmin(f->err[1], f->err[2]));
+}
+
+/*
+ * Normale unitaire de la face, faux si elle est degeneree
+ */
+static bool faceNormal(const Simplify *s, const SimplifyFace *f, Vector *n) {
+  const Vector *p0 = &s->vertices[f->v[0]].p;
+  Vector s21, s31;
+  VECT_Sub(&s21, &s->vertices[f->v[1]].p, p0);
+  VECT_Sub(&s31, &s->vertices[f->v[2]].p, p0);
+  VECT_CrossProduct(n, &s21, &s31);
+  if (VECT_NormSquare(n) == 0)
+    return false;
+  VECT_Normalise(n);
+  return true;
+}
+
+/*
+ * Fusionne i1 dans i0, deplace au minimum de leur quadrique. Refusee (faux)
+ * au bord ou si une face voisine se retournerait.
+ */
+static bool collapseEdge(Simplify *s, uint32_t i0, uint32_t i1) {
+  SimplifyVertex *v0 = &s->vertices[i0], *v1 = &s->vertices[i1];
+  if (v0->border || v1->border)
+    return false;
+
+  size_t nbRefs = v0->refCount > v1->refCount ? v0->refCount : v1->refCount;
+  if (nbRefs > s->removedAlloc) {
+    s->removedAlloc = 2 * nbRefs;
+    for (int k = 0; k < 2; k++) {
+      s->removed[k] = realloc(s->removed[k], sizeof(bool) * s->removedAlloc);
+      assert(s->removed[k]);
+    }
+  }
+
+  Vector p;
+  edgeError(s, i0, i1, &p);
+  if (isFlipped(s, &p, i0, i1, s->removed[0]) ||
+      isFlipped(s, &p, i1, i0, s->removed[1]))
+    return false;
+
+  v0->p = p;
+  for (int j = 0; j < 10; j++)
+    v0->q[j] += v1->q[j];
+  // Les faces restantes des deux sommets sont referencees a la suite
+  size_t start = s->nbRefs;
+  updateFaces(s, i0, v0, s->removed[0]);
+  updateFaces(s, i0, v1, s->removed[1]);
+  v0->refStart = start;
+  v0->refCount = s->nbRefs - start;
+  v1->refCount = 0;
+  return true;
+}
+
+/*
+ * Vrai si deplacer i0 en p (i1 fusionne) degenere ou retourne une de ses
+ * faces. removed[r] est mis a vrai pour les faces partagees avec i1, qui
+ * disparaissent.
+ */
+static bool isFlipped(Simplify *s, const Vector *p, uint32_t i0, uint32_t i1,
+                      bool *removed) {
+  const SimplifyVertex *v = &s->vertices[i0];
+  for (uint32_t r = 0; r < v->refCount; r++) {
+    const SimplifyRef *ref = &s->refs[v->refStart + r];
+    const SimplifyFace *f = &s->faces[ref->face];
+    removed[r] = false;
+    if (f->deleted)
+      continue;
+    uint32_t id1 = f->v[(ref->corner + 1) % 3];
+    uint32_t id2 = f->v[(ref->corner + 2) % 3];
+    if (id1 == i1 || id2 == i1) {
+      removed[r] = true;
+      continue;
+    }
+    Vector d1, d2, n;
+    VECT_Sub(&d1, &s->vertices[id1].p, p);
+    VECT_Sub(&d2, &s->vertices[id2].p, p);
+    if (VECT_NormSquare(&d1) == 0 || VECT_NormSquare(&d2) == 0)
+      return true;
+    VECT_Normalise(&d1);
+    VECT_Normalise(&d2);
+    if (fabs(VECT_DotProduct(&d1, &d2)) > SIMPLIFY_MAX_CORNER_COS)
+      return true;
+    VECT_CrossProduct(&n, &d1, &d2);
+    VECT_Normalise(&n);
+    if (VECT_DotProduct(&n, &f->normal) < SIMPLIFY_MIN_NORMAL_COS)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Faces du sommet v apres sa fusion en i0 : supprimees si marquees, sinon
+ * rattachees a i0 et referencees en fin de tableau
+ */
+static void updateFaces(Simplify *s, uint32_t i0, const SimplifyVertex *v,
+                        const bool *removed) {
+  for (uint32_t r = 0; r < v->refCount; r++) {
+    // Copie : addRef peut deplacer le tableau
+    SimplifyRef ref = s->refs[v->refStart + r];
+    SimplifyFace *f = &s->faces[ref.face];
+    if (f->deleted)
+      continue;
+    if (removed[r]) {
+      f->deleted = true;
+      s->nbDeleted++;
+      continue;
+    }
+    f->v[ref.corner] = i0;
+    f->dirty = true;
+    faceNormal(s, f, &f->normal);
+    calcFaceErrors(s, f);
+    addRef(s, ref);
+  }
+}
+
+/*
+ * Cout de la fusion de l'arete (i0, i1) et position p du sommet fusionne : le
+ * minimum de la quadrique s'il existe (borne a la boite du mesh), sinon la
+ * meilleure des extremites et du milieu
+ */
+static double edgeError(const Simplify *s, uint32_t i0, uint32_t i1,
+                        Vector *p) {
+  Quadric q;
+  for (int j = 0; j < 10; j++)
+    q[j] = s->vertices[i0].q[j] + s->vertices[i1].q[j];
+
+  double det = quadricDet(q, 0, 1, 2, 1, 4, 5, 2, 5, 7);
+  if (fabs(det) > SIMPLIFY_MIN_DET) {
+    p->x = -quadricDet(q, 1, 2, 3, 4, 5, 6, 5, 7, 8) / det;
+    p->y = quadricDet(q, 0, 2, 3, 1, 5, 6, 2, 7, 8) / det;
+    p->z = -quadricDet(q, 0, 1, 3, 1, 4, 6, 2, 5, 8) / det;
+    // Reste dans la boite du mesh, donc dans les hierarchies existantes
+    REAL *c[3] = {&p->x, &p->y, &p->z};
+    const REAL max[3] = {s->extent.x, s->extent.y, s->extent.z};
+    for (int k = 0; k < 3; k++)
+      *c[k] = *c[k] < 0 ? 0 : *c[k] > max[k] ? max[k] : *c[k];
+    return quadricError(q, p);
+  }
+
+  const Vector *p0 = &s->vertices[i0].p, *p1 = &s->vertices[i1].p;
+  Vector mid;
+  VECT_Add(&mid, p0, p1);
+  VECT_MultSca(&mid, &mid, 0.5);
+  const Vector *candidates[3] = {p0, p1, &mid};
+  double best = INFINITY;
+  for (int k = 0; k < 3; k++) {
+    double err = quadricError(q, candidates[k]);
+    if (err < best) {
+      best = err;
+      *p = *candidates[k];
+    }
+  }
+  return best;
+}
+
+/* Erreur v^T Q v du point v = (p, 1) */
+static inline double quadricError(const Quadric q, const Vector *p) {
+  double x = p->x, y = p->y, z = p->z;
+  return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x +
+         q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y + q[7] * z * z +
+         2 * q[8] * z + q[9];
+}
+
+/* Determinant 3x3 des coefficients de q d'indices donnes */
+static inline double quadricDet(const Quadric q, int a11, int a12, int a13,
+                                int a21, int a22, int a23, int a31, int a32,
+                                int a33) {
+  return q[a11] * q[a22] * q[a33] + q[a13] * q[a21] * q[a32] +
+         q[a12] * q[a23] * q[a31] - q[a13] * q[a22] * q[a31] -
+         q[a11] * q[a23] * q[a32] - q[a12] * q[a21] * q[a33];
+}
@@ -0,0 +1,50 @@
+#ifndef _SIMPLIFY_H_
+#define _SIMPLIFY_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+
+#include "mesh.h"
+
+#include <stddef.h>
+
+/*******************************************************************************
+ * Macros
+ ******************************************************************************/
+
+// Rapport du nombre de faces entre deux niveaux de detail successifs
+#define SIMPLIFY_LOD_RATIO 0.5
+
+// Pas de niveau de detail en dessous de ce nombre de faces
+#define SIMPLIFY_LOD_MIN_FACES 256
+
+/*******************************************************************************
+ * Types
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/*
+ * Simplification par fusion d'aretes guidee par les quadriques d'erreur
+ * (Garland et Heckbert) : retourne un nouveau mesh d'au plus nbFaces faces si
+ * possible. Les bords ne sont pas deplaces et les fusions qui retourneraient
+ * une face sont refusees, le resultat peut donc garder plus de faces.
+ * Les normales ne sont pas calculees.
+ */
+Mesh *SIMPLIFY_Mesh(const Mesh *mesh, size_t nbFaces);
+
+/*
+ * Chaine de niveaux de detail du mesh (cf Mesh.lods) : chaque niveau simplifie
+ * le precedent de SIMPLIFY_LOD_RATIO, jusqu'a MESH_LOD_MAX niveaux ou
+ * SIMPLIFY_LOD_MIN_FACES faces. Les niveaux precedents sont remplaces.
+ */
+void SIMPLIFY_CalcLods(Mesh *mesh);
+
+#endif /* _SIMPLIFY_H_ */
@@ -37,6 +37,9 @@ struct tty {
   /* Raster */
   uint32_t width, height;
   Matrix *raster; // Pointeur vers le raster
+  // Taille du raster a l'initialisation : s'il est reduit ensuite (resolution
+  // dynamique), il est agrandi a cette taille
+  uint32_t rasterX, rasterY;
   /* State */
   int run;
   uint32_t cpt;
@@ -65,6 +68,11 @@ static void TTY_DrawPixels_ASCII(struct tty *tty);
  */
 static void TTY_ResizeBuffer(struct tty *tty);
 
+/*
+ * Pixel (x, y) du raster a sa taille initiale (plus proche voisin)
+ */
+static color TTY_GetPixel(const struct tty *tty, uint32_t x, uint32_t y);
+
 /*
  * Gere les signaux
  */
@@ -89,6 +97,8 @@ extern struct tty *TTY_Init(Matrix *raster, RenderType renderType) {
   tty->bufferSize = 0;
 
   tty->raster = raster;
+  tty->rasterX = raster->xmax;
+  tty->rasterY = raster->ymax;
   tty->cpt = 0;
   tty->run = 1;
   TTY_QuerySize(&tty->width, &tty->height);
@@ -158,8 +168,8 @@ extern void TTY_QuerySize(uint32_t *w, uint32_t *h) {
  ******************************************************************************/
 
 static void TTY_ResizeBuffer(struct tty *tty) {
-  uint32_t maxWidth = MIN(tty->width, tty->raster->xmax);
-  uint32_t maxHeight = MIN(tty->height, tty->raster->ymax);
+  uint32_t maxWidth = MIN(tty->width, tty->rasterX);
+  uint32_t maxHeight = MIN(tty->height, tty->rasterY);
   uint32_t newSize =
       maxWidth * ((maxHeight + 1) / 2) * PIXELS_SIZE + maxHeight * 2 + 1;
   if (tty->bufferSize != newSize) {
@@ -188,13 +198,13 @@ static void TTY_DrawPixels_ASCII(struct tty *tty) {
   static unsigned int nbChars = 69;
   static const char *chars = ".'`^\",:;Il!i><~+_-?][}{1)(|\\/"
                              "tfjrxnuvczXYUJCLQ0OZmwqpdbkhao*#MW&8%B@$";
-  uint32_t maxWidth = MIN(tty->width, tty->raster->xmax);
-  uint32_t maxHeight = MIN(tty->height, tty->raster->ymax);
+  uint32_t maxWidth = MIN(tty->width, tty->rasterX);
+  uint32_t maxHeight = MIN(tty->height, tty->rasterY);
   for (uint32_t y = 0; y < maxHeight; y++) {
     if (y < maxHeight) {
       for (uint32_t x = 0; x < maxWidth; x++) {
 
-        unsigned lum = CL_Brightness(RASTER_GetPixelxy(tty->raster, x, y));
+        unsigned lum = CL_Brightness(TTY_GetPixel(tty, x, y));
         unsigned indice = (int)((lum * nbChars) / 255);
         putc(chars[indice], stdout);
         putc(chars[indice], stdout);
@@ -206,14 +216,13 @@ static void TTY_DrawPixels_ASCII(struct tty *tty) {
 }
 
 static void TTY_DrawPixels_Square(struct tty *tty) {
-  uint32_t maxWidth = MIN(tty->width, tty->raster->xmax);
-  uint32_t maxHeight = MIN(tty->height, tty->raster->ymax);
+  uint32_t maxWidth = MIN(tty->width, tty->rasterX);
+  uint32_t maxHeight = MIN(tty->height, tty->rasterY);
   for (uint32_t y = 0; y <= tty->height; y += 2) {
     if (y < maxHeight) {
       for (uint32_t x = 0; x < maxWidth; x++) {
-        color bg = RASTER_GetPixelxy(tty->raster, x, y);
-        color fg = y + 1 < maxHeight ? RASTER_GetPixelxy(tty->raster, x, y + 1)
-                                     : CL_BLACK;
+        color bg = TTY_GetPixel(tty, x, y);
+        color fg = y + 1 < maxHeight ? TTY_GetPixel(tty, x, y + 1) : CL_BLACK;
 
         printf("\x1b[48;2;%u;%u;%um\x1b[38;2;%u;%u;%um\u2584\x1b[0m", bg.rgb.r,
                bg.rgb.g, bg.rgb.b, fg.rgb.r, fg.rgb.g, fg.rgb.b);
@@ -224,6 +233,12 @@ static void TTY_DrawPixels_Square(struct tty *tty) {
   fflush(stdout);
 }
 
+static color TTY_GetPixel(const struct tty *tty, uint32_t x, uint32_t y) {
+  return RASTER_GetPixelxy(tty->raster,
+                           (uint64_t)x * tty->raster->xmax / tty->rasterX,
+                           (uint64_t)y * tty->raster->ymax / tty->rasterY);
+}
+
 static void TTY_SignalReceived(int signal) {
   if (signal == SIGINT)
     halted = 1;
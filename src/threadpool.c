@@ -0,0 +1,178 @@
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+
+#include "threadpool.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ * Macros
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Types
+ ******************************************************************************/
+
+struct ThreadPoolWorker {
+  ThreadPool *tp;
+  unsigned index;
+};
+
+struct ThreadPool {
+  /* Threads */
+  unsigned nbThreads;
+  pthread_t *threads;
+  struct ThreadPoolWorker *workers;
+  /* Synchronisation */
+  pthread_mutex_t lock;
+  pthread_cond_t start; // Nouveau travail ou fermeture
+  pthread_cond_t done;  // Tous les workers ont fini
+  unsigned generation;  // Incremente a chaque TP_Run
+  unsigned nbBusy;      // Workers encore au travail
+  bool quit;
+  /* Travail courant */
+  ThreadPoolJob job;
+  void **args;
+  uint32_t nbJobs;
+  atomic_uint nextJob;
+};
+
+/*******************************************************************************
+ * Internal function declaration
+ ******************************************************************************/
+
+static void *TP_WorkerLoop(void *arg);
+static void TP_RunJobs(ThreadPool *tp, unsigned ithread);
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Public function
+ ******************************************************************************/
+
+/*
+ * Initialisation d'un pool, 0 : autant de threads que de coeurs
+ */
+ThreadPool *TP_Init(unsigned nbThreads) {
+  ThreadPool *tp = malloc(sizeof(ThreadPool));
+  assert(tp);
+
+  if (!nbThreads) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    nbThreads = n > 0 ? (unsigned)n : 1;
+  }
+  tp->nbThreads = nbThreads;
+  tp->generation = 0;
+  tp->nbBusy = 0;
+  tp->quit = false;
+  tp->job = NULL;
+  tp->args = NULL;
+  tp->nbJobs = 0;
+  atomic_init(&tp->nextJob, 0);
+  pthread_mutex_init(&tp->lock, NULL);
+  pthread_cond_init(&tp->start, NULL);
+  pthread_cond_init(&tp->done, NULL);
+
+  // Le thread appelant est le thread 0
+  tp->threads = malloc(sizeof(pthread_t) * nbThreads);
+  tp->workers = malloc(sizeof(struct ThreadPoolWorker) * nbThreads);
+  assert(tp->threads && tp->workers);
+  for (unsigned i = 1; i < nbThreads; i++) {
+    tp->workers[i].tp = tp;
+    tp->workers[i].index = i;
+    pthread_create(&tp->threads[i], NULL, TP_WorkerLoop, &tp->workers[i]);
+  }
+  return tp;
+}
+
+void TP_Free(ThreadPool *tp) {
+  pthread_mutex_lock(&tp->lock);
+  tp->quit = true;
+  pthread_cond_broadcast(&tp->start);
+  pthread_mutex_unlock(&tp->lock);
+  for (unsigned i = 1; i < tp->nbThreads; i++)
+    pthread_join(tp->threads[i], NULL);
+
+  pthread_mutex_destroy(&tp->lock);
+  pthread_cond_destroy(&tp->start);
+  pthread_cond_destroy(&tp->done);
+  free(tp->threads);
+  free(tp->workers);
+  free(tp);
+}
+
+unsigned TP_GetNbThreads(const ThreadPool *tp) { return tp->nbThreads; }
+
+/*
+ * Distribue les travaux et attend leur fin
+ */
+void TP_Run(ThreadPool *tp, uint32_t nbJobs, ThreadPoolJob job, void **args) {
+  // Rien a paralleliser
+  if (tp->nbThreads == 1 || nbJobs <= 1) {
+    for (uint32_t i = 0; i < nbJobs; i++)
+      job(i, 0, args);
+    return;
+  }
+
+  pthread_mutex_lock(&tp->lock);
+  tp->job = job;
+  tp->args = args;
+  tp->nbJobs = nbJobs;
+  atomic_store(&tp->nextJob, 0);
+  tp->nbBusy = tp->nbThreads - 1;
+  tp->generation++;
+  pthread_cond_broadcast(&tp->start);
+  pthread_mutex_unlock(&tp->lock);
+
+  TP_RunJobs(tp, 0);
+
+  pthread_mutex_lock(&tp->lock);
+  while (tp->nbBusy)
+    pthread_cond_wait(&tp->done, &tp->lock);
+  pthread_mutex_unlock(&tp->lock);
+}
+
+/*******************************************************************************
+ * Internal function
+ ******************************************************************************/
+
+static void *TP_WorkerLoop(void *arg) {
+  struct ThreadPoolWorker *worker = arg;
+  ThreadPool *tp = worker->tp;
+  unsigned seen = 0;
+
+  while (1) {
+    pthread_mutex_lock(&tp->lock);
+    while (tp->generation == seen && !tp->quit)
+      pthread_cond_wait(&tp->start, &tp->lock);
+    if (tp->quit) {
+      pthread_mutex_unlock(&tp->lock);
+      return NULL;
+    }
+    seen = tp->generation;
+    pthread_mutex_unlock(&tp->lock);
+
+    TP_RunJobs(tp, worker->index);
+
+    pthread_mutex_lock(&tp->lock);
+    if (--tp->nbBusy == 0)
+      pthread_cond_signal(&tp->done);
+    pthread_mutex_unlock(&tp->lock);
+  }
+}
+
+/*
+ * Chaque thread prend le prochain travail libre jusqu'a epuisement
+ */
+static void TP_RunJobs(ThreadPool *tp, unsigned ithread) {
+  uint32_t ijob;
+  while ((ijob = atomic_fetch_add(&tp->nextJob, 1)) < tp->nbJobs)
+    tp->job(ijob, ithread, tp->args);
+}
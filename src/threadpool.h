@@ -0,0 +1,51 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+
+#include <stdint.h>
+
+/*******************************************************************************
+ * Macros
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Types
+ ******************************************************************************/
+
+struct ThreadPool;
+typedef struct ThreadPool ThreadPool;
+
+/*
+ * Travail execute pour chaque indice ijob dans [0, nbJobs[
+ * ithread est l'indice du thread executant dans [0, TP_GetNbThreads[
+ */
+typedef void (*ThreadPoolJob)(uint32_t ijob, unsigned ithread, void **args);
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/*
+ * Initialisation d'un pool de nbThreads threads (thread appelant compris)
+ * 0 : autant de threads que de coeurs
+ */
+ThreadPool *TP_Init(unsigned nbThreads);
+
+void TP_Free(ThreadPool *tp);
+
+unsigned TP_GetNbThreads(const ThreadPool *tp);
+
+/*
+ * Distribue les nbJobs travaux sur les threads du pool et attend leur fin.
+ * Le thread appelant participe au travail.
+ */
+void TP_Run(ThreadPool *tp, uint32_t nbJobs, ThreadPoolJob job, void **args);
+
+#endif /* _THREADPOOL_H_ */
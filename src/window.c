@@ -111,6 +111,7 @@ extern struct hwindow *HW_Init(const char *name, Matrix /*color*/ *raster) {
                        ret->width, ret->height, SDL_WINDOW_SHOWN);
 
   ret->renderer = SDL_CreateRenderer(ret->window, -1, SDL_RENDERER_ACCELERATED);
+  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear"); // Agrandissement
 
   ret->texture =
       SDL_CreateTexture(ret->renderer, SDL_PIXELFORMAT_ARGB8888,
@@ -195,8 +196,11 @@ extern inline unsigned int HW_GetY(struct hwindow *hw) { return hw->height; }
 static void HW_Render(struct hwindow *hw) {
   // SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
   // SDL_RenderClear(renderer);
-  SDL_UpdateTexture(hw->texture, NULL, hw->raster->data, hw->raster->xmax * 4);
-  SDL_RenderCopy(hw->renderer, hw->texture, NULL, NULL);
+  // Le raster peut etre plus petit que la fenetre (resolution dynamique) : il
+  // occupe le coin de la texture, agrandi a toute la fenetre par SDL
+  SDL_Rect src = {0, 0, hw->raster->xmax, hw->raster->ymax};
+  SDL_UpdateTexture(hw->texture, &src, hw->raster->data, hw->raster->xmax * 4);
+  SDL_RenderCopy(hw->renderer, hw->texture, &src, NULL);
   SDL_RenderPresent(hw->renderer);
 }
 
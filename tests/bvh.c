@@ -0,0 +1,81 @@
+#include "box3.h"
+#include "bvh.h"
+#include <assert.h>
+#include <math.h>
+
+#define NB_PRIMS 500
+
+/* Primitives : des spheres, args = {centres, rayons, origine, direction} */
+static bool hitSphere(uint32_t prim, REAL *tmax, void **args) {
+  const Vector *c = &((Vector *)args[0])[prim];
+  REAL r = ((REAL *)args[1])[prim];
+  const Vector *o = args[2], *d = args[3];
+  Vector oc;
+  VECT_Sub(&oc, o, c);
+  REAL a = VECT_NormSquare(d), b = VECT_DotProduct(&oc, d);
+  REAL delta = b * b - a * (VECT_NormSquare(&oc) - r * r);
+  if (delta < 0)
+    return false;
+  REAL t = (-b - sqrt(delta)) / a;
+  if (t <= 0 || t >= *tmax)
+    return false;
+  *tmax = t;
+  return true;
+}
+
+int main() {
+  Vector centers[NB_PRIMS];
+  REAL radius[NB_PRIMS];
+  Box3 boxes[NB_PRIMS];
+
+  srand(42);
+  for (int i = 0; i < NB_PRIMS; i++) {
+    VECT_Set(&centers[i], rand() % 1000 / 10., rand() % 1000 / 10.,
+             rand() % 1000 / 10.);
+    radius[i] = 0.5 + rand() % 30 / 10.;
+    Vector r = {radius[i], radius[i], radius[i]}, p;
+    BOX3_Reset(&boxes[i]);
+    BOX3_AddPoint(&boxes[i], VECT_Sub(&p, &centers[i], &r));
+    BOX3_AddPoint(&boxes[i], VECT_Add(&p, &centers[i], &r));
+  }
+
+  Bvh *bvh = BVH_Build(boxes, NB_PRIMS);
+  assert(bvh->nbNodes > 1 && bvh->nbNodes <= 2 * NB_PRIMS - 1);
+
+  // Chaque primitive apparait une et une seule fois dans les feuilles
+  unsigned seen[NB_PRIMS] = {0};
+  for (uint32_t i = 0; i < bvh->nbNodes; i++)
+    for (uint32_t j = 0; j < bvh->nodes[i].count; j++)
+      seen[bvh->indices[bvh->nodes[i].start + j]]++;
+  for (int i = 0; i < NB_PRIMS; i++)
+    assert(seen[i] == 1);
+
+  // Meme plus proche intersection que la recherche exhaustive
+  for (int i = 0; i < 2000; i++) {
+    Vector o = {-20, rand() % 1400 / 10. - 20, rand() % 1400 / 10. - 20};
+    Vector d = {1, rand() % 200 / 100. - 1, rand() % 200 / 100. - 1};
+    if (i % 3 == 0)
+      d.y = 0; // Rayons paralleles a un axe
+    void *args[4] = {centers, radius, &o, &d};
+
+    REAL tBvh = INFINITY, tRef = INFINITY;
+    bool hitBvh = BVH_Intersect(bvh, &o, &d, &tBvh, hitSphere, args);
+    bool hitRef = false;
+    for (uint32_t p = 0; p < NB_PRIMS; p++)
+      hitRef |= hitSphere(p, &tRef, args);
+
+    assert(hitBvh == hitRef);
+    assert(tBvh == tRef);
+  }
+
+  BVH_Free(bvh);
+
+  // Hierarchie vide
+  bvh = BVH_Build(NULL, 0);
+  REAL t = INFINITY;
+  Vector o = {0, 0, 0};
+  assert(!BVH_Intersect(bvh, &o, &VECT_X, &t, hitSphere, NULL));
+  BVH_Free(bvh);
+
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include "parsers/parser.h"
+#include "render.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIZE 200
+
+static color *copyRaster(const struct Render *rd) {
+  size_t size = sizeof(color) * SIZE * SIZE;
+  color *copy = malloc(size);
+  assert(copy);
+  return memcpy(copy, rd->raster->data, size);
+}
+
+static bool isRasterEqual(const struct Render *rd, const color *ref) {
+  return !memcmp(rd->raster->data, ref, sizeof(color) * SIZE * SIZE);
+}
+
+/*
+ * Suivi des modifications : une camera et des meshs inchanges ne recalculent
+ * rien, la face surlignee seule ne reombre que ses pixels et donne la meme
+ * image qu'un rendu complet
+ */
+int main() {
+  unsigned nbMeshes;
+  struct Mesh **meshes = PARSER_Load("data/monkey.obj", &nbMeshes);
+  assert(meshes && nbMeshes == 1);
+  Mesh *mesh = meshes[0];
+  struct Render *rd = RD_Init(SIZE, SIZE);
+  RD_AddMesh(rd, mesh);
+  RD_CalcNormales(rd);
+  struct RenderDeferred params = {.shading = RD_SHADING_NORMALS,
+                                  .background = (color)0xFF000000,
+                                  .negate = true};
+  Vector pos = {3, 2, 3};
+  RD_SetCam(rd, &pos, &pos, NULL);
+  RD_CalcProjectionVertices(rd);
+  RD_RenderDeferred(rd, &params);
+  color *plain = copyRaster(rd);
+
+  // Meme camera : rien ne change
+  uint32_t camVersion = rd->camVersion, sceneVersion = rd->sceneVersion;
+  Vector same = pos;
+  RD_SetCam(rd, &same, &same, NULL);
+  RD_CalcProjectionVertices(rd);
+  assert(rd->camVersion == camVersion && rd->sceneVersion == sceneVersion);
+  assert(rd->stats.nbMeshsReused == 1);
+  RD_RenderDeferred(rd, &params);
+  assert(isRasterEqual(rd, plain));
+
+  // Face surlignee : celle du centre de l'ecran
+  rd->highlightedFace = *(MeshFace **)MATRIX_Edit(rd->fbuffer, SIZE / 2,
+                                                   SIZE / 2);
+  assert(rd->highlightedFace);
+  RD_RenderDeferred(rd, &params);
+  assert(rd->sceneVersion == sceneVersion && !isRasterEqual(rd, plain));
+  color *partial = copyRaster(rd);
+  mesh->version++; // Force un rendu complet
+  RD_CalcProjectionVertices(rd);
+  assert(rd->sceneVersion != sceneVersion);
+  RD_RenderDeferred(rd, &params);
+  assert(isRasterEqual(rd, partial));
+
+  // Retour sans surlignage, puis autres parametres sans rasteriser
+  rd->highlightedFace = NULL;
+  RD_RenderDeferred(rd, &params);
+  assert(isRasterEqual(rd, plain));
+  params.negate = false;
+  RD_RenderDeferred(rd, &params);
+  assert(!isRasterEqual(rd, plain));
+  params.negate = true;
+  RD_RenderDeferred(rd, &params);
+  assert(isRasterEqual(rd, plain));
+
+  // Faces de dos rejetees : le z buffer est refait, un mode inchange ne
+  // change rien
+  uint32_t zbufferVersion = rd->zbufferVersion;
+  MESH_SetBackfaceCulling(mesh, true);
+  RD_CalcProjectionVertices(rd);
+  RD_RenderDeferred(rd, &params);
+  assert(rd->zbufferVersion != zbufferVersion);
+  uint32_t version = mesh->version;
+  MESH_SetBackfaceCulling(mesh, true);
+  assert(mesh->version == version);
+  MESH_SetBackfaceCulling(mesh, false);
+  RD_CalcProjectionVertices(rd);
+  RD_RenderDeferred(rd, &params);
+  assert(isRasterEqual(rd, plain));
+
+  // Camera deplacee
+  pos.x += 0.1;
+  RD_SetCam(rd, &pos, &pos, NULL);
+  assert(rd->camVersion != camVersion);
+  RD_CalcProjectionVertices(rd);
+  assert(rd->stats.nbMeshsReused == 0);
+  RD_RenderDeferred(rd, &params);
+  assert(!isRasterEqual(rd, plain));
+  free(plain);
+  free(partial);
+  return 0;
+}
@@ -0,0 +1,78 @@
+#include "parsers/parser.h"
+#include "render.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+#define SIZE 200
+
+/*
+ * Rend la vue et retourne le nombre de pixels couverts
+ */
+static unsigned renderCoverage(struct Render *rd) {
+  struct RenderDeferred params = {.shading = RD_SHADING_NORMALS,
+                                  .background = (color)0xFF000000};
+  RD_CalcProjectionVertices(rd);
+  RD_RenderDeferred(rd, &params);
+  unsigned nb = 0;
+  for (uint32_t y = 0; y < rd->raster->ymax; y++)
+    for (uint32_t x = 0; x < rd->raster->xmax; x++)
+      nb += *(MeshFace **)MATRIX_Edit(rd->fbuffer, x, y) != NULL;
+  return nb;
+}
+
+/*
+ * Resolution interne : le raster reduit couvre la meme part de l'ecran, le
+ * controle du temps d'image la baisse ou la remonte selon le budget
+ */
+int main() {
+  unsigned nbMeshes;
+  struct Mesh **meshes = PARSER_Load("data/monkey.obj", &nbMeshes);
+  assert(meshes && nbMeshes == 1);
+  struct Render *rd = RD_Init(SIZE, SIZE);
+  RD_AddMesh(rd, meshes[0]);
+  RD_CalcNormales(rd);
+  Vector pos = {3, 2, 3};
+  RD_SetCam(rd, &pos, &pos, NULL);
+  unsigned full = renderCoverage(rd);
+
+  Matrix *raster = rd->raster;
+  RD_SetResolution(rd, SIZE / 2, SIZE / 2);
+  assert(rd->raster == raster && raster->xmax == SIZE / 2);
+  assert(rd->outputX == SIZE && rd->outputY == SIZE);
+  unsigned half = renderCoverage(rd);
+  printf("coverage: %u at %u, %u at %u\n", full, SIZE, half, SIZE / 2);
+  assert(fabs(4.0 * half / full - 1) < 0.05);
+  RD_SetResolution(rd, SIZE, SIZE);
+  assert(renderCoverage(rd) == full);
+
+  // Temps d'image donnes : 4 fois trop lent, l'echelle est divisee par 2
+  RD_SetFrameBudget(rd, 0.01);
+  assert(!RD_AdaptResolutionTime(rd, 0));
+  assert(RD_AdaptResolutionTime(rd, 0.04));
+  assert(rd->scale == 0.5 && raster->xmax == SIZE / 2);
+  assert(rd->frameTime == 0);
+  renderCoverage(rd);
+  // Dans la tolerance, lissage compris : rien ne bouge
+  for (int i = 0; i < 8; i++)
+    assert(!RD_AdaptResolutionTime(rd, i % 2 ? 0.0095 : 0.0105));
+  assert(raster->xmax == SIZE / 2);
+  // Un pic isole est amorti par la moyenne
+  assert(!RD_AdaptResolutionTime(rd, 0.0125));
+  // 4 fois trop rapide : retour a la taille de sortie, jamais au-dela
+  RD_SetFrameBudget(rd, 0.01);
+  assert(RD_AdaptResolutionTime(rd, 0.0025));
+  assert(rd->scale == 1 && raster->xmax == SIZE && raster->ymax == SIZE);
+  assert(!RD_AdaptResolutionTime(rd, 0.001));
+  // Budget intenable : echelle minimale
+  assert(RD_AdaptResolutionTime(rd, 1));
+  assert(rd->scale == RD_DYNRES_MIN_SCALE);
+  assert(raster->xmax == SIZE * RD_DYNRES_MIN_SCALE);
+  renderCoverage(rd);
+  printf("scale %.2f: %ux%u\n", rd->scale, raster->xmax, raster->ymax);
+  assert(!RD_AdaptResolutionTime(rd, 1));
+  RD_SetFrameBudget(rd, 0);
+  assert(raster->xmax == SIZE && raster->ymax == SIZE);
+  assert(renderCoverage(rd) == full);
+  return 0;
+}
@@ -0,0 +1,123 @@
+#include "parsers/parser.h"
+#include "render.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+#define SIZE 200
+// Erreur tolere sur les normales, selon la precision (cf GEO_PRECISION)
+#define TOLERANCE (sizeof(REAL) == sizeof(double) ? 1e-6 : 1e-4)
+
+/*
+ * Normale exacte au point de la face vu par le pixel (x, y) : intersection du
+ * rayon avec le plan de la face puis barycentres dans le monde
+ */
+static void exactNormal(struct Render *rd, const MeshFace *f, unsigned x,
+                        unsigned y, Vector *out) {
+  const Mesh *mesh = rd->meshs[0];
+  size_t i_face = MESH_GetFaceIndex(mesh, f);
+  const MeshVertex *p0 = MESH_GetFaceVertex(mesh, i_face, 0);
+  const MeshVertex *p1 = MESH_GetFaceVertex(mesh, i_face, 1);
+  const MeshVertex *p2 = MESH_GetFaceVertex(mesh, i_face, 2);
+  Vector q0, q1, q2, ray, e1, e2, nf, op, xa, c1, c2;
+  MESH_GetFaceVertexPos(mesh, i_face, 0, &q0);
+  MESH_GetFaceVertexPos(mesh, i_face, 1, &q1);
+  MESH_GetFaceVertexPos(mesh, i_face, 2, &q2);
+  RD_CalcRayDir(rd, x, y, &ray);
+  VECT_Sub(&e1, &q1, &q0);
+  VECT_Sub(&e2, &q2, &q0);
+  VECT_CrossProduct(&nf, &e1, &e2);
+  VECT_Sub(&op, &q0, &rd->cam_pos);
+  double t = VECT_DotProduct(&nf, &op) / VECT_DotProduct(&nf, &ray);
+  Vector hit = {rd->cam_pos.x + t * ray.x, rd->cam_pos.y + t * ray.y,
+                rd->cam_pos.z + t * ray.z};
+
+  double nn = VECT_DotProduct(&nf, &nf);
+  VECT_Sub(&xa, &hit, &q0);
+  VECT_CrossProduct(&c1, &xa, &e2);
+  VECT_CrossProduct(&c2, &e1, &xa);
+  double w1 = VECT_DotProduct(&c1, &nf) / nn;
+  double w2 = VECT_DotProduct(&c2, &nf) / nn;
+  double w0 = 1 - w1 - w2;
+  out->x = w0 * p0->normal.x + w1 * p1->normal.x + w2 * p2->normal.x;
+  out->y = w0 * p0->normal.y + w1 * p1->normal.y + w2 * p2->normal.y;
+  out->z = w0 * p0->normal.z + w1 * p1->normal.z + w2 * p2->normal.z;
+  VECT_Normalise(out);
+}
+
+/*
+ * Rend la vue et retourne le nombre de pixels dessines, leur normale doit etre
+ * exacte. Si other n'est pas NULL, il est rendu entre le z buffer et le g
+ * buffer de rd.
+ */
+static unsigned checkView(struct Render *rd, struct Vector cam_pos,
+                          struct Vector cam_forward, struct Render *other) {
+  RD_SetCam(rd, &cam_pos, &cam_forward, NULL);
+  RD_CalcProjectionVertices(rd);
+  RD_CalcZbuffer(rd);
+  if (other) {
+    RD_CalcProjectionVertices(other);
+    RD_CalcZbuffer(other);
+  }
+  RD_CalcGbuffer(rd);
+
+  unsigned nbPixels = 0;
+  double maxErr = 0;
+  for (unsigned y = 0; y < SIZE; y++) {
+    for (unsigned x = 0; x < SIZE; x++) {
+      MeshFace *f = *(MeshFace **)MATRIX_Edit(rd->fbuffer, x, y);
+      if (!f)
+        continue;
+      Vector n;
+      exactNormal(rd, f, x, y, &n);
+      double err = sqrt(VECT_DistanceSquare(&n, MATRIX_Edit(rd->gbuffer, x, y)));
+      maxErr = err > maxErr ? err : maxErr;
+      nbPixels++;
+    }
+  }
+  printf("pixels: %u, max error: %g\n", nbPixels, maxErr);
+  assert(maxErr < TOLERANCE);
+  return nbPixels;
+}
+
+/*
+ * Cube vu de pres et de biais puis de l'interieur (faces coupees par le plan
+ * proche) : l'interpolation des normales du g buffer doit etre correcte en
+ * perspective et l'interieur entierement couvert
+ */
+int main() {
+  struct Render *rd = RD_Init(SIZE, SIZE);
+  unsigned nbMeshes;
+  struct Mesh **meshes = PARSER_Load("data/cube.obj", &nbMeshes);
+  assert(meshes);
+  assert(nbMeshes == 1);
+  for (unsigned i = 0; i < nbMeshes; i++)
+    RD_AddMesh(rd, meshes[i]);
+  RD_CalcNormales(rd);
+
+  assert(checkView(rd, (Vector){0.8, 1.3, 1.9}, (Vector){0.8, 1.3, 1.9},
+                   NULL) > SIZE * SIZE / 4);
+  assert(checkView(rd, (Vector){0.3, -0.2, 0.1}, (Vector){1, 0.5, 2}, NULL) ==
+         SIZE * SIZE);
+
+  // Un second rendu du meme mesh, sous un autre angle, ne change pas les plans
+  // d'interpolation du premier
+  struct Render *other = RD_Init(SIZE, SIZE);
+  RD_AddMesh(other, meshes[0]);
+  RD_SetCam(other, &(Vector){-1.5, 0.7, 2.2}, &(Vector){-1.5, 0.7, 2.2}, NULL);
+  assert(checkView(rd, (Vector){1.9, 0.6, -1.2}, (Vector){1.9, 0.6, -1.2},
+                   other) > SIZE * SIZE / 4);
+
+  // Face de front seule visible : profondeur uniforme, une seule teinte
+  RD_SetCam(rd, &(Vector){0, 0, 5}, &(Vector){0, 0, 1}, NULL);
+  RD_CalcProjectionVertices(rd);
+  RD_CalcZbuffer(rd);
+  RASTER_DrawFill(rd->raster, CL_BLACK);
+  RD_DrawZbuffer(rd);
+  const color *px = (color *)rd->raster->data;
+  const color *center = &px[SIZE / 2 * SIZE + SIZE / 2];
+  assert(center->raw == CL_WHITE.raw);
+  for (unsigned i = 0; i < SIZE * SIZE; i++)
+    assert(px[i].raw == center->raw || px[i].raw == CL_BLACK.raw);
+  return 0;
+}
@@ -0,0 +1,168 @@
+#include "colornames.h"
+#include "mesh.h"
+#include "parsers/parser.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Les clusters partitionnent les faces en intervalles contigus, leurs bornes
+ * englobent les sommets de leurs faces
+ */
+static void checkClusters(const Mesh *mesh, size_t nbFaces) {
+  assert(MESH_GetNbFace(mesh) == nbFaces);
+  assert(mesh->nbClusters > 1 && mesh->clusters[0].start == 0);
+  for (uint32_t k = 0; k < mesh->nbClusters; k++) {
+    const MeshCluster *cl = &mesh->clusters[k];
+    assert(cl->end > cl->start && cl->end - cl->start <= MESH_CLUSTER_MAX_FACES);
+    assert(k + 1 == mesh->nbClusters ? cl->end == nbFaces
+                                     : cl->end == cl[1].start);
+    for (uint32_t i = cl->start; i < cl->end; i++) {
+      for (int j = 0; j < 3; j++) {
+        Vector q, *p = MESH_GetFaceVertexPos(mesh, i, j, &q);
+        assert(p->x >= cl->box.min.x && p->x <= cl->box.max.x);
+        assert(p->y >= cl->box.min.y && p->y <= cl->box.max.y);
+        assert(p->z >= cl->box.min.z && p->z <= cl->box.max.z);
+        assert(VECT_DistanceSquare(p, &cl->center) <=
+               cl->radius * cl->radius * (1 + 1e-4));
+      }
+    }
+  }
+}
+
+/*
+ * Adjacence comparee a une recherche exhaustive, puis normales des sommets
+ * du cube : la ponderation par les angles les rend independantes de la
+ * triangulation des faces, elles pointent vers les coins
+ */
+int main() {
+  unsigned nbMeshes;
+  struct Mesh **meshes = PARSER_Load("data/icosphere-320.obj", &nbMeshes);
+  assert(meshes && nbMeshes == 1);
+  Mesh *mesh = meshes[0];
+  MESH_CalcAdjacency(mesh);
+  for (size_t iv = 0; iv < MESH_GetNbVertice(mesh); iv++) {
+    uint32_t nb;
+    const uint32_t *faces = MESH_GetVertexFaces(mesh, iv, &nb);
+    uint32_t k = 0;
+    for (size_t i = 0; i < MESH_GetNbFace(mesh); i++) {
+      const uint32_t *idx = MESH_GetFaceIndices(mesh, i);
+      if (idx[0] == iv || idx[1] == iv || idx[2] == iv) {
+        assert(k < nb && faces[k] == i); // Faces croissantes
+        k++;
+      }
+    }
+    assert(k == nb);
+  }
+
+  meshes = PARSER_Load("data/cube.obj", &nbMeshes);
+  assert(meshes && nbMeshes == 1);
+  mesh = meshes[0];
+  MESH_CalcVerticesNormales(mesh);
+  for (size_t iv = 0; iv < MESH_GetNbVertice(mesh); iv++) {
+    const MeshVertex *v = MESH_GetVertex(mesh, iv);
+    Vector corner;
+    VECT_Sub(&corner, MESH_GetVertexPos(mesh, iv, &corner), &mesh->box.center);
+    VECT_Normalise(&corner);
+    assert(sqrt(VECT_DistanceSquare(&corner, &v->normal)) < 1e-4);
+  }
+
+  // Un sommet ajoute invalide l'adjacence
+  MESH_AddVertexPos(mesh, 0, 0, 0);
+  assert(!mesh->vertexFacesStart);
+
+  // Fusion : les sommets proches (meme de part et d'autre d'une cellule)
+  // reprennent l'indice existant, les triangles degeneres sont ignores
+  mesh = MESH_Init();
+  MESH_SetWeld(mesh, 0.01);
+  uint32_t a = MESH_AddVertexPos(mesh, 0, 0, 0);
+  uint32_t b = MESH_AddVertexPos(mesh, 1, 0, 0);
+  uint32_t c = MESH_AddVertexPos(mesh, 0, 1, 0);
+  assert(MESH_AddVertexPos(mesh, 0.004, -0.003, 0.002) == a);
+  assert(MESH_AddVertexPos(mesh, 0.999, 0.001, 0) == b);
+  assert(MESH_AddVertexPos(mesh, 0, 1.02, 0) != c);
+  for (unsigned i = 0; i < 1000; i++) // Force le rehachage
+    MESH_AddVertexPos(mesh, i, 5, 0);
+  assert(MESH_AddVertexPos(mesh, -0.001, 0.9995, 0.001) == c);
+  assert(MESH_GetNbVertice(mesh) == 1004 && mesh->nbWelded == 3);
+  uint32_t quad[4] = {a, b, b, c};
+  MESH_AddPolygon(mesh, quad, 4, CL_GRAY);
+  assert(MESH_GetNbFace(mesh) == 1);
+  // Le plus proche l'emporte, quel que soit l'ordre d'insertion
+  uint32_t d = MESH_AddVertexPos(mesh, 0.015, 0, 0);
+  assert(d != a && MESH_AddVertexPos(mesh, 0.009, 0, 0) == d);
+  // Un sommet deplace est retrouve a sa nouvelle place seulement
+  Vector moved = {3, 3, 3};
+  MESH_SetVertexPos(mesh, d, &moved);
+  assert(MESH_AddVertexPos(mesh, 3.001, 3, 3) == d);
+  assert(MESH_AddVertexPos(mesh, 0.009, 0, 0) == a);
+  MESH_SetWeld(mesh, -1);
+  assert(MESH_AddVertexPos(mesh, 0, 0, 0) != a);
+
+  // Anciennes fonctions : sommets et faces hors du mesh, copies a l'ajout
+  mesh = MESH_Init();
+  MeshVertex *quadVertices[4] = {
+      MESH_VERT_Init(0, 0, 0), MESH_VERT_Init(1, 0, 0),
+      MESH_VERT_Init(1, 1, 0), MESH_VERT_Init(0, 1, 0)};
+  for (int i = 0; i < 4; i++)
+    assert(MESH_AddVertex(mesh, quadVertices[i]) == quadVertices[i]);
+  unsigned nbQuadFaces;
+  MeshFace **quadFaces =
+      MESH_FACE_FromVertices(quadVertices, 4, &nbQuadFaces, CL_GRAY);
+  assert(nbQuadFaces == 2);
+  MESH_AddFaces(mesh, quadFaces, nbQuadFaces);
+  assert(MESH_GetNbVertice(mesh) == 4 && MESH_GetNbFace(mesh) == 2);
+  const uint32_t *last = MESH_GetFaceIndices(mesh, 1);
+  assert(last[0] == 0 && last[1] == 2 && last[2] == 3);
+  assert(MESH_GetFace(mesh, 1)->color.raw == CL_GRAY.raw);
+  MESH_VERT_Set(quadVertices[2], 2, 2, 0);
+  assert(VECT_Eq(MESH_GetVertexPos(mesh, 2, &moved), &(Vector){2, 2, 0}));
+  for (int i = 0; i < 4; i++)
+    free(quadVertices[i]);
+  for (unsigned i = 0; i < nbQuadFaces; i++)
+    free(quadFaces[i]);
+  free(quadFaces);
+  MESH_Free(mesh);
+
+  // Fichier sans objet
+  PARSER_LoadWelded("data/empty.obj", &nbMeshes, 0.01);
+
+  // Clusters : partition contigue des faces, bornes englobant leurs sommets,
+  // preservee par l'optimisation du cache qui renumerote les sommets dans
+  // l'ordre de premiere utilisation
+  meshes = PARSER_Load("data/monkey.obj", &nbMeshes);
+  assert(meshes && nbMeshes == 1);
+  mesh = meshes[0];
+  size_t nbFaces = MESH_GetNbFace(mesh);
+  MESH_CalcClusters(mesh);
+  checkClusters(mesh, nbFaces);
+  double acmr = MESH_CalcAcmr(mesh);
+  MESH_OptimizeVertexCache(mesh);
+  printf("ACMR %.3f -> %.3f\n", acmr, MESH_CalcAcmr(mesh));
+  assert(MESH_CalcAcmr(mesh) < 0.95 * acmr);
+  checkClusters(mesh, nbFaces);
+  uint32_t nbUsed = 0;
+  for (size_t i = 0; i < nbFaces; i++)
+    for (int k = 0; k < 3; k++)
+      if (MESH_GetFaceIndices(mesh, i)[k] == nbUsed)
+        nbUsed++;
+      else
+        assert(MESH_GetFaceIndices(mesh, i)[k] < nbUsed);
+
+  // Sans clusters, l'ordre du fichier est nettement ameliore
+  meshes = PARSER_Load("data/monkey.obj", &nbMeshes);
+  mesh = meshes[0];
+  acmr = MESH_CalcAcmr(mesh);
+  MESH_OptimizeVertexCache(mesh);
+  assert(MESH_CalcAcmr(mesh) < 0.75 * acmr);
+
+  // Un sommet deplace est relu tel quel, la hierarchie est a recalculer
+  uint32_t version = mesh->version;
+  Vector p = {0.25, 0.5, 0.75}, q;
+  MESH_CalcBvh(mesh);
+  MESH_SetVertexPos(mesh, 0, &p);
+  assert(VECT_Eq(MESH_GetVertexPos(mesh, 0, &q), &p));
+  assert(mesh->version != version && !mesh->bvh);
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include "raster.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SIZE 64
+#define GRID 8
+#define TILE 12
+// Erreur tolere sur les attributs, selon la precision (cf GEO_PRECISION)
+#define TOLERANCE (sizeof(REAL) == sizeof(double) ? 1e-6 : 1e-3)
+
+static void kernelCount(const RasterSpan *span, void **args) {
+  unsigned *count = args[0];
+  assert(span->x0 < span->x1 && span->x1 <= SIZE && span->y < SIZE);
+  for (uint32_t x = span->x0; x < span->x1; x++)
+    count[span->y * SIZE + x]++;
+}
+
+/* L'attribut interpole doit valoir x + 2 y partout */
+static void kernelCheckAttrib(const RasterSpan *span, void **args) {
+  (void)args;
+  assert(span->nbAttribs == 1);
+  for (uint32_t x = span->x0; x < span->x1; x++) {
+    double a = span->attribs[0] + (x - span->x0) * span->steps[0];
+    assert(fabs(a - (x + 2. * span->y)) < TOLERANCE);
+  }
+}
+
+/*
+ * Rasterise le triangle d'un coup ou tuile par tuile (scissor)
+ */
+static void fillTriangle(RasterPos *a, RasterPos *b, RasterPos *c, bool tiled,
+                         void **args) {
+  if (!tiled) {
+    RASTER_GenerateFillTriangle(a, b, c, NULL, NULL, 0, kernelCount, args);
+    return;
+  }
+  for (uint32_t y = 0; y < SIZE; y += TILE) {
+    for (uint32_t x = 0; x < SIZE; x += TILE) {
+      RasterRect tile = {x, y, x + TILE, y + TILE};
+      RASTER_GenerateFillTriangle(a, b, c, &tile, NULL, 0, kernelCount, args);
+    }
+  }
+}
+
+/*
+ * Un carre decoupe en triangles (sommets entiers aleatoires, diagonales et
+ * sens de parcours aleatoires) : la regle haut-gauche doit couvrir chaque
+ * pixel exactement une fois, avec ou sans decoupage en tuiles
+ */
+int main() {
+  static unsigned count[SIZE * SIZE];
+  RasterPos grid[GRID + 1][GRID + 1];
+  void *args[1] = {count};
+
+  srand(42);
+  for (int iter = 0; iter < 20; iter++) {
+    memset(count, 0, sizeof(count));
+    for (int j = 0; j <= GRID; j++) {
+      for (int i = 0; i <= GRID; i++) {
+        // Bords du carre fixes, sommets interieurs perturbes
+        int jx = i == 0 || i == GRID ? 0 : rand() % 5 - 2;
+        int jy = j == 0 || j == GRID ? 0 : rand() % 5 - 2;
+        grid[j][i] = (RasterPos){i * SIZE / GRID + jx, j * SIZE / GRID + jy};
+      }
+    }
+    for (int j = 0; j < GRID; j++) {
+      for (int i = 0; i < GRID; i++) {
+        RasterPos *a = &grid[j][i], *b = &grid[j][i + 1];
+        RasterPos *c = &grid[j + 1][i + 1], *d = &grid[j + 1][i];
+        if (rand() % 2) {
+          fillTriangle(a, b, c, iter % 2, args);
+          fillTriangle(a, d, c, iter % 2, args);
+        } else {
+          fillTriangle(b, a, d, iter % 2, args);
+          fillTriangle(b, c, d, iter % 2, args);
+        }
+      }
+    }
+    for (int k = 0; k < SIZE * SIZE; k++) {
+      if (count[k] != 1)
+        printf("pixel %d %d : %u\n", k % SIZE, k / SIZE, count[k]);
+      assert(count[k] == 1);
+    }
+  }
+
+  // Interpolation lineaire des attributs
+  RasterPos q0 = {3, 50}, q1 = {40, 2}, q2 = {60, 61};
+  REAL attribs[3] = {3 + 2 * 50, 40 + 2 * 2, 60 + 2 * 61};
+  RASTER_GenerateFillTriangle(&q0, &q1, &q2, NULL, attribs, 1,
+                              kernelCheckAttrib, NULL);
+
+  // Triangle degenere : rien
+  memset(count, 0, sizeof(count));
+  RasterPos p0 = {1, 1}, p1 = {10, 10}, p2 = {20, 20};
+  fillTriangle(&p0, &p1, &p2, false, args);
+  for (int k = 0; k < SIZE * SIZE; k++)
+    assert(count[k] == 0);
+  return 0;
+}
@@ -0,0 +1,105 @@
+#include "parsers/parser.h"
+#include "render.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#define SIZE 400
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * Distance de x au bord le plus proche de la face
+ */
+static double edgeDistance(struct Mesh *mesh, const struct MeshFace *face,
+                           const Vector *x) {
+  Mesh *lod = MESH_GetLod(mesh);
+  size_t i_face = MESH_GetFaceIndex(lod, face);
+  Vector p[3];
+  for (unsigned k = 0; k < 3; k++)
+    MESH_GetFaceVertexPos(lod, i_face, k, &p[k]);
+  double best = INFINITY;
+  for (unsigned k = 0; k < 3; k++) {
+    Vector e, d, q;
+    VECT_Sub(&e, &p[(k + 1) % 3], &p[k]);
+    VECT_Sub(&d, x, &p[k]);
+    double t = VECT_DotProduct(&d, &e) / VECT_NormSquare(&e);
+    t = t < 0 ? 0 : t > 1 ? 1 : t;
+    VECT_Add(&q, &p[k], VECT_MultSca(&e, &e, t));
+    best = fmin(best, sqrt(VECT_DistanceSquare(&q, x)));
+  }
+  return best;
+}
+
+/*
+ * Compare le lancer de rayons scalaire et par paquets sur les rayons
+ * primaires, et affiche le debit de chacun (significatif seulement en -O2,
+ * cf README). En float, les deux donnent exactement les memes faces.
+ */
+int main() {
+  struct Render *rd = RD_Init(SIZE, SIZE);
+  unsigned nbMeshes;
+  struct Mesh **meshes = PARSER_Load("data/monkey.obj", &nbMeshes);
+  assert(meshes);
+  for (unsigned i = 0; i < nbMeshes; i++)
+    RD_AddMesh(rd, meshes[i]);
+  RD_CalcBvh(rd);
+
+  struct Vector cam_pos = {1.5, 1, 2}, cam_forward;
+  VECT_Sub(&cam_forward, &cam_pos, &meshes[0]->box.center);
+  RD_SetCam(rd, &cam_pos, &cam_forward, NULL);
+
+  static struct Vector rays[SIZE * SIZE], xs[SIZE * SIZE], xp[SIZE * SIZE];
+  static struct Mesh *ms[SIZE * SIZE], *mp[SIZE * SIZE];
+  static struct MeshFace *fs[SIZE * SIZE], *fp[SIZE * SIZE];
+  static bool hs[SIZE * SIZE], hp[SIZE * SIZE];
+  unsigned nbRays = SIZE * SIZE, nbHits = 0, nbMismatch = 0;
+  for (unsigned y = 0; y < SIZE; y++)
+    for (unsigned x = 0; x < SIZE; x++)
+      RD_CalcRayDir(rd, x, y, &rays[y * SIZE + x]);
+
+  double t0 = now();
+  for (unsigned i = 0; i < nbRays; i++)
+    hs[i] = RD_RayCastOnRD(rd, &rays[i], &xs[i], &ms[i], &fs[i]);
+  double tScalar = now() - t0;
+
+  t0 = now();
+  for (unsigned i = 0; i < nbRays; i += PACKET_SIZE) {
+    unsigned mask = RD_RayCastPacket(rd, &rays[i], PACKET_SIZE, &xp[i], &mp[i],
+                                     &fp[i]);
+    for (unsigned j = 0; j < PACKET_SIZE; j++)
+      hp[i + j] = mask & (1u << j);
+  }
+  double tPacket = now() - t0;
+
+  for (unsigned i = 0; i < nbRays; i++) {
+    if (hp[i] != hs[i] || (hp[i] && fp[i] != fs[i])) {
+      // Les paquets calculent en float : en double, un rayon a l'arrondi
+      // pres d'une arete peut toucher la face voisine, passer a cote ou
+      // derriere. L'une des deux faces est alors touchee sur son bord.
+      assert(sizeof(REAL) != sizeof(float));
+      double d = INFINITY;
+      if (hs[i])
+        d = edgeDistance(ms[i], fs[i], &xs[i]);
+      if (hp[i])
+        d = fmin(d, edgeDistance(mp[i], fp[i], &xp[i]));
+      assert(d < 1e-5);
+      nbMismatch++;
+    } else if (hp[i]) {
+      nbHits++;
+      assert(sqrt(VECT_DistanceSquare(&xs[i], &xp[i])) < 1e-3);
+    }
+  }
+
+  printf("rays: %u, hits: %u, mismatches: %u\n", nbRays, nbHits, nbMismatch);
+  printf("scalar: %.2f Mrays/s\n", nbRays / tScalar * 1e-6);
+  printf("packet (%d): %.2f Mrays/s\n", PACKET_SIZE, nbRays / tPacket * 1e-6);
+  assert(nbHits > nbRays / 10);
+  assert(nbMismatch <= nbRays / 1000);
+  return 0;
+}
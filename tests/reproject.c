@@ -0,0 +1,136 @@
+#include "parsers/parser.h"
+#include "render.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SIZE 200
+#define MAX_AGE 8
+
+static void orbit(struct Render *rd, double angle) {
+  Vector pos = {3 * cos(angle), 1.5, 3 * sin(angle)};
+  RD_SetCam(rd, &pos, &pos, NULL);
+}
+
+static unsigned countDiff(const struct Render *a, const struct Render *b) {
+  const color *pa = (color *)a->raster->data, *pb = (color *)b->raster->data;
+  unsigned nb = 0;
+  for (unsigned i = 0; i < SIZE * SIZE; i++)
+    nb += pa[i].raw != pb[i].raw;
+  return nb;
+}
+
+/*
+ * Historique du raytracing : une camera fixe ne relance aucun rayon, une
+ * camera qui tourne peu n'en relance qu'une fraction pour une image proche du
+ * rendu complet, les pixels expirent apres MAX_AGE images, un mesh modifie
+ * relance tout et un point cache par un objet plus proche n'est pas repris
+ */
+int main() {
+  unsigned nbMeshes;
+  struct Mesh **meshes = PARSER_Load("data/monkey.obj", &nbMeshes);
+  assert(meshes && nbMeshes == 1);
+  struct Render *rd = RD_Init(SIZE, SIZE), *ref = RD_Init(SIZE, SIZE);
+  RD_AddMesh(rd, meshes[0]);
+  RD_AddMesh(ref, meshes[0]);
+  RD_CalcBvh(rd);
+  RD_CalcBvh(ref);
+  RD_SetRaytracingHistory(rd, MAX_AGE);
+
+  double angle = 0.3;
+  orbit(rd, angle);
+  orbit(ref, angle);
+  RD_DrawRaytracing(ref);
+  RD_DrawRaytracing(rd);
+  assert(rd->stats.nbRaysTraced == SIZE * SIZE);
+  assert(countDiff(rd, ref) == 0);
+
+  // Camera fixe, face surlignee : tout est repris
+  rd->highlightedMesh = ref->highlightedMesh = meshes[0];
+  rd->highlightedFace = ref->highlightedFace = MESH_GetFace(meshes[0], 0);
+  RD_DrawRaytracing(ref);
+  RD_DrawRaytracing(rd);
+  assert(rd->stats.nbRaysTraced == 0);
+  assert(rd->stats.nbPixelsReprojected == SIZE * SIZE);
+  // Un rayon d'occlusion par point repris, aucun pour le vide
+  assert(rd->stats.nbOcclusionRays > 0);
+  assert(rd->stats.nbOcclusionRays < SIZE * SIZE);
+  assert(countDiff(rd, ref) == 0);
+  rd->highlightedFace = ref->highlightedFace = NULL;
+
+  // Camera en rotation
+  unsigned traced = 0, occlusion = 0, diff = 0;
+  for (int i = 0; i < MAX_AGE; i++) {
+    angle += 0.02;
+    orbit(rd, angle);
+    orbit(ref, angle);
+    RD_DrawRaytracing(ref);
+    RD_DrawRaytracing(rd);
+    traced += rd->stats.nbRaysTraced;
+    occlusion += rd->stats.nbOcclusionRays;
+    diff += countDiff(rd, ref);
+  }
+  assert(traced < MAX_AGE * SIZE * SIZE / 2);
+  assert(diff < MAX_AGE * SIZE * SIZE / 200);
+
+  // Camera fixe : chaque pixel est relance une fois en MAX_AGE + 1 images
+  unsigned staticTraced = 0;
+  for (int i = 0; i <= MAX_AGE; i++) {
+    RD_DrawRaytracing(rd);
+    staticTraced += rd->stats.nbRaysTraced;
+  }
+  assert(staticTraced == SIZE * SIZE);
+  assert(countDiff(rd, ref) == 0);
+
+  // Mesh modifie
+  meshes[0]->version++;
+  RD_DrawRaytracing(rd);
+  assert(rd->stats.nbRaysTraced == SIZE * SIZE);
+
+  // Rayons un par un
+  rd->raytracingPackets = ref->raytracingPackets = false;
+  angle += 0.02;
+  orbit(rd, angle);
+  orbit(ref, angle);
+  RD_DrawRaytracing(ref);
+  RD_DrawRaytracing(rd);
+  assert(rd->stats.nbRaysTraced < SIZE * SIZE / 2);
+  assert(countDiff(rd, ref) < SIZE * SIZE / 200);
+
+  // Cube passant derriere la camera en reculant, devant le mesh : les points
+  // qu'il cache sont relances, seuls des pixels dans le vide peuvent rester
+  // jusqu'a leur expiration
+  struct Mesh **cube = PARSER_Load("data/cube.obj", &nbMeshes);
+  assert(cube && nbMeshes == 1);
+  for (unsigned i = 0; i < MESH_GetNbVertice(cube[0]); i++) {
+    Vector p;
+    MESH_GetVertexPos(cube[0], i, &p);
+    Vector q = {0.01 * p.x, 0.01 * p.y, 0.01 * p.z + 2.3};
+    MESH_SetVertexPos(cube[0], i, &q);
+  }
+  for (unsigned i = 0; i < MESH_GetNbFace(cube[0]); i++)
+    MESH_GetFace(cube[0], i)->color = CL_rgb(255, 0, 0);
+  RD_AddMesh(rd, cube[0]);
+  RD_AddMesh(ref, cube[0]);
+  RD_CalcBvh(rd);
+  RD_CalcBvh(ref);
+  unsigned hidden = 0;
+  for (int i = 0; i < 8; i++) {
+    Vector pos = {0, 0, 2.2 + 0.02 * i}, dir = {0, 0, 1};
+    RD_SetCam(rd, &pos, &dir, NULL);
+    RD_SetCam(ref, &pos, &dir, NULL);
+    RD_DrawRaytracing(ref);
+    RD_DrawRaytracing(rd);
+    const color *pa = (color *)rd->raster->data;
+    const color *pb = (color *)ref->raster->data;
+    for (unsigned j = 0; j < SIZE * SIZE; j++)
+      hidden += pa[j].raw != pb[j].raw && pa[j].raw != CL_BLACK.raw;
+  }
+  assert(hidden == 0);
+  printf("rotation: %u rays + %u occlusion rays/frame, %u pixels differ/frame, "
+         "static: %u rays in %d frames\n",
+         traced / MAX_AGE, occlusion / MAX_AGE, diff / MAX_AGE, staticTraced,
+         MAX_AGE + 1);
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include "parsers/parser.h"
+#include "render.h"
+#include "simplify.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+/*
+ * Nombre d'aretes du mesh partagees par exactement deux faces (recherche
+ * exhaustive, le mesh est petit)
+ */
+static size_t countManifoldEdges(const Mesh *mesh) {
+  size_t nb = 0;
+  for (size_t i = 0; i < MESH_GetNbFace(mesh); i++) {
+    const uint32_t *a = MESH_GetFaceIndices(mesh, i);
+    for (int k = 0; k < 3; k++) {
+      uint32_t p0 = a[k], p1 = a[(k + 1) % 3];
+      unsigned shared = 0;
+      for (size_t j = 0; j < MESH_GetNbFace(mesh); j++) {
+        const uint32_t *b = MESH_GetFaceIndices(mesh, j);
+        for (int l = 0; l < 3; l++)
+          shared += b[l] == p1 && b[(l + 1) % 3] == p0;
+      }
+      nb += shared == 1;
+    }
+  }
+  return nb;
+}
+
+/*
+ * Sphere fermee simplifiee : elle reste fermee et orientee (chaque arete a sa
+ * jumelle), dans sa boite et proche de la sphere. Puis chaine de niveaux de
+ * detail du singe et choix du niveau selon la distance de la camera.
+ */
+int main() {
+  unsigned nbMeshes;
+  struct Mesh **meshes = PARSER_Load("data/icosphere-320.obj", &nbMeshes);
+  assert(meshes && nbMeshes == 1);
+  Mesh *sphere = meshes[0];
+  Mesh *simple = SIMPLIFY_Mesh(sphere, 80);
+  size_t nbFaces = MESH_GetNbFace(simple);
+  printf("sphere: %zu -> %zu faces\n", MESH_GetNbFace(sphere), nbFaces);
+  assert(nbFaces <= 80 && nbFaces >= 40);
+  assert(countManifoldEdges(simple) == 3 * nbFaces);
+  assert(MESH_GetNbVertice(simple) == nbFaces / 2 + 2); // Euler
+  for (size_t i = 0; i < MESH_GetNbVertice(simple); i++) {
+    Vector q, *p = MESH_GetVertexPos(simple, i, &q);
+    const Vector *min = &sphere->box.min, *max = &sphere->box.max;
+    assert(p->x >= min->x - 1e-6 && p->y >= min->y - 1e-6 &&
+           p->z >= min->z - 1e-6);
+    assert(p->x <= max->x + 1e-6 && p->y <= max->y + 1e-6 &&
+           p->z <= max->z + 1e-6);
+    assert(fabs(sqrt(VECT_NormSquare(p)) - 0.5) < 0.08);
+  }
+  MESH_Free(simple);
+
+  meshes = PARSER_Load("data/monkey.obj", &nbMeshes);
+  assert(meshes && nbMeshes == 1);
+  Mesh *monkey = meshes[0];
+  SIMPLIFY_CalcLods(monkey);
+  assert(monkey->nbLods >= 1);
+  for (unsigned i = 0; i < monkey->nbLods; i++) {
+    size_t nbPrev = MESH_GetNbFace(i ? monkey->lods[i - 1] : monkey);
+    assert(MESH_GetNbFace(monkey->lods[i]) <= nbPrev * SIMPLIFY_LOD_RATIO);
+  }
+
+  struct Render *rd = RD_Init(200, 200);
+  RD_AddMesh(rd, monkey);
+  RD_CalcNormales(rd);
+  Vector forward = {1, 1, 1}; // Oppose a la direction de visee
+  RD_SetCam(rd, &(Vector){3, 3, 3}, &forward, NULL);
+  RD_CalcProjectionVertices(rd);
+  RD_CalcZbuffer(rd);
+  assert(monkey->lod == 0);
+  assert(rd->stats.nbFacesDrawn == rd->stats.nbFacesLoaded);
+  RD_SetCam(rd, &(Vector){60, 60, 60}, &forward, NULL);
+  RD_CalcProjectionVertices(rd);
+  RD_CalcZbuffer(rd);
+  assert(monkey->lod == monkey->nbLods);
+  assert(rd->stats.nbFacesDrawn < rd->stats.nbFacesLoaded);
+  RD_DrawRaytracing(rd);
+  assert(monkey->lod == monkey->nbLods);
+  return 0;
+}